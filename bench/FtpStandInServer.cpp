@@ -0,0 +1,609 @@
+// Minimal FTP server on loopback for the native bench build. Keeps files in memory.
+#include "FtpStandInServer.hpp"
+
+#include <string.h>
+#include <stdio.h>
+#include <chrono>
+#include <stdlib.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+static bool SendAll(int fd, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t result = send(fd, data, length, MSG_NOSIGNAL);
+    if (result <= 0)
+      return false;
+    data += result;
+    length -= result;
+  }
+  return true;
+}
+
+/// @brief "YYYYMMDDHHMMSS" in UTC, the time format of MLSD and MDTM
+static std::string FtpTime(time_t time)
+{
+  struct tm fields;
+  char text[16];
+  gmtime_r(&time, &fields);
+  strftime(text, sizeof(text), "%Y%m%d%H%M%S", &fields);
+  return text;
+}
+
+static bool SendReply(int fd, const std::string &reply)
+{
+  std::string line = reply + "\r\n";
+  return SendAll(fd, line.data(), line.size());
+}
+
+/// @brief Undo MODE Z: one zlib stream (RFC 1950) per transfer
+static bool Inflate(const std::string &input, std::string *output)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK)
+    return false;
+
+  stream.next_in = (Bytef *)input.data();
+  stream.avail_in = input.size();
+  char buffer[16384];
+  int result;
+  do
+  {
+    stream.next_out = (Bytef *)buffer;
+    stream.avail_out = sizeof(buffer);
+    result = inflate(&stream, Z_NO_FLUSH);
+    output->append(buffer, sizeof(buffer) - stream.avail_out);
+  } while (result == Z_OK);
+
+  inflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+/// @brief Downloads and listings in MODE Z
+static std::string Deflate(const std::string &input)
+{
+  uLongf length = compressBound(input.size());
+  std::string output(length, '\0');
+  compress((Bytef *)&output[0], &length, (const Bytef *)input.data(), input.size());
+  output.resize(length);
+  return output;
+}
+
+static std::string ParentOf(const std::string &path)
+{
+  size_t slash = path.find_last_of('/');
+  return slash == 0 || slash == std::string::npos ? "/" : path.substr(0, slash);
+}
+
+/// @brief State of one control connection
+class FtpStandInSession
+{
+private:
+  FtpStandInServer &server;
+  int fd;
+  int passiveFd;
+  std::string cwd;
+  uint64_t restartOffset;
+  std::string renameFrom;
+  char transferMode; // 'S' or 'Z', set by MODE
+
+  std::string Resolve(const std::string &argument)
+  {
+    std::string path = argument.empty() ? cwd : argument[0] == '/' ? argument : (cwd == "/" ? "" : cwd) + "/" + argument;
+    while (path.size() > 1 && path.back() == '/')
+      path.pop_back();
+    return path;
+  }
+
+  int OpenPassive(uint16_t *dataPort)
+  {
+    ClosePassive();
+    passiveFd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(passiveFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(passiveFd, 1) != 0 ||
+        getsockname(passiveFd, (struct sockaddr *)&address, &length) != 0)
+    {
+      ClosePassive();
+      return -1;
+    }
+
+    *dataPort = ntohs(address.sin_port);
+    return 0;
+  }
+
+  void ClosePassive()
+  {
+    if (passiveFd >= 0)
+      close(passiveFd);
+    passiveFd = -1;
+  }
+
+  int AcceptData()
+  {
+    if (passiveFd < 0)
+      return -1;
+
+    struct pollfd pfd = {passiveFd, POLLIN, 0};
+    int dataFd = poll(&pfd, 1, 5000) == 1 ? accept(passiveFd, NULL, NULL) : -1;
+    ClosePassive();
+
+    if (dataFd >= 0)
+    {
+      int noDelay = 1;
+      setsockopt(dataFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    return dataFd;
+  }
+
+  void Store(const std::string &path, bool append)
+  {
+    {
+      std::lock_guard<std::mutex> lock(server.storeMutex);
+      if (server.dirs.count(ParentOf(path)) == 0)
+      {
+        SendReply(fd, "553 Could not create file.");
+        return;
+      }
+    }
+
+    int dataFd = AcceptData();
+    if (dataFd < 0)
+    {
+      SendReply(fd, "425 Can't open data connection.");
+      return;
+    }
+    SendReply(fd, "150 Ok to send data.");
+
+    std::string data;
+    char buffer[16384];
+    ssize_t received;
+    size_t cutBytes = server.dataCutBytes.exchange(0);
+    bool isCut = false;
+    while (true)
+    {
+      if (server.isDataStalled)
+      {
+        // Leave the data in the socket until the bench lifts the stall or the client gives up
+        struct pollfd pfd = {dataFd, POLLRDHUP, 0};
+        if (poll(&pfd, 1, 1) == 1)
+          break;
+        continue;
+      }
+      if ((received = recv(dataFd, buffer, sizeof(buffer), 0)) <= 0)
+        break;
+      data.append(buffer, received);
+      if (cutBytes > 0 && data.size() >= cutBytes)
+      {
+        data.resize(cutBytes);
+        isCut = true;
+        break;
+      }
+    }
+    close(dataFd);
+
+    if (transferMode == 'Z')
+    {
+      std::string compressed;
+      compressed.swap(data);
+      if (!Inflate(compressed, &data) && !isCut)
+      {
+        restartOffset = 0;
+        SendReply(fd, "451 Invalid deflate stream, file not stored.");
+        return;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(server.storeMutex);
+      std::string &file = server.files[path];
+      if (append)
+        file += data;
+      else
+        file = file.substr(0, restartOffset < file.size() ? restartOffset : file.size()) + data;
+      server.modified[path] = time(NULL);
+    }
+    restartOffset = 0;
+    if (isCut)
+    {
+      SendReply(fd, "426 Connection closed; transfer aborted.");
+      return;
+    }
+    if (server.completionDelayMs > 0)
+      usleep(server.completionDelayMs * 1000);
+    SendReply(fd, "226 Transfer complete.");
+  }
+
+  void Retrieve(const std::string &path)
+  {
+    std::string data;
+    {
+      std::lock_guard<std::mutex> lock(server.storeMutex);
+      std::map<std::string, std::string>::iterator it = server.files.find(path);
+      if (it == server.files.end())
+      {
+        ClosePassive();
+        SendReply(fd, "550 Failed to open file.");
+        return;
+      }
+      data = restartOffset < it->second.size() ? it->second.substr(restartOffset) : std::string();
+    }
+    restartOffset = 0;
+    if (transferMode == 'Z')
+      data = Deflate(data);
+
+    int dataFd = AcceptData();
+    if (dataFd < 0)
+    {
+      SendReply(fd, "425 Can't open data connection.");
+      return;
+    }
+    SendReply(fd, "150 Opening BINARY mode data connection.");
+    bool isSent = SendAll(dataFd, data.data(), data.size());
+    close(dataFd);
+    SendReply(fd, isSent ? "226 Transfer complete." : "426 Connection closed; transfer aborted.");
+  }
+
+  void List(const std::string &path, bool machine)
+  {
+    std::string listing;
+    {
+      std::lock_guard<std::mutex> lock(server.storeMutex);
+      if (server.dirs.count(path) == 0)
+      {
+        ClosePassive();
+        SendReply(fd, "550 Directory not found.");
+        return;
+      }
+
+      std::string prefix = path == "/" ? "/" : path + "/";
+      if (machine)
+        listing += "type=cdir;modify=20240101000000; .\r\n";
+
+      for (std::set<std::string>::iterator it = server.dirs.lower_bound(prefix); it != server.dirs.end() && it->compare(0, prefix.size(), prefix) == 0; ++it)
+      {
+        std::string name = it->substr(prefix.size());
+        if (name.empty() || name.find('/') != std::string::npos)
+          continue;
+        listing += machine ? "type=dir;modify=20240101000000; " + name + "\r\n" : "drwxr-xr-x 1 ftp ftp 0 Jan 01 2024 " + name + "\r\n";
+      }
+
+      for (std::map<std::string, std::string>::iterator it = server.files.lower_bound(prefix); it != server.files.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+      {
+        std::string name = it->first.substr(prefix.size());
+        if (name.find('/') != std::string::npos)
+          continue;
+        std::string size = std::to_string(it->second.size());
+        listing += machine ? "type=file;size=" + size + ";modify=" + FtpTime(server.modified[it->first]) + "; " + name + "\r\n"
+                           : "-rw-r--r-- 1 ftp ftp " + size + " Jan 01 2024 " + name + "\r\n";
+      }
+    }
+    if (transferMode == 'Z')
+      listing = Deflate(listing);
+
+    int dataFd = AcceptData();
+    if (dataFd < 0)
+    {
+      SendReply(fd, "425 Can't open data connection.");
+      return;
+    }
+    SendReply(fd, "150 Here comes the directory listing.");
+    bool isSent = SendAll(dataFd, listing.data(), listing.size());
+    close(dataFd);
+    SendReply(fd, isSent ? "226 Directory send OK." : "426 Connection closed; transfer aborted.");
+  }
+
+  bool Command(const std::string &line)
+  {
+    size_t space = line.find(' ');
+    std::string verb = line.substr(0, space);
+    std::string argument = space == std::string::npos ? std::string() : line.substr(space + 1);
+    for (size_t i = 0; i < verb.size(); i++)
+      verb[i] = toupper(verb[i]);
+
+    if (verb == "USER")
+      return SendReply(fd, "331 Please specify the password.");
+    if (verb == "PASS")
+      return SendReply(fd, "230 Login successful.");
+    if (verb == "NOOP")
+      return SendReply(fd, "200 NOOP ok.");
+    if (verb == "QUIT")
+    {
+      SendReply(fd, "221 Goodbye.");
+      return false;
+    }
+    if (verb == "TYPE")
+      return SendReply(fd, "200 Type set.");
+    if (verb == "MODE")
+    {
+      if (argument != "S" && argument != "Z")
+        return SendReply(fd, "504 Bad MODE command.");
+      transferMode = argument[0];
+      return SendReply(fd, "200 Mode set to " + argument + ".");
+    }
+    if (verb == "FEAT")
+      return SendReply(fd, "211-Features:\r\n EPSV\r\n MDTM\r\n MLSD\r\n MODE Z\r\n PASV\r\n REST STREAM\r\n SIZE\r\n211 End");
+
+    if (verb == "EPSV" || verb == "PASV")
+    {
+      uint16_t dataPort;
+      if (OpenPassive(&dataPort) != 0)
+        return SendReply(fd, "425 Can't open passive connection.");
+
+      char reply[80];
+      if (verb == "EPSV")
+        snprintf(reply, sizeof(reply), "229 Entering Extended Passive Mode (|||%u|)", dataPort);
+      else
+        snprintf(reply, sizeof(reply), "227 Entering Passive Mode (127,0,0,1,%u,%u)", dataPort >> 8, dataPort & 0xFF);
+      return SendReply(fd, reply);
+    }
+
+    if (verb == "REST")
+    {
+      restartOffset = strtoull(argument.c_str(), NULL, 10);
+      return SendReply(fd, "350 Restart position accepted.");
+    }
+    if (verb == "STOR" || verb == "APPE")
+    {
+      Store(Resolve(argument), verb == "APPE");
+      return true;
+    }
+    if (verb == "RETR")
+    {
+      Retrieve(Resolve(argument));
+      return true;
+    }
+    if (verb == "MLSD" || verb == "LIST" || verb == "NLST")
+    {
+      List(Resolve(argument), verb == "MLSD");
+      return true;
+    }
+
+    std::string path = Resolve(argument);
+    std::lock_guard<std::mutex> lock(server.storeMutex);
+
+    if (verb == "SIZE" || verb == "MDTM")
+    {
+      std::map<std::string, std::string>::iterator it = server.files.find(path);
+      if (it == server.files.end())
+        return SendReply(fd, "550 Could not get file size.");
+      return SendReply(fd, "213 " + (verb == "SIZE" ? std::to_string(it->second.size()) : FtpTime(server.modified[path])));
+    }
+    if (verb == "MKD")
+    {
+      if (server.dirs.count(path) > 0 || server.files.count(path) > 0 || server.dirs.count(ParentOf(path)) == 0)
+        return SendReply(fd, "550 Create directory operation failed.");
+      server.dirs.insert(path);
+      return SendReply(fd, "257 \"" + path + "\" created");
+    }
+    if (verb == "RMD")
+      return SendReply(fd, server.dirs.erase(path) > 0 ? "250 Remove directory operation successful." : "550 Remove directory operation failed.");
+    if (verb == "DELE")
+    {
+      server.modified.erase(path);
+      return SendReply(fd, server.files.erase(path) > 0 ? "250 Delete operation successful." : "550 Delete operation failed.");
+    }
+    if (verb == "CWD")
+    {
+      if (server.dirs.count(path) == 0)
+        return SendReply(fd, "550 Failed to change directory.");
+      cwd = path;
+      return SendReply(fd, "250 Directory successfully changed.");
+    }
+    if (verb == "RNFR")
+    {
+      renameFrom = path;
+      return SendReply(fd, server.files.count(path) > 0 ? "350 Ready for RNTO." : "550 RNFR command failed.");
+    }
+    if (verb == "RNTO")
+    {
+      std::map<std::string, std::string>::iterator it = server.files.find(renameFrom);
+      if (it == server.files.end())
+        return SendReply(fd, "550 RNTO command failed.");
+      server.files[path] = it->second;
+      server.files.erase(renameFrom);
+      server.modified[path] = server.modified[renameFrom];
+      server.modified.erase(renameFrom);
+      return SendReply(fd, "250 Rename successful.");
+    }
+
+    return SendReply(fd, "502 Command not implemented.");
+  }
+
+  /// @brief Hold back the next reply while the bench stalls the server
+  void WaitReplyStall()
+  {
+    while (server.isReplyStalled && server.isRunning)
+      usleep(1000);
+  }
+
+public:
+  FtpStandInSession(FtpStandInServer &_server, int _fd) : server(_server), fd(_fd), passiveFd(-1), cwd("/"), restartOffset(0), transferMode('S')
+  {
+  }
+
+  void Run()
+  {
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    WaitReplyStall();
+    SendReply(fd, "220 FTP stand-in ready.");
+
+    std::string pending;
+    char buffer[1024];
+    bool isOpen = true;
+    while (isOpen)
+    {
+      ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+      if (received <= 0)
+        break;
+      pending.append(buffer, received);
+
+      // Pipelined commands arrive together, answer them in order
+      size_t end;
+      while (isOpen && (end = pending.find("\r\n")) != std::string::npos)
+      {
+        std::string line = pending.substr(0, end);
+        pending.erase(0, end + 2);
+        WaitReplyStall();
+        isOpen = Command(line);
+      }
+    }
+
+    ClosePassive();
+  }
+};
+
+/////////////////////////////////////////////
+
+FtpStandInServer::FtpStandInServer() : listenFd(-1), port(0), isRunning(false), isDataStalled(false), isReplyStalled(false), completionDelayMs(0), dataCutBytes(0)
+{
+  dirs.insert("/");
+}
+
+FtpStandInServer::~FtpStandInServer()
+{
+  End();
+}
+
+bool FtpStandInServer::Begin(uint16_t listenPort)
+{
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(listenPort);
+  socklen_t length = sizeof(address);
+  if (bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 8) != 0 ||
+      getsockname(listenFd, (struct sockaddr *)&address, &length) != 0)
+  {
+    close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+
+  port = ntohs(address.sin_port);
+  isRunning = true;
+  acceptThread = std::thread(&FtpStandInServer::AcceptLoop, this);
+  return true;
+}
+
+void FtpStandInServer::End()
+{
+  if (!isRunning)
+    return;
+
+  isRunning = false;
+  shutdown(listenFd, SHUT_RDWR);
+  close(listenFd);
+  listenFd = -1;
+  if (acceptThread.joinable())
+    acceptThread.join();
+
+  // Sessions run on detached threads, wait until each one has seen its socket shut down
+  while (true)
+  {
+    {
+      std::lock_guard<std::mutex> lock(sessionMutex);
+      if (sessionFds.empty())
+        break;
+      for (std::set<int>::iterator it = sessionFds.begin(); it != sessionFds.end(); ++it)
+        shutdown(*it, SHUT_RDWR);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void FtpStandInServer::AcceptLoop()
+{
+  while (isRunning)
+  {
+    struct pollfd pfd = {listenFd, POLLIN, 0};
+    if (poll(&pfd, 1, 100) != 1)
+      continue;
+
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0)
+      continue;
+
+    {
+      std::lock_guard<std::mutex> lock(sessionMutex);
+      sessionFds.insert(fd);
+    }
+    std::thread(&FtpStandInServer::Session, this, fd).detach();
+  }
+}
+
+void FtpStandInServer::Session(int fd)
+{
+  FtpStandInSession session(*this, fd);
+  session.Run();
+
+  {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    sessionFds.erase(fd);
+  }
+  close(fd);
+}
+
+size_t FtpStandInServer::GetFileSize(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(storeMutex);
+  std::map<std::string, std::string>::iterator it = files.find(path);
+  return it == files.end() ? 0 : it->second.size();
+}
+
+std::string FtpStandInServer::GetFile(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(storeMutex);
+  std::map<std::string, std::string>::iterator it = files.find(path);
+  return it == files.end() ? std::string() : it->second;
+}
+
+void FtpStandInServer::PutFile(const std::string &path, const std::string &data)
+{
+  std::lock_guard<std::mutex> lock(storeMutex);
+  files[path] = data;
+  modified[path] = time(NULL);
+}
+
+void FtpStandInServer::MakeDir(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(storeMutex);
+  for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+  {
+    dirs.insert(path.substr(0, slash));
+    if (slash == std::string::npos)
+      break;
+  }
+}
+
+bool FtpStandInServer::HasDir(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(storeMutex);
+  return dirs.count(path) > 0;
+}
+
+void FtpStandInServer::Clear()
+{
+  std::lock_guard<std::mutex> lock(storeMutex);
+  files.clear();
+  modified.clear();
+  dirs.clear();
+  dirs.insert("/");
+}
@@ -0,0 +1,64 @@
+// Minimal FTP server on loopback for the native bench build. Keeps files in memory.
+#ifndef FtpStandInServer_H
+#define FtpStandInServer_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <time.h>
+
+/**
+ * @brief Serves the commands M5_Ethernet_FtpClient uses: USER/PASS, TYPE, MODE S/Z, FEAT, EPSV/PASV,
+ * STOR/APPE/RETR/REST, SIZE/MDTM, MKD/RMD/CWD/DELE, MLSD/LIST and NOOP/QUIT.
+ * One thread per control connection, so pooled sessions run in parallel.
+ */
+class FtpStandInServer
+{
+private:
+  int listenFd;
+  uint16_t port;
+  std::atomic<bool> isRunning;
+  std::atomic<bool> isDataStalled;
+  std::atomic<bool> isReplyStalled;
+  std::atomic<unsigned> completionDelayMs;
+  std::atomic<size_t> dataCutBytes;
+  std::thread acceptThread;
+
+  std::mutex sessionMutex;
+  std::set<int> sessionFds; // Open control connections, End() shuts them down
+
+  std::mutex storeMutex;
+  std::map<std::string, std::string> files;
+  std::map<std::string, time_t> modified; // Upload time per file, reported by MLSD and MDTM
+  std::set<std::string> dirs;
+
+  friend class FtpStandInSession;
+  void AcceptLoop();
+  void Session(int fd);
+
+public:
+  FtpStandInServer();
+  ~FtpStandInServer();
+
+  bool Begin(uint16_t listenPort = 0);
+  void End(); // Also drops the open sessions, the store is kept so Begin(GetPort()) models a server restart
+  uint16_t GetPort() const { return port; }
+  void SetDataStall(bool stall) { isDataStalled = stall; } // Stop reading upload data, like a peer that no longer ACKs
+  void SetReplyStall(bool stall) { isReplyStalled = stall; } // Accept connections but answer nothing, like a hung server
+  void SetCompletionDelay(unsigned ms) { completionDelayMs = ms; } // Hold back the 226 after an upload, like a NAS closing a big file
+  void SetDataCut(size_t bytes) { dataCutBytes = bytes; } // Drop the next upload after bytes and keep them, like a link that fails mid-transfer
+
+  // Access to the in-memory store from the bench, all paths absolute
+  size_t GetFileSize(const std::string &path);
+  std::string GetFile(const std::string &path);
+  void PutFile(const std::string &path, const std::string &data);
+  void MakeDir(const std::string &path);
+  bool HasDir(const std::string &path);
+  void Clear();
+};
+
+#endif
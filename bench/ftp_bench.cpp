@@ -0,0 +1,793 @@
+// Host benchmark for M5_Ethernet_FtpClient against FtpStandInServer on loopback.
+// Build and run with `pio run -e native -t exec`, or without PlatformIO:
+//   g++ -std=gnu++17 -O2 -Ibench/host -Isrc -D_FTP_LOGLEVEL_=0 -DFTP_CLIENT_USING_ETHERNET -DFTP_CLIENT_USING_ZLIB
+//       src/M5_Ethernet_*.cpp bench/*.cpp bench/host/*.cpp -o ftp_bench -lz -pthread
+// Usage: ftp_bench [iterations] [--metrics] [--posix]
+// --posix runs the client over FtpPosixTransport, the host's sockets without the W5500 limits; calls/op is 0 then.
+// Add -DETHERNET_LARGE_BUFFERS -DMAX_SOCK_NUM=2 to model 8 KB socket buffers instead of 2 KB.
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "FtpStandInServer.hpp"
+#include "M5_Ethernet_FtpClient.hpp"
+#include "M5_Ethernet_FtpPool.hpp"
+#include "M5_Ethernet_FtpPosixTransport.hpp"
+#include "M5_Ethernet_FtpSpool.hpp"
+#include "M5_Ethernet_FtpSync.hpp"
+#include "M5_Ethernet_FtpUploader.hpp"
+
+/// @brief Print on stdout, for the --metrics dump
+class StdoutPrint : public Print
+{
+public:
+  size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+  size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+};
+
+/// @brief Latency samples of one scenario, in microseconds
+struct BenchResult
+{
+  const char *name;
+  std::vector<unsigned long> samples;
+  uint64_t bytes;
+  unsigned long totalMicros;
+  uint64_t calls; // Socket layer calls, see HostTransportStats
+  uint16_t lastCode;
+  uint32_t failures;
+
+  explicit BenchResult(const char *_name) : name(_name), bytes(0), totalMicros(0), calls(0), lastCode(0), failures(0) {}
+};
+
+static unsigned long Percentile(std::vector<unsigned long> samples, int percent)
+{
+  if (samples.empty())
+    return 0;
+  std::sort(samples.begin(), samples.end());
+  size_t index = (samples.size() - 1) * percent / 100;
+  return samples[index];
+}
+
+static void PrintResult(const BenchResult &result)
+{
+  double seconds = result.totalMicros / 1e6;
+  printf("%-22s %7u %10.1f %12.0f %9lu %9lu %9.0f %s\n",
+         result.name, (unsigned)result.samples.size(),
+         seconds > 0 ? result.samples.size() / seconds : 0.0,
+         seconds > 0 ? result.bytes / seconds : 0.0,
+         Percentile(result.samples, 50), Percentile(result.samples, 99),
+         result.samples.empty() ? 0.0 : (double)result.calls / result.samples.size(),
+         result.failures == 0 ? "ok" : "FAILED");
+}
+
+static uint64_t TransportCalls()
+{
+  return (uint64_t)HostTransport.available + HostTransport.reads + HostTransport.writes + HostTransport.status;
+}
+
+static uint64_t startCalls;
+
+/// @brief Start timing one operation, Record() takes the time and the socket calls since then
+static unsigned long Start()
+{
+  startCalls = TransportCalls();
+  return micros();
+}
+
+static void Record(BenchResult &result, M5_Ethernet_FtpClient &ftp, unsigned long start, uint16_t code, size_t bytes)
+{
+  unsigned long elapsed = micros() - start;
+  result.calls += TransportCalls() - startCalls;
+  result.samples.push_back(elapsed);
+  result.totalMicros += elapsed;
+  result.bytes += bytes;
+  result.lastCode = code;
+  if (ftp.isErrorCode(code))
+    result.failures++;
+}
+
+struct UploadSource
+{
+  std::vector<uint8_t> data;
+  size_t offset;
+  size_t chunk;
+};
+
+static int ReadUpload(void *context, const uint8_t **data)
+{
+  UploadSource *source = (UploadSource *)context;
+  size_t length = std::min(source->chunk, source->data.size() - source->offset);
+  *data = source->data.data() + source->offset;
+  source->offset += length;
+  return (int)length;
+}
+
+/// @brief Hands out the same data over and over, for uploads that are expected to be cut off
+static int ReadEndless(void *context, const uint8_t **data)
+{
+  UploadSource *source = (UploadSource *)context;
+  if (source->offset >= source->data.size())
+    source->offset = 0;
+  return ReadUpload(context, data);
+}
+
+static bool CountDownload(void *context, const uint8_t *, size_t length)
+{
+  *(size_t *)context += length;
+  return true;
+}
+
+static bool CollectDownload(void *context, const uint8_t *data, size_t length)
+{
+  ((std::string *)context)->append((const char *)data, length);
+  return true;
+}
+
+/// @brief Decode a record file the way tools/ftp_record_decode.cpp does and compare it with what was queued
+static bool CheckRecords(const std::string &file, const std::vector<uint64_t> &timestamps, const std::vector<uint32_t> &values,
+                         uint8_t channels)
+{
+  const uint8_t *in = (const uint8_t *)file.data();
+  const uint8_t *end = in + file.size();
+  size_t record = 0;
+  while (in < end)
+  {
+    uint8_t blockChannels;
+    uint64_t timestampMs;
+    uint32_t bits[FTP_BIN_MAX_CHANNELS];
+    uint16_t count = FtpBinReadHeader(in, end, &blockChannels, &timestampMs, bits);
+    if (count == 0 || blockChannels != channels)
+      return false;
+
+    in += FTP_BIN_HEADER_SIZE(channels);
+    for (uint16_t i = 0; i < count; i++, record++)
+    {
+      if (i > 0 && !FtpBinReadDelta(&in, end, channels, &timestampMs, bits))
+        return false;
+      if (record >= timestamps.size() || timestampMs != timestamps[record] ||
+          memcmp(bits, &values[record * channels], channels * sizeof(uint32_t)) != 0)
+        return false;
+    }
+  }
+  return record == timestamps.size();
+}
+
+static bool CountEntry(void *context, const FtpListEntry &entry)
+{
+  if (entry.type == FTP_ENTRY_FILE)
+    (*(uint32_t *)context)++;
+  return true;
+}
+
+static bool StopEntry(void *context, const FtpListEntry &entry)
+{
+  if (entry.type == FTP_ENTRY_FILE)
+    (*(uint32_t *)context)++;
+  return *(uint32_t *)context < 10;
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = 200;
+  bool isMetrics = false;
+  bool isPosix = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--metrics") == 0)
+      isMetrics = true;
+    else if (strcmp(argv[i], "--posix") == 0)
+      isPosix = true;
+    else
+      iterations = atoi(argv[i]);
+  }
+
+  FtpStandInServer server;
+  if (!server.Begin())
+  {
+    fprintf(stderr, "Could not start the stand-in server\n");
+    return 1;
+  }
+
+  FtpPosixTransport posixControl;
+  FtpPosixTransport posixData;
+  M5_Ethernet_FtpClient ftp("127.0.0.1", server.GetPort(), "bench", "bench", 5000);
+  if (isPosix)
+    ftp.SetTransport(&posixControl, &posixData);
+  std::vector<BenchResult> results;
+  char line[96];
+
+  // Login: full connect, USER/PASS and QUIT
+  {
+    BenchResult result("login");
+    for (int i = 0; i < iterations / 4 + 1; i++)
+    {
+      unsigned long start = Start();
+      uint16_t code = ftp.OpenConnection();
+      Record(result, ftp, start, code, 0);
+      ftp.CloseConnection();
+    }
+    results.push_back(result);
+  }
+
+  if (ftp.isErrorCode(ftp.OpenConnection()))
+  {
+    fprintf(stderr, "Could not log in to the stand-in server\n");
+    return 1;
+  }
+
+  // MKD chain: four levels created from scratch each round
+  {
+    BenchResult result("mkd_chain_4");
+    for (int i = 0; i < iterations; i++)
+    {
+      snprintf(line, sizeof(line), "/mkd/%d/a/b/c", i);
+      ftp.ClearDirCache();
+      unsigned long start = Start();
+      uint16_t code = ftp.MakeDirRecursive(line);
+      Record(result, ftp, start, code, 0);
+    }
+    results.push_back(result);
+  }
+
+  // The same through Submit*()/poll(): a recursive MKD, then a lazy APPE into directories that do not exist yet
+  {
+    BenchResult result("async_mkd_append");
+    static const uint8_t payload[] = "2024/01/01 00:00:00,1,2,3\r\n";
+    char filePath[96];
+    ftp.SetLazyMakeDir(true);
+    for (int i = 0; i < iterations / 10 + 1; i++)
+    {
+      snprintf(line, sizeof(line), "/async/%d/m/n/o", i);
+      unsigned long start = Start();
+      if (!ftp.SubmitMakeDir(line))
+        result.failures++;
+      while (ftp.poll())
+        ;
+      Record(result, ftp, start, ftp.GetAsyncResult(), 0);
+      if (!server.HasDir(line))
+        result.failures++;
+
+      snprintf(filePath, sizeof(filePath), "/async/%d/x/y/z.txt", i);
+      start = Start();
+      if (!ftp.SubmitAppend(filePath, payload, sizeof(payload) - 1))
+        result.failures++;
+      while (ftp.poll())
+        ;
+      Record(result, ftp, start, ftp.GetAsyncResult(), sizeof(payload) - 1);
+      if (server.GetFile(filePath) != std::string((const char *)payload, sizeof(payload) - 1))
+        result.failures++;
+    }
+    ftp.SetLazyMakeDir(false);
+    results.push_back(result);
+  }
+
+  server.MakeDir("/log");
+
+  // One append per line, the unbatched path
+  {
+    BenchResult result("append_text_line");
+    for (int i = 0; i < iterations; i++)
+    {
+      int length = snprintf(line, sizeof(line), "2024/01/01 00:00:%02d,%d,%d,%d", i % 60, i, i * 3, i * 7);
+      unsigned long start = Start();
+      uint16_t code = ftp.AppendTextLine("/log/single.csv", line, length);
+      Record(result, ftp, start, code, length + 2);
+    }
+    results.push_back(result);
+  }
+
+  // The same lines queued and flushed in batches of 20
+  {
+    BenchResult result("queue_flush_x20");
+    ftp.SetAppendThresholds(1000, 64 * 1024, 60000);
+    for (int i = 0; i < iterations; i += 20)
+    {
+      size_t bytes = 0;
+      unsigned long start = Start();
+      for (int j = 0; j < 20; j++)
+      {
+        int length = snprintf(line, sizeof(line), "2024/01/01 00:00:%02d,%d,%d,%d", j, i + j, j * 3, j * 7);
+        ftp.QueueTextLine("/log/batched.csv", line, length);
+        bytes += length + 2;
+      }
+      uint16_t code = ftp.FlushAppendBuffers();
+      Record(result, ftp, start, code, bytes);
+    }
+    results.push_back(result);
+  }
+
+  // Binary records: QueueRecord(), flush, download the file and decode it again
+  {
+    BenchResult result("record_roundtrip_500");
+    for (int i = 0; i < iterations / 20 + 1; i++)
+    {
+      server.PutFile("/log/records.bin", "");
+      std::vector<uint64_t> timestamps;
+      std::vector<uint32_t> values;
+      uint64_t timestampMs = 1704067200000ULL;
+      uint16_t code = FTP_RESCODE_ACTION_SUCCESS;
+      unsigned long start = Start();
+      for (int j = 0; j < 500 && !ftp.isErrorCode(code); j++)
+      {
+        float record[4] = {20.0f + j * 0.01f, (float)(j % 7), -1.5f * j, 1e6f / (j + 1)};
+        timestampMs += 100 + j % 3;
+        code = ftp.QueueRecord("/log/records.bin", timestampMs, record, 4);
+        timestamps.push_back(timestampMs);
+        for (int k = 0; k < 4; k++)
+          values.push_back(FtpBinFloatBits(record[k]));
+      }
+      if (!ftp.isErrorCode(code))
+        code = ftp.FlushAppendBuffers();
+
+      std::string file;
+      if (!ftp.isErrorCode(code))
+        code = ftp.DownloadStream("/log/records.bin", CollectDownload, &file);
+      Record(result, ftp, start, code, file.size());
+      if (!CheckRecords(file, timestamps, values, 4))
+        result.failures++;
+    }
+    results.push_back(result);
+  }
+
+  // An APPE cut off part way: the next flush must send exactly the bytes that did not land,
+  // for text lines and for a binary block cut inside a record
+  {
+    BenchResult result("append_cut_reconcile");
+    for (int i = 0; i < iterations / 20 + 1; i++)
+    {
+      char textPath[32];
+      char recordPath[32];
+      snprintf(textPath, sizeof(textPath), "/log/cut_%d.csv", i);
+      snprintf(recordPath, sizeof(recordPath), "/log/cut_%d.bin", i);
+
+      std::string expected;
+      for (int j = 0; j < 40; j++)
+      {
+        int length = snprintf(line, sizeof(line), "2024/01/01 02:00:%02d,%d,%d", j, i, j * 11);
+        ftp.QueueTextLine(textPath, line, length);
+        expected.append(line, length).append("\r\n");
+      }
+
+      size_t cut = 1 + (i * 97 + 13) % 900;
+      unsigned long start = Start();
+      server.SetDataCut(cut);
+      if (!ftp.isErrorCode(ftp.FlushAppendBuffers(true)) || server.GetFileSize(textPath) != cut)
+        result.failures++;
+      uint16_t code = ftp.FlushAppendBuffers(true);
+      Record(result, ftp, start, code, expected.size());
+      if (server.GetFile(textPath) != expected)
+        result.failures++;
+
+      std::vector<uint64_t> timestamps;
+      std::vector<uint32_t> values;
+      uint64_t timestampMs = 1704067200000ULL;
+      for (int j = 0; j < 60; j++)
+      {
+        float record[3] = {21.0f + j * 0.05f, (float)(j % 5), 1e3f / (j + 1)};
+        timestampMs += 1000 + j % 7;
+        ftp.QueueRecord(recordPath, timestampMs, record, 3);
+        timestamps.push_back(timestampMs);
+        for (int k = 0; k < 3; k++)
+          values.push_back(FtpBinFloatBits(record[k]));
+      }
+
+      size_t recordBytes = ftp.GetBufferedBytes();
+      cut = 1 + (i * 53 + 7) % 300;
+      start = Start();
+      server.SetDataCut(cut);
+      if (!ftp.isErrorCode(ftp.FlushAppendBuffers(true)) || server.GetFileSize(recordPath) != cut)
+        result.failures++;
+      code = ftp.FlushAppendBuffers(true);
+      Record(result, ftp, start, code, recordBytes);
+      if (ftp.GetBufferedBytes() != 0 || !CheckRecords(server.GetFile(recordPath), timestamps, values, 3))
+        result.failures++;
+    }
+    results.push_back(result);
+  }
+
+  // Bulk upload of 256 KB
+  UploadSource source;
+  source.data.resize(256 * 1024);
+  for (size_t i = 0; i < source.data.size(); i++)
+    source.data[i] = (uint8_t)(i * 31 + (i >> 8));
+  source.chunk = 2048;
+  {
+    BenchResult result("upload_stream_256k");
+    for (int i = 0; i < iterations / 20 + 1; i++)
+    {
+      source.offset = 0;
+      unsigned long start = Start();
+      uint16_t code = ftp.UploadStream("/log/bulk.bin", ReadUpload, &source);
+      Record(result, ftp, start, code, source.data.size());
+    }
+    results.push_back(result);
+  }
+
+  // 256 KB of CSV lines compressed with MODE Z, the stand-in inflates them again
+  FtpCompressionStats deflateStats;
+  memset(&deflateStats, 0, sizeof(deflateStats));
+  {
+    BenchResult result("upload_deflate_256k");
+    UploadSource text;
+    while (text.data.size() < 256 * 1024)
+    {
+      int length = snprintf(line, sizeof(line), "2024/01/01 00:%02d:%02d,%u,%u,%u\r\n", (int)(text.data.size() / 3600) % 60,
+                            (int)(text.data.size() / 60) % 60, (unsigned)text.data.size() % 977, (unsigned)text.data.size() % 13, 42u);
+      text.data.insert(text.data.end(), line, line + length);
+    }
+    text.chunk = 2048;
+    std::string expected(text.data.begin(), text.data.end());
+
+    ftp.SetCompression(true);
+    for (int i = 0; i < iterations / 20 + 1; i++)
+    {
+      text.offset = 0;
+      unsigned long start = Start();
+      uint16_t code = ftp.UploadStream("/log/deflate.csv", ReadUpload, &text);
+      Record(result, ftp, start, code, text.data.size());
+      deflateStats = ftp.GetCompressionStats();
+      if (server.GetFile("/log/deflate.csv") != expected || deflateStats.inputBytes != text.data.size() ||
+          deflateStats.outputBytes == 0 || deflateStats.outputBytes >= deflateStats.inputBytes)
+        result.failures++;
+    }
+    ftp.SetCompression(false);
+    if (!ftp.isModeZSupported())
+      result.failures++;
+    results.push_back(result);
+  }
+
+  // The same kind of data as 6 files of 64 KB, spread over 1, 2 and 3 pooled sessions
+  FtpPosixTransport posixPool[4];
+  M5_Ethernet_FtpClient ftp2("127.0.0.1", server.GetPort(), "bench", "bench", 5000);
+  M5_Ethernet_FtpClient ftp3("127.0.0.1", server.GetPort(), "bench", "bench", 5000);
+  if (isPosix)
+  {
+    ftp2.SetTransport(&posixPool[0], &posixPool[1]);
+    ftp3.SetTransport(&posixPool[2], &posixPool[3]);
+  }
+  M5_Ethernet_FtpClient *poolClients[] = {&ftp, &ftp2, &ftp3};
+  static const char *const poolNames[] = {"pool_upload_1", "pool_upload_2", "pool_upload_3"};
+  for (uint8_t sessions = 1; sessions <= 3; sessions++)
+  {
+    BenchResult result(poolNames[sessions - 1]);
+    M5_Ethernet_FtpPool pool(poolClients, sessions);
+    if (ftp.isErrorCode(pool.Open()))
+      result.failures++;
+
+    UploadSource sources[6];
+    for (int i = 0; i < iterations / 20 + 1; i++)
+    {
+      for (int j = 0; j < 6; j++)
+      {
+        snprintf(line, sizeof(line), "/log/pool_%d.bin", j);
+        sources[j].data.assign(source.data.begin(), source.data.begin() + 64 * 1024);
+        sources[j].offset = 0;
+        sources[j].chunk = 2048;
+        pool.Enqueue(line, ReadUpload, &sources[j]);
+      }
+
+      FtpTransferStats stats;
+      unsigned long start = Start();
+      uint16_t code = pool.Run(&stats);
+      Record(result, ftp, start, code, stats.bytes);
+      if (stats.bytes != 6 * 64 * 1024 || server.GetFileSize("/log/pool_5.bin") != 64 * 1024)
+        result.failures++;
+    }
+    result.failures += pool.GetFailedCount();
+    results.push_back(result);
+  }
+  ftp2.CloseConnection();
+  ftp3.CloseConnection();
+
+  // A pooled upload to a server that stops reading must fail after DataTimeout() instead of spinning in Run()
+  {
+    BenchResult result("pool_upload_stall");
+    FtpPosixTransport posixStall[2];
+    M5_Ethernet_FtpClient stalled("127.0.0.1", server.GetPort(), "bench", "bench", 1000);
+    if (isPosix)
+      stalled.SetTransport(&posixStall[0], &posixStall[1]);
+    M5_Ethernet_FtpClient *stallClients[] = {&stalled};
+    M5_Ethernet_FtpPool pool(stallClients, 1);
+    pool.Open();
+
+    UploadSource endless;
+    endless.data = source.data;
+    endless.chunk = 512; // Whole spans fit, so Run() finds the socket full between spans
+    endless.offset = 0;
+    server.SetDataStall(true);
+    pool.Enqueue("/log/stall.bin", ReadEndless, &endless);
+    unsigned long start = Start();
+    pool.Run();
+    // The expected outcome is one failed upload; anything else counts as a failure of this scenario
+    Record(result, stalled, start, pool.GetFailedCount() == 1 ? FTP_RESCODE_ACTION_SUCCESS : FTP_RESCODE_DATA_CONNECTION_ERROR, 0);
+    server.SetDataStall(false);
+    stalled.CloseConnection();
+    results.push_back(result);
+  }
+
+  // Upload whose 226 takes 2 s, far above the reply time on loopback: the client must wait for it
+  // instead of dropping a session that is only slow
+  {
+    BenchResult result("upload_slow_226");
+    UploadSource small;
+    small.data.assign(source.data.begin(), source.data.begin() + 8192);
+    small.chunk = 2048;
+    small.offset = 0;
+    server.SetCompletionDelay(2000);
+    unsigned long start = Start();
+    uint16_t code = ftp.UploadStream("/log/slow.bin", ReadUpload, &small);
+    Record(result, ftp, start, code, small.data.size());
+    server.SetCompletionDelay(0);
+    if (!ftp.isConnected() || ftp.isErrorCode(ftp.Noop()) || server.GetFileSize("/log/slow.bin") != small.data.size())
+      result.failures++;
+    results.push_back(result);
+  }
+
+  // Bulk download of the same file
+  {
+    BenchResult result("download_stream_256k");
+    for (int i = 0; i < iterations / 20 + 1; i++)
+    {
+      size_t received = 0;
+      unsigned long start = Start();
+      uint16_t code = ftp.DownloadStream("/log/bulk.bin", CountDownload, &received);
+      Record(result, ftp, start, code, received);
+      if (received != source.data.size())
+        result.failures++;
+    }
+    results.push_back(result);
+  }
+
+  // MLSD over a directory of 100 files
+  server.MakeDir("/list");
+  for (int i = 0; i < 100; i++)
+  {
+    snprintf(line, sizeof(line), "/list/file_%03d.csv", i);
+    server.PutFile(line, std::string(100 + i, 'x'));
+  }
+  {
+    BenchResult result("list_dir_100");
+    for (int i = 0; i < iterations / 4 + 1; i++)
+    {
+      uint32_t entries = 0;
+      unsigned long start = Start();
+      uint16_t code = ftp.ListDir("/list", CountEntry, &entries);
+      Record(result, ftp, start, code, 0);
+      if (entries != 100)
+        result.failures++;
+    }
+    results.push_back(result);
+  }
+
+  // The same listing stopped by the callback after 10 entries; the server's 426 must not read as a lost link
+  {
+    BenchResult result("list_dir_stop_10");
+    for (int i = 0; i < iterations / 4 + 1; i++)
+    {
+      uint32_t entries = 0;
+      unsigned long start = Start();
+      uint16_t code = ftp.ListDir("/list", StopEntry, &entries);
+      Record(result, ftp, start, code, 0);
+      if (entries != 10 || !ftp.isConnected())
+        result.failures++;
+    }
+    results.push_back(result);
+  }
+
+  // The same listing through ContentList(), which returns the raw lines
+  {
+    BenchResult result("content_list_100");
+    static String list[256];
+    for (int i = 0; i < iterations / 4 + 1; i++)
+    {
+      unsigned long start = Start();
+      uint16_t code = ftp.InitAsciiPassiveMode();
+      if (!ftp.isErrorCode(code))
+        code = ftp.ContentList("/list", list);
+      Record(result, ftp, start, code, 0);
+      if (!list[99].startsWith("type=file") || list[99].indexOf("file_") < 0)
+        result.failures++;
+    }
+    results.push_back(result);
+  }
+
+  // DownloadFile() into a fixed buffer
+  server.PutFile("/log/small.bin", std::string((const char *)source.data.data(), 8192));
+  {
+    BenchResult result("download_file_8k");
+    static unsigned char buffer[8192];
+    for (int i = 0; i < iterations / 4 + 1; i++)
+    {
+      memset(buffer, 0, sizeof(buffer));
+      unsigned long start = Start();
+      uint16_t code = ftp.InitBinaryPassiveMode();
+      if (!ftp.isErrorCode(code))
+        code = ftp.DownloadFile("/log/small.bin", buffer, sizeof(buffer));
+      Record(result, ftp, start, code, sizeof(buffer));
+      if (memcmp(buffer, source.data.data(), sizeof(buffer)) != 0)
+        result.failures++;
+    }
+    results.push_back(result);
+  }
+
+  // Directory sync where one of 20 local files has grown since the last run
+  {
+    BenchResult result("sync_dir_20");
+    static M5_Ethernet_FtpSync sync;
+    char localDir[] = "/tmp/ftp_bench_XXXXXX";
+    char path[64];
+    if (mkdtemp(localDir) == NULL)
+      result.failures++;
+
+    for (int i = 0; i < 20; i++)
+    {
+      snprintf(path, sizeof(path), "%s/cap_%02d.bin", localDir, i);
+      FILE *file = fopen(path, "wb");
+      if (file != NULL)
+      {
+        fwrite(source.data.data(), 1, 4096, file);
+        fclose(file);
+      }
+    }
+
+    FtpSyncStats stats;
+    if (sync.Sync(ftp, localDir, "/capture", &stats) != FTP_RESCODE_ACTION_SUCCESS || stats.filesUploaded != 20)
+      result.failures++;
+
+    for (int i = 0; i < iterations / 4 + 1; i++)
+    {
+      snprintf(path, sizeof(path), "%s/cap_%02d.bin", localDir, i % 20);
+      FILE *file = fopen(path, "ab");
+      if (file != NULL)
+      {
+        fwrite(source.data.data(), 1, 256, file);
+        fclose(file);
+      }
+
+      unsigned long start = Start();
+      uint16_t code = sync.Sync(ftp, localDir, "/capture", &stats);
+      Record(result, ftp, start, code, stats.bytesUploaded);
+      if (stats.filesUploaded != 1 || stats.filesSkipped != 19 || stats.bytesUploaded != 256)
+        result.failures++;
+    }
+
+    for (int i = 0; i < 20; i++)
+    {
+      snprintf(path, sizeof(path), "%s/cap_%02d.bin", localDir, i);
+      unlink(path);
+    }
+    rmdir(localDir);
+    results.push_back(result);
+  }
+
+  // Outage and recovery: lines spooled while the server is stopped are replayed once it is back
+  {
+    BenchResult result("spool_replay_100");
+    char spoolDir[] = "/tmp/ftp_bench_spool_XXXXXX";
+    if (mkdtemp(spoolDir) == NULL)
+      result.failures++;
+
+    M5_Ethernet_FtpSpool spool(spoolDir);
+    if (!spool.Begin())
+      result.failures++;
+
+    ftp.SetKeepAliveInterval(0); // Every EnsureSession() checks the connection with NOOP
+    std::string expected;
+    for (int round = 0; round < 3; round++)
+    {
+      server.End();
+      if (!ftp.isErrorCode(ftp.EnsureSession()))
+        result.failures++;
+
+      uint32_t spooled = 0;
+      for (int i = 0; i < 100; i++)
+      {
+        int length = snprintf(line, sizeof(line), "2024/01/01 00:%02d:%02d,%d", round, i % 60, i);
+        if (!spool.Write("/log/spool.csv", line, length))
+          result.failures++;
+        expected.append(line, length).append("\r\n");
+        spooled += FTP_SPOOL_RECORD_HEADER + strlen("/log/spool.csv") + length;
+      }
+      if (spool.GetPendingBytes() != spooled)
+        result.failures++;
+
+      // Restart on the same port and wait out the client's reconnect backoff
+      server.Begin(server.GetPort());
+      for (int wait = 0; wait < 100 && ftp.isErrorCode(ftp.EnsureSession()); wait++)
+        usleep(50000);
+
+      unsigned long start = Start();
+      uint32_t replayed = 0;
+      for (int pass = 0; pass < 10 && !spool.isEmpty(); pass++)
+        replayed += spool.Replay(ftp);
+      Record(result, ftp, start, spool.isEmpty() ? FTP_RESCODE_ACTION_SUCCESS : FTP_RESCODE_DATA_CONNECTION_ERROR, 0);
+      if (replayed != 100 || spool.GetPendingBytes() != 0)
+        result.failures++;
+    }
+    ftp.SetKeepAliveInterval(FTP_KEEPALIVE_MS);
+
+    if (server.GetFile("/log/spool.csv") != expected || spool.GetDroppedRecords() != 0)
+      result.failures++;
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s/cursor", spoolDir);
+    unlink(path);
+    for (int i = 0; i < 8; i++)
+    {
+      snprintf(path, sizeof(path), "%s/seg_%08d.log", spoolDir, i);
+      unlink(path);
+    }
+    rmdir(spoolDir);
+    results.push_back(result);
+  }
+
+  // Uploader task while the server accepts connections but answers nothing: Push() must not wait for it,
+  // the ring fills up and the rest is counted as dropped. Once the server answers the ring drains in order.
+  {
+    BenchResult result("uploader_stall_100");
+    FtpPosixTransport posixUploader[2];
+    M5_Ethernet_FtpClient queued("127.0.0.1", server.GetPort(), "bench", "bench", 1000);
+    if (isPosix)
+      queued.SetTransport(&posixUploader[0], &posixUploader[1]);
+    M5_Ethernet_FtpSpool notStarted("/nonexistent/spool"); // Begin() never ran, the uploader must treat it as no spool
+    M5_Ethernet_FtpUploader uploader(queued, &notStarted);
+
+    server.SetReplyStall(true);
+    uploader.Begin();
+    usleep(50000); // The task is now waiting for the greeting
+
+    std::string expected;
+    unsigned long start = Start();
+    for (int i = 0; i < 100; i++)
+    {
+      int length = snprintf(line, sizeof(line), "2024/01/01 01:00:%02d,%d", i % 60, i);
+      if (uploader.Push("/log/uploader.csv", line, length))
+        expected.append(line, length).append("\r\n");
+    }
+    bool isFull = uploader.GetDepth() == FTP_RECORD_QUEUE_SIZE && uploader.GetMaxDepth() == FTP_RECORD_QUEUE_SIZE &&
+                  uploader.GetDroppedCount() == 100 - FTP_RECORD_QUEUE_SIZE;
+    Record(result, queued, start, isFull ? FTP_RESCODE_ACTION_SUCCESS : FTP_RESCODE_DATA_CONNECTION_ERROR, 0);
+
+    // Outlast the greeting timeout, so Step() sees the server as down while the ring is full
+    usleep(1500000);
+    if (uploader.GetDepth() != FTP_RECORD_QUEUE_SIZE)
+      result.failures++;
+    server.SetReplyStall(false);
+    for (int wait = 0; wait < 200 && uploader.GetDepth() > 0; wait++)
+      usleep(50000);
+    uploader.End();
+
+    if (uploader.GetStoredCount() != FTP_RECORD_QUEUE_SIZE || uploader.GetDroppedCount() != 100 - FTP_RECORD_QUEUE_SIZE ||
+        uploader.GetRejectedCount() != 0 ||
+        server.GetFile("/log/uploader.csv") != expected)
+      result.failures++;
+    results.push_back(result);
+  }
+
+  ftp.CloseConnection();
+  server.End();
+
+  printf("%-22s %7s %10s %12s %9s %9s %9s\n", "scenario", "ops", "ops/s", "bytes/s", "p50_us", "p99_us", "calls/op");
+  bool isFailed = false;
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    PrintResult(results[i]);
+    isFailed |= results[i].failures > 0;
+  }
+  if (deflateStats.inputBytes > 0)
+    printf("\nupload_deflate_256k: %u bytes in, %u bytes on the wire, ratio %.3f, compressor %u us\n",
+           (unsigned)deflateStats.inputBytes, (unsigned)deflateStats.outputBytes,
+           (double)deflateStats.outputBytes / deflateStats.inputBytes, (unsigned)deflateStats.cpuMicros);
+
+  if (isMetrics)
+  {
+    printf("\n");
+    StdoutPrint out;
+    MetricsWriter writer(out);
+    ftp.WriteMetrics(writer);
+  }
+  return isFailed ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+// Host stand-in for the parts of the Arduino core used by the FTP client, for the native bench build
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HEX 16
+#define DEC 10
+
+class __FlashStringHelper;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+class String
+{
+private:
+  std::string buffer;
+
+public:
+  String() {}
+  String(const char *str) : buffer(str != NULL ? str : "") {}
+  String(const __FlashStringHelper *str) : buffer(reinterpret_cast<const char *>(str)) {}
+  String(const std::string &str) : buffer(str) {}
+  String(char c) : buffer(1, c) {}
+  String(int value) : buffer(std::to_string(value)) {}
+  String(unsigned int value) : buffer(std::to_string(value)) {}
+  String(long value) : buffer(std::to_string(value)) {}
+  String(unsigned long value) : buffer(std::to_string(value)) {}
+
+  const char *c_str() const { return buffer.c_str(); }
+  unsigned int length() const { return buffer.size(); }
+  void reserve(unsigned int size) { buffer.reserve(size); }
+
+  String &operator+=(const String &str)
+  {
+    buffer += str.buffer;
+    return *this;
+  }
+  String &operator+=(const char *str)
+  {
+    buffer += str;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    buffer += c;
+    return *this;
+  }
+  friend String operator+(const String &a, const String &b) { return String(a.buffer + b.buffer); }
+  friend String operator+(const String &a, const char *b) { return String(a.buffer + b); }
+  friend String operator+(const char *a, const String &b) { return String(a + b.buffer); }
+  bool operator==(const String &str) const { return buffer == str.buffer; }
+  bool operator==(const char *str) const { return buffer == str; }
+  char operator[](unsigned int index) const { return buffer[index]; }
+
+  int indexOf(const char *str, unsigned int from = 0) const
+  {
+    size_t pos = buffer.find(str, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  int indexOf(char c, unsigned int from = 0) const
+  {
+    size_t pos = buffer.find(c, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  int lastIndexOf(char c) const
+  {
+    size_t pos = buffer.rfind(c);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  int lastIndexOf(const char *str) const
+  {
+    size_t pos = buffer.rfind(str);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  String substring(unsigned int from) const { return String(buffer.substr(from)); }
+  String substring(unsigned int from, unsigned int to) const { return String(buffer.substr(from, to - from)); }
+  bool startsWith(const char *str) const { return buffer.compare(0, strlen(str), str) == 0; }
+  long toInt() const { return strtol(buffer.c_str(), NULL, 10); }
+};
+
+class Print;
+
+class Printable
+{
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t count = 0;
+    while (size--)
+      count += write(*buffer++);
+    return count;
+  }
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+  virtual int availableForWrite() { return 0; }
+
+  size_t print(const char *str) { return write(str); }
+  size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+  size_t print(const String &str) { return write(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value, int base = DEC) { return printNumber(base == HEX ? "%x" : "%d", value); }
+  size_t print(unsigned int value, int base = DEC) { return printNumber(base == HEX ? "%x" : "%u", value); }
+  size_t print(long value, int base = DEC) { return printNumber(base == HEX ? "%lx" : "%ld", value); }
+  size_t print(unsigned long value, int base = DEC) { return printNumber(base == HEX ? "%lx" : "%lu", value); }
+  size_t print(long long value, int base = DEC) { return printNumber(base == HEX ? "%llx" : "%lld", value); }
+  size_t print(unsigned long long value, int base = DEC) { return printNumber(base == HEX ? "%llx" : "%llu", value); }
+  size_t print(double value, int digits = 2)
+  {
+    char text[48];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return write(text);
+  }
+  size_t print(const Printable &printable) { return printable.printTo(*this); }
+
+  template <typename T>
+  size_t println(const T &value) { return print(value) + println(); }
+  template <typename T>
+  size_t println(const T &value, int format) { return print(value, format) + println(); }
+  size_t println() { return write("\r\n"); }
+
+private:
+  template <typename T>
+  size_t printNumber(const char *format, T value)
+  {
+    char text[24];
+    snprintf(text, sizeof(text), format, value);
+    return write(text);
+  }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() { return -1; }
+
+  size_t readBytes(char *buffer, size_t length)
+  {
+    size_t count = 0;
+    while (count < length)
+    {
+      int c = read();
+      if (c < 0)
+        break;
+      buffer[count++] = c;
+    }
+    return count;
+  }
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+  String readStringUntil(char terminator)
+  {
+    String result;
+    int c;
+    while ((c = read()) >= 0 && c != terminator)
+      result += (char)c;
+    return result;
+  }
+  String readString()
+  {
+    String result;
+    int c;
+    while ((c = read()) >= 0)
+      result += (char)c;
+    return result;
+  }
+};
+
+class IPAddress : public Printable
+{
+private:
+  uint8_t bytes[4];
+
+public:
+  IPAddress() { memset(bytes, 0, sizeof(bytes)); }
+  IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth)
+  {
+    bytes[0] = first;
+    bytes[1] = second;
+    bytes[2] = third;
+    bytes[3] = fourth;
+  }
+  IPAddress(uint32_t address) { memcpy(bytes, &address, sizeof(bytes)); }
+
+  uint8_t operator[](int index) const { return bytes[index]; }
+  operator uint32_t() const
+  {
+    uint32_t address;
+    memcpy(&address, bytes, sizeof(address));
+    return address;
+  }
+  String toString() const
+  {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    return String(text);
+  }
+  size_t printTo(Print &p) const { return p.print(toString()); }
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+  size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+  using Print::write;
+  int available() { return 0; }
+  int read() { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,130 @@
+// Host implementations behind the Arduino, M5Unified and Ethernet stand-ins of the native bench build
+#include <Arduino.h>
+#include <M5Unified.h>
+#include <M5_Ethernet.h>
+
+#include "M5_Ethernet_FtpPosixTransport.hpp"
+
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+HostM5 M5;
+HostTransportStats HostTransport;
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield()
+{
+  std::this_thread::yield();
+}
+
+/////////////////////////////////////////////
+
+EthernetClient::EthernetClient() : socket(std::make_shared<FtpPosixTransport>()), isOpen(false), connectionTimeout(1000)
+{
+}
+
+EthernetClient::EthernetClient(uint8_t) : socket(std::make_shared<FtpPosixTransport>()), isOpen(false), connectionTimeout(1000)
+{
+}
+
+int EthernetClient::connect(IPAddress ip, uint16_t port)
+{
+  isOpen = socket->Connect(ip, port, connectionTimeout);
+  return isOpen ? 1 : 0;
+}
+
+int EthernetClient::connect(const char *host, uint16_t port)
+{
+  isOpen = socket->Connect(host, port, connectionTimeout);
+  return isOpen ? 1 : 0;
+}
+
+uint8_t EthernetClient::connected()
+{
+  HostTransport.status++;
+  return socket->isConnected() ? 1 : 0;
+}
+
+void EthernetClient::stop()
+{
+  socket->Stop();
+  isOpen = false;
+}
+
+int EthernetClient::available()
+{
+  HostTransport.available++;
+  return socket->Available();
+}
+
+int EthernetClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int EthernetClient::read(uint8_t *buffer, size_t size)
+{
+  HostTransport.reads++;
+  if (size > HOST_SOCKET_RX_SIZE)
+    size = HOST_SOCKET_RX_SIZE;
+  return socket->Read(buffer, size);
+}
+
+size_t EthernetClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+/**
+ * @brief Block until everything is queued, the socket closed or HOST_SOCKET_WRITE_TIMEOUT_MS passed without progress.
+ */
+size_t EthernetClient::write(const uint8_t *buffer, size_t size)
+{
+  HostTransport.writes++;
+
+  size_t sent = 0;
+  unsigned long progressMillis = millis();
+  while (sent < size && isOpen)
+  {
+    size_t written = socket->Write(buffer + sent, size - sent);
+    if (written > 0)
+    {
+      sent += written;
+      progressMillis = millis();
+      continue;
+    }
+    if (!socket->isConnected() || millis() - progressMillis >= HOST_SOCKET_WRITE_TIMEOUT_MS)
+      break;
+    yield();
+  }
+  return sent;
+}
+
+int EthernetClient::availableForWrite()
+{
+  int space = socket->AvailableForWrite();
+  return space < HOST_SOCKET_TX_SIZE ? space : HOST_SOCKET_TX_SIZE;
+}
+
+IPAddress EthernetClient::remoteIP()
+{
+  return socket->RemoteIP();
+}
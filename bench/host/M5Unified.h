@@ -0,0 +1,23 @@
+// Host stand-in for M5Unified: log output of the FTP client goes to stderr
+#ifndef HOST_M5UNIFIED_H
+#define HOST_M5UNIFIED_H
+
+#include <Arduino.h>
+
+class HostDisplay : public Print
+{
+public:
+  size_t write(uint8_t c) { return fwrite(&c, 1, 1, stderr); }
+  using Print::write;
+  void setCursor(int, int) {}
+};
+
+struct HostM5
+{
+  HostDisplay Lcd;
+  HostDisplay Display;
+};
+
+extern HostM5 M5;
+
+#endif
@@ -0,0 +1,87 @@
+// Host stand-in for the W5500 Ethernet library: EthernetClient on top of FtpPosixTransport
+#ifndef HOST_M5_ETHERNET_H
+#define HOST_M5_ETHERNET_H
+
+#include <Arduino.h>
+#include <memory>
+
+#ifndef MAX_SOCK_NUM
+#define MAX_SOCK_NUM 8
+#endif
+
+// Socket buffer size as the Ethernet library derives it (SSIZE in utility/w5100.h): 16 KB shared by MAX_SOCK_NUM
+// sockets with ETHERNET_LARGE_BUFFERS, otherwise 2 KB each. availableForWrite() and read() are capped by it.
+#if defined(ETHERNET_LARGE_BUFFERS) && MAX_SOCK_NUM <= 1
+#define HOST_SOCKET_BUFFER_SIZE 16384
+#elif defined(ETHERNET_LARGE_BUFFERS) && MAX_SOCK_NUM <= 2
+#define HOST_SOCKET_BUFFER_SIZE 8192
+#elif defined(ETHERNET_LARGE_BUFFERS) && MAX_SOCK_NUM <= 4
+#define HOST_SOCKET_BUFFER_SIZE 4096
+#else
+#define HOST_SOCKET_BUFFER_SIZE 2048
+#endif
+#define HOST_SOCKET_TX_SIZE HOST_SOCKET_BUFFER_SIZE
+#define HOST_SOCKET_RX_SIZE HOST_SOCKET_BUFFER_SIZE
+#define HOST_SOCKET_WRITE_TIMEOUT_MS 2000 // write() gives up without progress, like a W5500 socket out of retransmissions
+
+/// @brief Calls into the socket layer; on the W5500 each one costs at least one SPI register transaction
+struct HostTransportStats
+{
+  uint32_t available;
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t status; // connected()
+};
+extern HostTransportStats HostTransport;
+
+class Client : public Stream
+{
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int connect(const char *host, uint16_t port) = 0;
+  virtual uint8_t connected() = 0;
+  virtual void stop() = 0;
+  virtual operator bool() = 0;
+  virtual int read(uint8_t *buffer, size_t size) = 0;
+  using Stream::read;
+};
+
+class FtpPosixTransport;
+
+/**
+ * @brief Same contract as the Ethernet library's EthernetClient: reads never block, writes block until sent,
+ * connected() stays true while received data is still unread.
+ * The socket code is FtpPosixTransport's; this class adds the W5500 buffer limits and the call counts.
+ * Copies share the socket, as copies of the library's client share the socket number.
+ */
+class EthernetClient : public Client
+{
+private:
+  std::shared_ptr<FtpPosixTransport> socket;
+  bool isOpen;
+  uint16_t connectionTimeout;
+
+public:
+  EthernetClient();
+  EthernetClient(uint8_t socket);
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(const char *host, uint16_t port);
+  uint8_t connected();
+  void stop();
+  operator bool() { return isOpen; }
+
+  int available();
+  int read();
+  int read(uint8_t *buffer, size_t size);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+  int availableForWrite();
+  void flush() {}
+
+  IPAddress remoteIP();
+  void setConnectionTimeout(uint16_t timeout) { connectionTimeout = timeout; }
+};
+
+#endif
@@ -0,0 +1,4 @@
+// Host stand-in, the native build has no SPI bus
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+#endif
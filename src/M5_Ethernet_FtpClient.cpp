@@ -37,6 +37,10 @@ M5_Ethernet_FtpClient::M5_Ethernet_FtpClient(String _serverAdress, uint16_t _por
   serverAdress = _serverAdress;
   port = _port;
   timeout = _timeout;
+  ClearDirCache();
+  memset(appendSlots, 0, sizeof(appendSlots));
+  memset(&compressionStats, 0, sizeof(compressionStats));
+  memset(&metrics, 0, sizeof(metrics));
 }
 
 M5_Ethernet_FtpClient::M5_Ethernet_FtpClient(String _serverAdress, String _userName, String _passWord, uint16_t _timeout)
@@ -46,11 +50,24 @@ M5_Ethernet_FtpClient::M5_Ethernet_FtpClient(String _serverAdress, String _userN
   serverAdress = _serverAdress;
   port = FTP_PORT;
   timeout = _timeout;
+  ClearDirCache();
+  memset(appendSlots, 0, sizeof(appendSlots));
+  memset(&compressionStats, 0, sizeof(compressionStats));
+  memset(&metrics, 0, sizeof(metrics));
 }
 
-EthernetClient *M5_Ethernet_FtpClient::GetDataClient()
+/**
+ * @brief Run the command and data connections over other transports, e.g. FtpPosixTransport on a host.
+ *
+ * Call it before OpenConnection(); the transports must outlive the client. NULL selects the built-in W5500 transport again.
+ */
+void M5_Ethernet_FtpClient::SetTransport(FtpTransport *control, FtpTransport *data)
 {
-  return &dclient;
+  client->Stop();
+  dclient->Stop();
+  _isConnected = false;
+  client = control ? control : &ethernetControl;
+  dclient = data ? data : &ethernetData;
 }
 
 bool M5_Ethernet_FtpClient::isConnected()
@@ -60,7 +77,7 @@ bool M5_Ethernet_FtpClient::isConnected()
 
 bool M5_Ethernet_FtpClient::isErrorCode(uint16_t responseCode)
 {
-  return responseCode >= 400 && responseCode < 600;
+  return (responseCode >= 400 && responseCode < 600) || responseCode >= FTP_RESCODE_LOCAL_ERROR;
 }
 
 /**
@@ -70,32 +87,57 @@ uint16_t M5_Ethernet_FtpClient::OpenConnection()
 {
   int responceCode = 200;
   FTP_LOGINFO1(F("Connecting to: "), serverAdress);
+  pendingCount = 0;
+  cmdRxPos = cmdRxLength = 0;
 
-#if ((ESP32) && !FTP_CLIENT_USING_ETHERNET)
-  if (client.connect(serverAdress, port, timeout))
-#else
-  if (client.connect(serverAdress.c_str(), port))
-#endif
+  if (client->Connect(serverAdress.c_str(), port, ConnectTimeout()))
   {
+    transferType = 0;
+    transferMode = 'S';
     FTP_LOGINFO(F("Command connected"));
   }
+  else
+  {
+    FTP_LOGERROR(F("Command connection failed"));
+    _isConnected = false;
+    metrics.connectFailures++;
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
 
   responceCode = GetCmdAnswer();
   if (isErrorCode(responceCode))
+  {
+    client->Stop();
+    _isConnected = false;
+    metrics.connectFailures++;
     return responceCode;
+  }
 
   FTP_LOGINFO1("Send USER =", userName);
-  client.print(FTP_COMMAND_USER);
-  client.println(userName);
+  WriteCommand(FTP_COMMAND_USER, userName);
 
   responceCode = GetCmdAnswer();
   if (isErrorCode(responceCode))
+  {
+    client->Stop();
+    _isConnected = false;
+    metrics.connectFailures++;
     return responceCode;
+  }
 
-  FTP_LOGINFO1("Send PASSWORD =", passWord);
-  client.print(FTP_COMMAND_PASS);
-  client.println(passWord);
-  return GetCmdAnswer();
+  FTP_LOGINFO("Send PASS"); // Never the value, the log is readable over GET /log
+  WriteCommand(FTP_COMMAND_PASS, passWord);
+
+  responceCode = GetCmdAnswer();
+  if (isErrorCode(responceCode))
+  {
+    client->Stop();
+    _isConnected = false;
+    metrics.connectFailures++;
+  }
+  else
+    metrics.connects++;
+  return responceCode;
 }
 
 /**
@@ -103,623 +145,2839 @@ uint16_t M5_Ethernet_FtpClient::OpenConnection()
  */
 void M5_Ethernet_FtpClient::CloseConnection()
 {
-  client.println(FTP_COMMAND_QUIT);
-  client.stop();
+  if (isConnected())
+    FlushAppendBuffers();
+
+  WriteCommand(FTP_COMMAND_QUIT);
+  client->Stop();
+  dclient->Stop();
+  _isConnected = false;
   FTP_LOGINFO(F("Connection closed"));
 }
 
 /**
- * @brief Retrieves and processes the response from the FTP server, updating the connection status and storing the result.
+ * @brief Keep the command connection logged in across calls.
+ *
+ * Reconnects and logs in again when the socket has dropped or the server stopped answering.
+ * When the connection has been idle longer than the keepalive interval a NOOP is sent first,
+ * so a half-open socket is found here instead of in the middle of a transfer.
  */
-uint16_t M5_Ethernet_FtpClient::GetCmdAnswer(char *result, int offsetStart)
+uint16_t M5_Ethernet_FtpClient::EnsureSession()
 {
-  char thisByte;
-  outCount = 0;
-  unsigned long _m = millis();
-
-  while (!client.available() && millis() < _m + timeout)
+  if (_isConnected && client->isConnected())
   {
-    delay(100);
+    if (millis() - lastActivityMillis < keepAliveInterval)
+      return FTP_RESCODE_ACTION_SUCCESS;
+
+    if (!isErrorCode(Noop()))
+      return FTP_RESCODE_ACTION_SUCCESS;
   }
 
-  if (!client.available())
-  {
-    memset(outBuf, 0, sizeof(outBuf));
-    strcpy(outBuf, "Offline");
-    _isConnected = false;
-    isConnected();
+  client->Stop();
+  dclient->Stop();
+  _isConnected = false;
+
+  // After a failed reconnect wait out the backoff instead of stalling every caller on a dead server
+  if (reconnectFailures > 0 && (long)(millis() - reconnectMillis) < 0)
     return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
-  }
 
-  while (client.available())
-  {
-    thisByte = client.read();
-    if (outCount < sizeof(outBuf))
-    {
-      outBuf[outCount] = thisByte;
-      outCount++;
-      outBuf[outCount] = 0;
-    }
-  }
+  FTP_LOGWARN(F("Session lost, reconnecting"));
+  metrics.reconnects++;
 
-  uint16_t responseCode = atoi(outBuf);
-  if (isErrorCode(responseCode))
+  uint16_t responseCode = OpenConnection();
+  if (!isErrorCode(responseCode))
   {
-    _isConnected = false;
-    isConnected();
+    reconnectFailures = 0;
     return responseCode;
   }
-  else
-  {
-    _isConnected = true;
-  }
-
-  if (result != NULL)
-  {
-    // Deprecated
-    for (uint32_t i = offsetStart; i < sizeof(outBuf); i++)
-    {
-      result[i] = outBuf[i - offsetStart];
-    }
-    FTP_LOGDEBUG0("!>");
-  }
-  else
-  {
-    FTP_LOGDEBUG0("->");
-  }
 
-  FTP_LOGDEBUG0(outBuf);
+  if (reconnectFailures < 16)
+    reconnectFailures++;
+  unsigned long backoff = ReconnectBackoff(reconnectFailures);
+  reconnectMillis = millis() + backoff;
+  FTP_LOGWARN1(F("Reconnect failed, next attempt in ms: "), backoff);
   return responseCode;
 }
 
 /**
- * @brief Initializes the FTP client in passive mode.
- *
- * This function sets the FTP client to ASCII mode, sends the PASV command to the FTP server,
- * and processes the server's response to establish a data connection in passive mode.
+ * @brief Wait after the given number of consecutive failures: doubled from FTP_RECONNECT_BACKOFF_MIN_MS each time,
+ * at most FTP_RECONNECT_BACKOFF_MAX_MS. Callers keep failures at 16 or below, larger shifts overflow.
  */
-uint16_t M5_Ethernet_FtpClient::InitAsciiPassiveMode()
+unsigned long M5_Ethernet_FtpClient::ReconnectBackoff(uint8_t failures)
 {
-  uint16_t responseCode = FTP_RESCODE_SYNTAX_ERROR;
-
-  FTP_LOGINFO("Send TYPE A");
-  client.println("TYPE A"); // Set ASCII mode
-  responseCode = GetCmdAnswer();
+  unsigned long backoff = FTP_RECONNECT_BACKOFF_MIN_MS << (failures - 1);
+  if (backoff > FTP_RECONNECT_BACKOFF_MAX_MS)
+    backoff = FTP_RECONNECT_BACKOFF_MAX_MS;
+  return backoff - micros() % (backoff / 4 + 1); // Jitter, so pooled sessions do not retry in lockstep
+}
 
-  if (isErrorCode(responseCode))
-    return responseCode;
+/**
+ * @brief Send NOOP to check that the command connection is still alive.
+ */
+uint16_t M5_Ethernet_FtpClient::Noop()
+{
+  FTP_LOGINFO("Send NOOP");
+  WriteCommand(FTP_COMMAND_NOOP);
+  return GetCmdAnswer();
+}
 
-  FTP_LOGINFO("Send PASV");
-  client.println(FTP_COMMAND_PASSIVE_MODE);
+void M5_Ethernet_FtpClient::SetKeepAliveInterval(unsigned long intervalMs)
+{
+  keepAliveInterval = intervalMs;
+}
 
-  responseCode = GetCmdAnswer();
-  if (isErrorCode(responseCode))
-    return responseCode;
+/**
+ * @brief Send one command line with a single socket write.
+ */
+void M5_Ethernet_FtpClient::WriteCommand(const __FlashStringHelper *command, const char *argument)
+{
+  WriteCommand(command, argument, strlen(argument));
+}
 
-  char *tmpPtr;
-  while (strtol(outBuf, &tmpPtr, 10) != FTP_ENTERING_PASSIVE_MODE)
-  {
-    client.println(FTP_COMMAND_PASSIVE_MODE);
+void M5_Ethernet_FtpClient::WriteCommand(const __FlashStringHelper *command, const String &argument)
+{
+  WriteCommand(command, argument.c_str(), argument.length());
+}
 
-    responseCode = GetCmdAnswer();
-    if (isErrorCode(responseCode))
-      return responseCode;
+void M5_Ethernet_FtpClient::WriteCommand(const __FlashStringHelper *command, const char *argument, size_t argumentLength)
+{
+  // A rejected command is reported by the GetCmdAnswer() that follows
+  BatchCommand(command, argument, argumentLength);
+  FlushBatch();
+  batchCount = 0;
+}
 
-    delay(1000);
-  }
+// Verbs with a latency histogram of their own, in the order WriteMetrics() reports them
+static const char *const metricsVerbs[FTP_METRICS_VERBS - 1] = {
+    "USER", "PASS", "NOOP", "FEAT", "TYPE", "MODE", "EPSV", "PASV", "REST", "STOR", "APPE",
+    "RETR", "SIZE", "MDTM", "MKD", "CWD", "RMD", "DELE", "RNFR", "RNTO", "MLSD", "LIST"};
 
-  // Test to know which format
-  // 227 Entering Passive Mode (192,168,2,112,157,218)
-  // 227 Entering Passive Mode (4043483328, port 55600)
-  char *passiveIP = strchr(outBuf, '(') + 1;
+/**
+ * @brief Verbs a server answers from memory. The others may wait on its disk, see CmdAnswerTimeout().
+ */
+static bool IsQuickVerb(uint8_t verbIndex)
+{
+  static const char *const quickVerbs[] = {"USER", "NOOP", "FEAT", "TYPE", "MODE", "EPSV", "PASV", "REST"};
+  if (verbIndex >= FTP_METRICS_VERBS - 1)
+    return false;
 
-  if (atoi(passiveIP) <= 0xFF) // 227 Entering Passive Mode (192,168,2,112,157,218)
+  for (size_t i = 0; i < sizeof(quickVerbs) / sizeof(quickVerbs[0]); i++)
   {
-    char *tStr = strtok(outBuf, "(,");
-    int array_pasv[6];
-
-    for (int i = 0; i < 6; i++)
-    {
-      tStr = strtok(NULL, "(,");
-      if (tStr == NULL)
-      {
-        FTP_LOGDEBUG(F("Bad PASV Answer"));
-        CloseConnection();
-        return FTP_RESCODE_SYNTAX_ERROR;
-      }
-      array_pasv[i] = atoi(tStr);
-    }
-    unsigned int hiPort, loPort;
-    hiPort = array_pasv[4] << 8;
-    loPort = array_pasv[5]; // & 255;
-
-    _dataAddress = IPAddress(array_pasv[0], array_pasv[1], array_pasv[2], array_pasv[3]);
-    _dataPort = hiPort | loPort;
+    if (strcmp(metricsVerbs[verbIndex], quickVerbs[i]) == 0)
+      return true;
   }
-  else // 227 Entering Passive Mode (4043483328, port 55600)
+  return false;
+}
+
+static uint8_t MetricsVerbIndex(const char *command)
+{
+  for (uint8_t i = 0; i < FTP_METRICS_VERBS - 1; i++)
   {
-    // Using with old style PASV answer, such as `FTP_Server_Teensy41` library
-    char *ptr = strtok(passiveIP, ",");
-    uint32_t ret = strtoul(ptr, &tmpPtr, 10);
+    size_t length = strlen(metricsVerbs[i]);
+    if (strncmp(command, metricsVerbs[i], length) == 0 && (command[length] == ' ' || command[length] == 0))
+      return i;
+  }
+  return FTP_METRICS_VERBS - 1;
+}
 
-    passiveIP = strchr(outBuf, ')');
-    ptr = strtok(passiveIP, "port ");
+/**
+ * @brief Add a command to the pending batch. The batch is written by SendBatch().
+ *
+ * When the batch buffer fills up the lines collected so far are written out early,
+ * replies are still matched in order by SendBatch().
+ * A command line longer than the buffer is not sent at all, a shortened path could name another file;
+ * the next SendBatch() or GetCmdAnswer() then returns FTP_RESCODE_COMMAND_TOO_LONG.
+ *
+ * @return false when the command was rejected
+ */
+bool M5_Ethernet_FtpClient::BatchCommand(const __FlashStringHelper *command, const char *argument, size_t argumentLength)
+{
+  const char *verb = reinterpret_cast<const char *>(command);
+  size_t verbLength = strlen(verb);
 
-    _dataAddress = IPAddress(ret);
-    _dataPort = strtol(ptr, &tmpPtr, 10);
+  if (verbLength + argumentLength + 2 > sizeof(cmdBuf))
+  {
+    FTP_LOGERROR1(F("Command too long, not sent: "), verb);
+    commandRejected = true;
+    return false;
   }
 
-  FTP_LOGINFO3(F("dataAddress:"), _dataAddress, F(", dataPort:"), _dataPort);
+  if (cmdLength + verbLength + argumentLength + 2 > sizeof(cmdBuf))
+    FlushBatch();
 
-// data connection create
-#if ((ESP32) && !FTP_CLIENT_USING_ETHERNET)
-  if (dclient.connect(_dataAddress, _dataPort, timeout))
-#else
-  if (dclient.connect(_dataAddress, _dataPort))
-#endif
+  memcpy(cmdBuf + cmdLength, verb, verbLength);
+  cmdLength += verbLength;
+  memcpy(cmdBuf + cmdLength, argument, argumentLength);
+  cmdLength += argumentLength;
+  cmdBuf[cmdLength++] = '\r';
+  cmdBuf[cmdLength++] = '\n';
+  batchCount++;
+
+  // Remember the verb and the time, ObserveReply() takes them off in reply order
+  metrics.commands++;
+  if (pendingCount < FTP_METRICS_PENDING)
   {
-    FTP_LOGDEBUG(F("Data connection established"));
-    responseCode = FTP_RESCODE_ACTION_SUCCESS;
+    uint8_t index = (pendingHead + pendingCount) % FTP_METRICS_PENDING;
+    pendingVerbs[index] = MetricsVerbIndex(verb);
+    pendingMicros[index] = micros();
+    pendingCount++;
   }
-  else
+  return true;
+}
+
+void M5_Ethernet_FtpClient::FlushBatch()
+{
+  if (cmdLength == 0)
+    return;
+
+  client->Write((const uint8_t *)cmdBuf, cmdLength);
+  cmdLength = 0;
+}
+
+/**
+ * @brief Write the pending batch and read one reply per command, in order.
+ *
+ * @param responseCodes receives the reply code of each command, up to maxCodes entries
+ * @return FTP_RESCODE_CLIENT_ISNOT_CONNECTED when a reply did not arrive, FTP_RESCODE_COMMAND_TOO_LONG when
+ * BatchCommand() rejected a command of the batch, otherwise the last reply code
+ */
+uint16_t M5_Ethernet_FtpClient::SendBatch(uint16_t *responseCodes, uint8_t maxCodes)
+{
+  uint8_t count = batchCount;
+  batchCount = 0;
+  bool isRejected = commandRejected; // The replies of the commands that were sent are read first
+  commandRejected = false;
+  FlushBatch();
+
+  uint16_t responseCode = FTP_RESCODE_ACTION_SUCCESS;
+  for (uint8_t i = 0; i < count; i++)
   {
-    FTP_LOGDEBUG(F("Data connection not established error"));
-    responseCode = FTP_RESCODE_DATA_CONNECTION_ERROR;
+    if (responseCode != FTP_RESCODE_CLIENT_ISNOT_CONNECTED)
+      responseCode = GetCmdAnswer();
+
+    if (i < maxCodes)
+      responseCodes[i] = responseCode;
   }
 
+  if (isRejected && responseCode != FTP_RESCODE_CLIENT_ISNOT_CONNECTED)
+    responseCode = FTP_RESCODE_COMMAND_TOO_LONG;
   return responseCode;
 }
 
 /**
- * @brief Sends a directory listing command to the FTP server and retrieves the list of directory contents.
+ * @brief Retrieves and processes the response from the FTP server, updating the connection status and storing the result.
+ *
+ * Returns as soon as the last line of the reply has arrived. Multi-line replies (RFC 959 "NNN-" ... "NNN ")
+ * are collected into outBuf as a whole; bytes after the reply stay in cmdRx for the next call.
  */
-uint16_t M5_Ethernet_FtpClient::ContentList(const char *dir, String *list)
+uint16_t M5_Ethernet_FtpClient::GetCmdAnswer(char *result, int offsetStart)
 {
-  if (!isConnected())
+  if (commandRejected)
   {
-    FTP_LOGERROR("ContentList: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+    commandRejected = false;
+    return FTP_RESCODE_COMMAND_TOO_LONG;
   }
 
-  char _resp[sizeof(outBuf)];
-
-  FTP_LOGINFO("Send MLSD");
-  client.print(FTP_COMMAND_LIST_DIR_STANDARD);
-  client.println(dir);
-
-  uint16_t responseCode = GetCmdAnswer(_resp);
-  if (isErrorCode(responseCode))
-    return responseCode;
-
-  // Convert char array to string to manipulate and find response size
-  // each server reports it differently, TODO = FEAT
-  // String resp_string = _resp;
-  // resp_string.substring(resp_string.lastIndexOf('matches')-9);
-  // FTP_LOGDEBUG(resp_string);
-
   unsigned long _m = millis();
+  unsigned long _us = micros();
+  unsigned long waitMs = CmdAnswerTimeout();
+  uint16_t responseCode;
 
-  while (!dclient.available() && millis() < _m + timeout)
-    delay(1);
-
-  uint16_t _b = 0;
-  while (dclient.available())
+  while ((responseCode = PollCmdAnswer()) == 0 && millis() - _m < waitMs)
   {
-    if (_b < 256)
-    {
-      list[_b] = dclient.readStringUntil('\n');
-      FTP_LOGDEBUG(String(_b) + ":" + list[_b]);
-      _b++;
-    }
+    if (!client->isConnected() && !client->Available())
+      break;
+    PollWait(_us);
   }
 
-  return responseCode;
-}
-
-/////////////////////////////////////////////
-
-uint16_t M5_Ethernet_FtpClient::ContentListWithListCommand(const char *dir, String *list)
-{
-  if (!isConnected())
+  if (responseCode == 0)
   {
-    FTP_LOGERROR("ContentListWithListCommand: Not connected error");
+    if (millis() - _m >= waitMs)
+      ObserveTimeout();
+    pendingCount = 0;
+    ResetCmdAnswer();
+    strcpy(outBuf, "Offline");
+    _isConnected = false;
     return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
   }
 
-  char _resp[sizeof(outBuf)];
-  uint16_t _b = 0;
-
-  FTP_LOGINFO("Send LIST");
-  client.print(FTP_COMMAND_LIST_DIR);
-  client.println(dir);
+  lastActivityMillis = millis();
+  ObserveReply(responseCode);
 
-  uint16_t responseCode = GetCmdAnswer(_resp);
+  // Any reply means the command connection is alive; only 421 announces that the server is closing it.
+  _isConnected = responseCode != FTP_RESCODE_SERVICE_NOT_AVAILABLE;
   if (isErrorCode(responseCode))
     return responseCode;
 
-  // Convert char array to string to manipulate and find response size
-  // each server reports it differently, TODO = FEAT
-  // String resp_string = _resp;
-  // resp_string.substring(resp_string.lastIndexOf('matches')-9);
-  // FTP_LOGDEBUG(resp_string);
-
-  FTP_LOGINFO("Expand LIST");
-  unsigned long _m = millis();
-
-  while (!dclient.available() && millis() < _m + timeout)
-  {
-    delay(1);
-  }
-
-  while (dclient.available())
+  if (result != NULL)
   {
-    if (_b < 128)
+    // Deprecated
+    for (uint32_t i = offsetStart; i < sizeof(outBuf); i++)
     {
-      String tmp = dclient.readStringUntil('\n');
-      list[_b] = tmp.substring(tmp.lastIndexOf(" ") + 1, tmp.length());
-      FTP_LOGDEBUG(String(_b) + ":" + tmp);
-      _b++;
+      result[i] = outBuf[i - offsetStart];
     }
+    FTP_LOGDEBUG0("!>");
+  }
+  else
+  {
+    FTP_LOGDEBUG0("->");
   }
 
+  FTP_LOGDEBUG0(outBuf);
   return responseCode;
 }
 
-/////////////////////////////////////////////
-
-uint16_t M5_Ethernet_FtpClient::GetLastModifiedTime(const char *fileName, char *result)
+/**
+ * @brief Time the oldest unanswered command and count error replies.
+ *
+ * Replies without a command of their own (the greeting, 226 after a transfer) find no pending entry.
+ */
+void M5_Ethernet_FtpClient::ObserveReply(uint16_t responseCode)
 {
-  if (!isConnected())
-  {
-    FTP_LOGERROR("GetLastModifiedTime: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
-  }
+  if (isErrorCode(responseCode))
+    metrics.errorReplies++;
 
-  FTP_LOGINFO("Send MDTM");
-  client.print(FTP_COMMAND_FILE_LAST_MOD_TIME);
-  client.println(fileName);
-  return GetCmdAnswer(result, 4);
-}
+  if (pendingCount == 0)
+    return;
 
-/////////////////////////////////////////////
+  uint32_t elapsed = micros() - pendingMicros[pendingHead];
+  metrics.latency[pendingVerbs[pendingHead]].Observe(elapsed);
+  ObserveRtt(elapsed);
+  pendingHead = (pendingHead + 1) % FTP_METRICS_PENDING;
+  pendingCount--;
+}
 
-uint16_t M5_Ethernet_FtpClient::Write(const char *str)
+/**
+ * @brief Fold one reply time into the smoothed estimate (Jacobson/Karels, gains 1/8 and 1/4).
+ */
+void M5_Ethernet_FtpClient::ObserveRtt(uint32_t sampleMicros)
 {
-  if (!isConnected())
+  rtoBackoff = 0;
+  if (srttMicros == 0)
   {
-    FTP_LOGERROR("Write: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+    srttMicros = sampleMicros > 0 ? sampleMicros : 1;
+    rttVarMicros = sampleMicros / 2;
+    return;
   }
 
-  FTP_LOGDEBUG(F("Write File"));
-  GetDataClient()->print(str);
-
-  return FTP_RESCODE_ACTION_SUCCESS;
+  int32_t delta = (int32_t)(sampleMicros - srttMicros);
+  srttMicros += delta / 8;
+  if (srttMicros == 0)
+    srttMicros = 1;
+  rttVarMicros += ((delta < 0 ? -delta : delta) - (int32_t)rttVarMicros) / 4;
 }
 
-/////////////////////////////////////////////
+/**
+ * @brief A reply did not arrive in time: count it and double the reply timeout until a reply is timed again.
+ */
+void M5_Ethernet_FtpClient::ObserveTimeout()
+{
+  metrics.timeouts++;
+  if (rtoBackoff < FTP_RTO_MAX_BACKOFF)
+    rtoBackoff++;
+}
 
-uint16_t M5_Ethernet_FtpClient::CloseDataClient()
+/**
+ * @brief Wait for the reply to a command: SRTT + 4 * RTTVAR, at least FTP_RTO_MIN_MS and at most timeout.
+ */
+unsigned long M5_Ethernet_FtpClient::ReplyTimeout()
 {
-  if (!isConnected())
-  {
-    FTP_LOGERROR("CloseFile: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
-  }
+  unsigned long rto = FTP_RTO_INITIAL_MS;
+  if (srttMicros != 0)
+    rto = (srttMicros + 4 * (unsigned long)rttVarMicros) / 1000 + 1;
+  if (rto < FTP_RTO_MIN_MS)
+    rto = FTP_RTO_MIN_MS;
+
+  rto <<= rtoBackoff;
+  return rto < timeout ? rto : timeout;
+}
 
-  FTP_LOGDEBUG(F("Close File"));
-  dclient.stop();
+unsigned long M5_Ethernet_FtpClient::ConnectTimeout()
+{
+  unsigned long waitMs = ReplyTimeout() * FTP_RTO_CONNECT_FACTOR;
+  return waitMs < timeout ? waitMs : timeout;
+}
 
-  return GetCmdAnswer();
+/**
+ * @brief Wait for the data connection and for replies that depend on the server's disk:
+ * FTP_RTO_DATA_FACTOR reply timeouts, at least FTP_DATA_TIMEOUT_MIN_MS and at most timeout.
+ *
+ * A timeout drops the session, so this errs on the long side; the RTT only says how fast the LAN is.
+ */
+unsigned long M5_Ethernet_FtpClient::DataTimeout()
+{
+  unsigned long waitMs = ReplyTimeout() * FTP_RTO_DATA_FACTOR;
+  if (waitMs < FTP_DATA_TIMEOUT_MIN_MS)
+    waitMs = FTP_DATA_TIMEOUT_MIN_MS;
+  return waitMs < timeout ? waitMs : timeout;
 }
 
-/////////////////////////////////////////////
+/**
+ * @brief Commands the server answers from memory (NOOP, TYPE, PASV, ...) get ReplyTimeout(), so a dead
+ * session is noticed quickly. MKD, DELE, STOR and the other verbs that touch files get DataTimeout(), as do
+ * the greeting and the 226 after a transfer, which have no pending command: the server may still be
+ * looking up the client or closing the file.
+ */
+unsigned long M5_Ethernet_FtpClient::CmdAnswerTimeout()
+{
+  if (pendingCount > 0 && IsQuickVerb(pendingVerbs[pendingHead]))
+    return ReplyTimeout();
+  return DataTimeout();
+}
 
-uint16_t M5_Ethernet_FtpClient::RenameFile(String from, String to)
+void M5_Ethernet_FtpClient::ResetCmdAnswer()
 {
-  if (!isConnected())
-  {
-    FTP_LOGERROR("RenameFile: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
-  }
+  outCount = 0;
+  outBuf[0] = 0;
+  replyCode = 0;
+  replyLineLen = 0;
+  replyDone = false;
+}
 
-  FTP_LOGINFO("Send RNFR");
-  client.print(FTP_COMMAND_RENAME_FILE_FROM);
-  client.println(from);
+/**
+ * @brief Consume whatever reply bytes are available without waiting.
+ *
+ * The socket is read in blocks into cmdRx; bytes after the end of the reply stay there for the next reply.
+ *
+ * @return The reply code once the final line of the reply is complete, otherwise 0.
+ */
+uint16_t M5_Ethernet_FtpClient::PollCmdAnswer()
+{
+  if (replyDone)
+    ResetCmdAnswer();
 
-  uint16_t responseCode = GetCmdAnswer();
-  if (isErrorCode(responseCode))
-    return responseCode;
+  while (true)
+  {
+    if (cmdRxPos >= cmdRxLength)
+    {
+      int received = client->Read(cmdRx, sizeof(cmdRx));
+      if (received <= 0)
+        break;
+      cmdRxPos = 0;
+      cmdRxLength = received;
+    }
 
-  FTP_LOGINFO("Send RNTO");
-  client.print(FTP_COMMAND_RENAME_FILE_TO);
-  client.println(to);
-  return GetCmdAnswer();
-}
+    char thisByte = cmdRx[cmdRxPos++];
 
-/////////////////////////////////////////////
+    if (outCount < sizeof(outBuf) - 1)
+    {
+      outBuf[outCount] = thisByte;
+      outCount++;
+      outBuf[outCount] = 0;
+    }
 
-uint16_t M5_Ethernet_FtpClient::NewFile(String fileName)
-{
-  if (!isConnected())
-  {
-    FTP_LOGERROR("NewFile: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+    if (thisByte != '\n')
+    {
+      if (replyLineLen < sizeof(replyLineHead))
+        replyLineHead[replyLineLen] = thisByte;
+      if (replyLineLen < 0xFF)
+        replyLineLen++;
+      continue;
+    }
+
+    // A line is complete, look at "NNN" and the separator after it
+    bool hasCode = replyLineLen >= 3 && isdigit(replyLineHead[0]) && isdigit(replyLineHead[1]) && isdigit(replyLineHead[2]);
+    char separator = replyLineLen >= 4 ? replyLineHead[3] : ' ';
+    replyLineLen = 0;
+
+    if (!hasCode)
+      continue;
+
+    uint16_t lineCode = (replyLineHead[0] - '0') * 100 + (replyLineHead[1] - '0') * 10 + (replyLineHead[2] - '0');
+    if (replyCode == 0)
+      replyCode = lineCode;
+
+    if (lineCode == replyCode && separator != '-')
+    {
+      replyDone = true;
+      return replyCode;
+    }
   }
 
-  FTP_LOGINFO("Send STOR");
-  client.print(FTP_COMMAND_FILE_UPLOAD);
-  client.println(fileName);
-  return GetCmdAnswer();
+  return 0;
 }
 
-/////////////////////////////////////////////
-
-uint16_t M5_Ethernet_FtpClient::ChangeWorkDir(String dir)
+/**
+ * @brief Read the data connection address from a 227 reply without modifying it.
+ *
+ * 227 Entering Passive Mode (192,168,2,112,157,218)
+ * 227 Entering Passive Mode (4043483328, port 55600)
+ */
+bool M5_Ethernet_FtpClient::ParsePassiveAnswer(const char *answer)
 {
-  if (!isConnected())
+  const char *ptr = strchr(answer, '(');
+  ptr = ptr != NULL ? ptr + 1 : answer + 4; // Some servers leave out the parentheses
+  while (*ptr != 0 && !isdigit(*ptr))
+    ptr++;
+
+  char *endPtr;
+  unsigned long first = strtoul(ptr, &endPtr, 10);
+  if (endPtr == ptr)
+    return false;
+
+  if (first > 0xFF)
   {
-    FTP_LOGERROR("ChangeWorkDir: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+    // Using with old style PASV answer, such as `FTP_Server_Teensy41` library
+    const char *portPtr = strstr(endPtr, "port");
+    if (portPtr == NULL)
+      return false;
+
+    _dataAddress = IPAddress((uint32_t)first);
+    _dataPort = strtoul(portPtr + 4, NULL, 10);
+    return true;
   }
 
-  FTP_LOGINFO("Send CWD");
-  client.print(FTP_COMMAND_CURRENT_WORKING_DIR);
-  client.println(dir);
-  return GetCmdAnswer();
+  int array_pasv[6];
+  array_pasv[0] = first;
+  for (int i = 1; i < 6; i++)
+  {
+    if (*endPtr != ',')
+      return false;
+
+    ptr = endPtr + 1;
+    array_pasv[i] = strtoul(ptr, &endPtr, 10);
+    if (endPtr == ptr)
+      return false;
+  }
+
+  _dataAddress = IPAddress(array_pasv[0], array_pasv[1], array_pasv[2], array_pasv[3]);
+  _dataPort = (array_pasv[4] << 8) | array_pasv[5];
+  return true;
 }
 
-/////////////////////////////////////////////
+/**
+ * @brief Read the data port from a 229 reply, the host is the one of the command connection.
+ *
+ * 229 Entering Extended Passive Mode (|||6446|)
+ */
+bool M5_Ethernet_FtpClient::ParseExtendedPassiveAnswer(const char *answer)
+{
+  const char *ptr = strchr(answer, '(');
+  if (ptr == NULL || ptr[1] == 0)
+    return false;
+
+  char delimiter = ptr[1];
+  if (ptr[2] != delimiter || ptr[3] != delimiter)
+    return false;
+
+  char *endPtr;
+  unsigned long dataPort = strtoul(ptr + 4, &endPtr, 10);
+  if (endPtr == ptr + 4 || *endPtr != delimiter || dataPort == 0 || dataPort > 0xFFFF)
+    return false;
+
+  _dataPort = dataPort;
+  return true;
+}
 
-uint16_t M5_Ethernet_FtpClient::MakeDir(String dir)
+uint16_t M5_Ethernet_FtpClient::InitAsciiPassiveMode()
 {
-  if (!isConnected())
-  {
-    FTP_LOGERROR("MakeDir: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
-  }
+  return InitPassiveMode('A'); // Set ASCII mode
+}
 
-  FTP_LOGINFO("Send MKD");
-  client.print(FTP_COMMAND_MAKE_DIR);
-  client.println(dir);
-  return GetCmdAnswer();
+uint16_t M5_Ethernet_FtpClient::InitBinaryPassiveMode()
+{
+  return InitPassiveMode('I'); // Set binary mode
 }
 
-uint16_t M5_Ethernet_FtpClient::MakeDirRecursive(String dir)
+/**
+ * @brief Send TYPE unless the session already uses it.
+ */
+uint16_t M5_Ethernet_FtpClient::SetTransferType(char type)
 {
-  if (!isConnected())
-  {
-    FTP_LOGERROR("MakeDirRecursive: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
-  }
+  if (transferType == type)
+    return FTP_RESCODE_ACTION_SUCCESS;
 
-  FTP_LOGINFO("Send MKD Recursive");
+  FTP_LOGINFO(type == 'I' ? "Send TYPE I" : "Send TYPE A");
+  WriteCommand(type == 'I' ? FTP_COMMAND_TYPE_BINARY : FTP_COMMAND_TYPE_ASCII);
+  uint16_t responseCode = GetCmdAnswer();
+
+  transferType = isErrorCode(responseCode) ? 0 : type;
+  return responseCode;
+}
+
+/**
+ * @brief Send MODE unless the session already uses it.
+ *
+ * A refused MODE Z is remembered and the session stays in stream mode, which is not an error.
+ */
+uint16_t M5_Ethernet_FtpClient::SetTransferMode(char mode)
+{
+  if (transferMode == mode)
+    return FTP_RESCODE_ACTION_SUCCESS;
 
-  std::vector<String> paths = SplitPath(dir);
-  String currentPath = "";
+  FTP_LOGINFO(mode == 'Z' ? "Send MODE Z" : "Send MODE S");
+  WriteCommand(mode == 'Z' ? FTP_COMMAND_MODE_DEFLATE : FTP_COMMAND_MODE_STREAM);
+  uint16_t responseCode = GetCmdAnswer();
 
-  for (const String &subDir : paths)
+  if (!isErrorCode(responseCode))
   {
-    currentPath += "/" + subDir;
-    client.print(FTP_COMMAND_MAKE_DIR);
-    client.println(currentPath);
-    uint16_t res = GetCmdAnswer();
-    if (isErrorCode(res) && res != 550)
-    { // Ignore "Directory already exists" error
-      return res;
-    }
+    transferMode = mode;
   }
-  return FTP_RESCODE_ACTION_SUCCESS;
+  else if (mode == 'Z' && responseCode != FTP_RESCODE_CLIENT_ISNOT_CONNECTED && responseCode != FTP_RESCODE_SERVICE_NOT_AVAILABLE)
+  {
+    FTP_LOGWARN("MODE Z refused, using stream mode");
+    modeZSupported = 0;
+    return FTP_RESCODE_ACTION_SUCCESS;
+  }
+
+  return responseCode;
 }
 
-std::vector<String> M5_Ethernet_FtpClient::SplitPath(const String &path)
+/**
+ * @brief Initializes the FTP client in passive mode.
+ *
+ * This function sets the transfer type, asks the FTP server for a passive data port
+ * and establishes the data connection.
+ * TYPE is only sent when it differs from the one already negotiated on this session.
+ * EPSV is preferred; servers that reject it are remembered and get PASV from then on.
+ * With compress the session is switched to MODE Z when the server offers it, every other
+ * transfer puts it back into stream mode.
+ */
+uint16_t M5_Ethernet_FtpClient::InitPassiveMode(char type, bool compress)
 {
-  std::vector<String> paths;
-  String tempPath = "";
-  for (char c : path)
+  isDeflating = false;
+
+  uint16_t responseCode = SetTransferType(type);
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  bool deflate = compress && FtpDeflate::isAvailable() && isModeZSupported() && deflater.Begin();
+  responseCode = SetTransferMode(deflate ? 'Z' : 'S');
+  if (isErrorCode(responseCode))
+    return responseCode;
+  isDeflating = transferMode == 'Z';
+
+  if (epsvSupported)
   {
-    if (c == '/')
+    FTP_LOGINFO("Send EPSV");
+    WriteCommand(FTP_COMMAND_EXTENDED_PASSIVE_MODE);
+
+    responseCode = GetCmdAnswer();
+    if (responseCode == FTP_ENTERING_EXTENDED_PASSIVE_MODE && ParseExtendedPassiveAnswer(outBuf))
     {
-      if (tempPath.length() > 0)
-      {
-        paths.push_back(tempPath);
-      }
-      tempPath = "";
+      _dataAddress = client->RemoteIP();
+    }
+    else if (responseCode == FTP_RESCODE_CLIENT_ISNOT_CONNECTED || responseCode == FTP_RESCODE_SERVICE_NOT_AVAILABLE)
+    {
+      return responseCode;
     }
     else
     {
-      tempPath += c;
+      FTP_LOGINFO("EPSV not supported, using PASV");
+      epsvSupported = false;
     }
   }
-  if (tempPath.length() > 0)
+
+  if (!epsvSupported)
   {
-    paths.push_back(tempPath);
+    FTP_LOGINFO("Send PASV");
+    WriteCommand(FTP_COMMAND_PASSIVE_MODE);
+
+    responseCode = GetCmdAnswer();
+    if (isErrorCode(responseCode))
+      return responseCode;
+
+    if (responseCode != FTP_ENTERING_PASSIVE_MODE || !ParsePassiveAnswer(outBuf))
+    {
+      FTP_LOGDEBUG(F("Bad PASV Answer"));
+      return FTP_RESCODE_SYNTAX_ERROR;
+    }
   }
-  return paths;
-}
 
-/////////////////////////////////////////////
+  FTP_LOGINFO3(F("dataAddress:"), _dataAddress, F(", dataPort:"), _dataPort);
 
-uint16_t M5_Ethernet_FtpClient::RemoveDir(String dir)
+// data connection create
+  if (dclient->Connect(_dataAddress, _dataPort, ConnectTimeout()))
+  {
+    FTP_LOGDEBUG(F("Data connection established"));
+    responseCode = FTP_RESCODE_ACTION_SUCCESS;
+  }
+  else
+  {
+    FTP_LOGDEBUG(F("Data connection not established error"));
+    responseCode = FTP_RESCODE_DATA_CONNECTION_ERROR;
+  }
+
+  return responseCode;
+}
+
+/// @brief State of ContentList() and ContentListWithListCommand() while lines arrive
+struct ContentListContext
 {
-  if (!isConnected())
+  String *list;
+  uint16_t count;
+  uint16_t maxCount;
+  bool nameOnly; // Keep only the text after the last space, the name in a LIST line
+  bool isStopped;
+};
+
+static bool ContentListLine(void *context, char *line, size_t)
+{
+  ContentListContext *lines = (ContentListContext *)context;
+  const char *text = line;
+  if (lines->nameOnly)
   {
-    FTP_LOGERROR("RemoveDir: Not connected error");
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+    const char *space = strrchr(line, ' ');
+    if (space != NULL)
+      text = space + 1;
   }
 
-  FTP_LOGINFO("Send RMD");
-  client.print(FTP_COMMAND_REMOVE_DIR);
-  client.println(dir);
-  return GetCmdAnswer();
+  lines->list[lines->count] = text;
+  FTP_LOGDEBUG(String(lines->count) + ":" + line);
+  lines->isStopped = ++lines->count >= lines->maxCount;
+  return !lines->isStopped;
 }
 
-/////////////////////////////////////////////
+/// @brief State of ListDir() while lines arrive
+struct ListDirContext
+{
+  M5_Ethernet_FtpClient *client;
+  FtpListCallback callback;
+  void *context;
+  uint32_t *count;
+  bool isStopped; // callback returned false
+};
 
-uint16_t M5_Ethernet_FtpClient::AppendFile(String fileName)
+/**
+ * @brief Sends a directory listing command to the FTP server and retrieves the list of directory contents.
+ */
+uint16_t M5_Ethernet_FtpClient::ContentList(const char *dir, String *list)
 {
   if (!isConnected())
   {
-    FTP_LOGERROR("AppendFile: Not connected error");
+    FTP_LOGERROR("ContentList: Not connected error");
     return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
   }
 
-  FTP_LOGINFO("Send APPE");
-  client.print(FTP_COMMAND_APPEND_FILE);
-  client.println(fileName);
-
-  return GetCmdAnswer();
-}
+  char _resp[sizeof(outBuf)];
 
-/////////////////////////////////////////////
+  FTP_LOGINFO("Send MLSD");
+  WriteCommand(FTP_COMMAND_LIST_DIR_STANDARD, dir);
 
-uint16_t M5_Ethernet_FtpClient::AppendTextLine(String filePath, String textLine)
-{
-  uint16_t responseCode = FTP_RESCODE_ACTION_SUCCESS;
-  if (isErrorCode(InitAsciiPassiveMode()))
+  uint16_t responseCode = GetCmdAnswer(_resp);
+  if (isErrorCode(responseCode))
     return responseCode;
 
-  if (isErrorCode(AppendFile(filePath)))
-    return responseCode;
+  // Convert char array to string to manipulate and find response size
+  // each server reports it differently, TODO = FEAT
+  // String resp_string = _resp;
+  // resp_string.substring(resp_string.lastIndexOf('matches')-9);
+  // FTP_LOGDEBUG(resp_string);
 
-  if (isErrorCode(WriteData(textLine + "\r\n")))
-    return responseCode;
+  ContentListContext lines = {list, 0, 256, false, false}; // Entries past the array are dropped by CloseTransfer()
+  if (!ReadDataLines(ContentListLine, &lines))
+    FTP_LOGERROR("ContentList: Data connection timeout");
 
-  return CloseDataClient();
+  return CloseTransfer(responseCode, lines.isStopped);
 }
 
 /////////////////////////////////////////////
 
-uint16_t M5_Ethernet_FtpClient::DeleteFile(String file)
+uint16_t M5_Ethernet_FtpClient::ContentListWithListCommand(const char *dir, String *list)
 {
   if (!isConnected())
   {
-    FTP_LOGERROR("DeleteFile: Not connected error");
+    FTP_LOGERROR("ContentListWithListCommand: Not connected error");
     return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
   }
 
-  FTP_LOGINFO("Send DELE");
-  client.print(FTP_COMMAND_DELETE_FILE);
-  client.println(file);
+  char _resp[sizeof(outBuf)];
 
-  return GetCmdAnswer();
+  FTP_LOGINFO("Send LIST");
+  WriteCommand(FTP_COMMAND_LIST_DIR, dir);
+
+  uint16_t responseCode = GetCmdAnswer(_resp);
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  // Convert char array to string to manipulate and find response size
+  // each server reports it differently, TODO = FEAT
+  // String resp_string = _resp;
+  // resp_string.substring(resp_string.lastIndexOf('matches')-9);
+  // FTP_LOGDEBUG(resp_string);
+
+  FTP_LOGINFO("Expand LIST");
+  ContentListContext lines = {list, 0, 128, true, false}; // Entries past the array are dropped by CloseTransfer()
+  if (!ReadDataLines(ContentListLine, &lines))
+    FTP_LOGERROR("ContentListWithListCommand: Data connection timeout");
+
+  return CloseTransfer(responseCode, lines.isStopped);
 }
 
 /////////////////////////////////////////////
 
-uint16_t M5_Ethernet_FtpClient::WriteData(unsigned char *data, int dataLength)
+/**
+ * @brief Stream a directory listing (MLSD) entry by entry.
+ *
+ * Each line is parsed into an FtpListEntry as it arrives from the data connection and handed to callback,
+ * so there is no limit on the number of entries and nothing is allocated per entry.
+ * The listing stops early when callback returns false; the server's 426 for the aborted transfer is consumed
+ * and ListDir() still succeeds.
+ *
+ * @param count receives the number of entries passed to callback, may be NULL
+ */
+uint16_t M5_Ethernet_FtpClient::ListDir(const char *dir, FtpListCallback callback, void *context, uint32_t *count)
 {
   if (!isConnected())
   {
-    FTP_LOGERROR("WriteData: Not connected error");
+    FTP_LOGERROR("ListDir: Not connected error");
     return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
   }
-  FTP_LOGDEBUG1("WriteData: datalen =", dataLength);
-  return WriteClientBuffered(&dclient, &data[0], dataLength);
+
+  if (count != NULL)
+    *count = 0;
+
+  uint16_t responseCode = InitAsciiPassiveMode();
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  FTP_LOGINFO("Send MLSD");
+  WriteCommand(FTP_COMMAND_LIST_DIR_STANDARD, dir);
+
+  responseCode = GetCmdAnswer();
+  if (isErrorCode(responseCode))
+  {
+    dclient->Stop();
+    return responseCode;
+  }
+
+  ListDirContext lines = {this, callback, context, count, false};
+  if (!ReadDataLines(ListDirLine, &lines))
+    FTP_LOGERROR("ListDir: Data connection timeout");
+
+  return CloseTransfer(responseCode, lines.isStopped);
 }
 
-uint16_t M5_Ethernet_FtpClient::WriteData(String data)
+bool M5_Ethernet_FtpClient::ListDirLine(void *context, char *line, size_t length)
 {
-  return WriteData((unsigned char *)data.c_str(), data.length());
+  ListDirContext *lines = (ListDirContext *)context;
+  FtpListEntry entry;
+  if (length == 0 || !lines->client->ParseListEntry(line, &entry))
+    return true;
+
+  // ReadDataLines() cut the line, the name at its end is incomplete
+  if (length > strlen(line))
+    entry.isTruncated = true;
+
+  if (lines->count != NULL)
+    (*lines->count)++;
+  lines->isStopped = !lines->callback(lines->context, entry);
+  return !lines->isStopped;
 }
 
-/////////////////////////////////////////////
+/**
+ * @brief Idle step of the receive loops: poll again at once for FTP_POLL_SPIN_US after the last progress, then sleep.
+ *
+ * Each poll is a single socket call, so a reply that takes a few hundred microseconds is not rounded up to a 1 ms delay.
+ */
+void M5_Ethernet_FtpClient::PollWait(unsigned long sinceMicros)
+{
+  if (micros() - sinceMicros < FTP_POLL_SPIN_US)
+    yield();
+  else
+    delay(1);
+}
 
-uint16_t M5_Ethernet_FtpClient::WriteClientBuffered(EthernetClient *cli, unsigned char *data, int dataLength)
+/**
+ * @brief Read what the data connection has received into dataRx, with one socket call.
+ *
+ * @return Bytes in dataRx, 0 when nothing has arrived.
+ */
+int M5_Ethernet_FtpClient::ReadData()
 {
-  if (!isConnected())
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  int received = dclient->Read(dataRx, sizeof(dataRx));
+  if (received <= 0)
+    return 0;
+
+  metrics.bytesReceived += received;
+  return received;
+}
+
+/**
+ * @brief Hand the data connection to sink line by line until the server closes it.
+ *
+ * CR is dropped and lines longer than FTP_LIST_LINE_MAX are truncated; sink is then given the full length,
+ * larger than that of the string. Stops early when sink returns false.
+ *
+ * @return false when nothing arrived for DataTimeout()
+ */
+bool M5_Ethernet_FtpClient::ReadDataLines(FtpLineCallback sink, void *context)
+{
+  char line[FTP_LIST_LINE_MAX];
+  size_t lineLength = 0;
+  size_t fullLength = 0; // Including the characters that did not fit
+  unsigned long _m = millis();
+  unsigned long _us = micros();
 
-  size_t clientCount = 0;
-  for (int i = 0; i < dataLength; i++)
+  while (true)
   {
-    clientBuf[clientCount] = data[i];
-    clientCount++;
+    int received = ReadData();
+    if (received == 0)
+    {
+      if (!dclient->isConnected())
+        break;
+      if (millis() - _m >= DataTimeout())
+        return false;
+      PollWait(_us);
+      continue;
+    }
+    _m = millis();
+    _us = micros();
 
-    if (clientCount > bufferSize - 1)
+    for (int i = 0; i < received; i++)
     {
-#if FTP_CLIENT_USING_QNETHERNET
-      cli->writeFully(clientBuf, bufferSize);
-#else
-      cli->write(clientBuf, bufferSize);
-#endif
-      FTP_LOGDEBUG3("Written: num bytes =", bufferSize, ", index =", i);
-      FTP_LOGDEBUG3("Written: clientBuf =", (uint32_t)clientBuf, ", clientCount =", clientCount);
-      clientCount = 0;
+      char c = dataRx[i];
+      if (c != '\n')
+      {
+        if (c == '\r')
+          continue;
+        if (lineLength < sizeof(line) - 1)
+          line[lineLength++] = c;
+        fullLength++;
+        continue;
+      }
+
+      line[lineLength] = 0;
+      size_t length = fullLength;
+      lineLength = 0;
+      fullLength = 0;
+      if (!sink(context, line, length))
+        return true;
     }
   }
 
-  if (clientCount > 0)
+  // Some servers leave out the line end after the last line
+  if (lineLength > 0)
   {
-    cli->write(clientBuf, clientCount);
-    FTP_LOGDEBUG1("Last Written: num bytes =", clientCount);
+    line[lineLength] = 0;
+    sink(context, line, fullLength);
   }
-  return FTP_RESCODE_ACTION_SUCCESS;
+  return true;
 }
 
-/////////////////////////////////////////////
-uint16_t M5_Ethernet_FtpClient::DownloadString(const char *filename, String &str)
+/**
+ * @brief Parse one MLSD line, "type=file;size=1234;modify=20240101120000; name".
+ *
+ * Unknown facts are skipped, missing ones are left at 0.
+ */
+bool M5_Ethernet_FtpClient::ParseListEntry(const char *line, FtpListEntry *entry)
 {
-  FTP_LOGINFO("Send RETR");
+  memset(entry, 0, sizeof(FtpListEntry));
 
-  if (!isConnected())
-    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  const char *name = strchr(line, ' ');
+  if (name == NULL)
+    return false;
 
-  client.print(FTP_COMMAND_DOWNLOAD);
-  client.println(filename);
+  size_t nameLength = strlen(name + 1);
+  if (nameLength >= sizeof(entry->name))
+  {
+    nameLength = sizeof(entry->name) - 1;
+    entry->isTruncated = true;
+  }
+  memcpy(entry->name, name + 1, nameLength);
+  entry->name[nameLength] = 0;
 
-  char _resp[sizeof(outBuf)];
-  uint16_t responseCode = GetCmdAnswer(_resp);
+  const char *fact = line;
+  while (fact < name)
+  {
+    const char *factEnd = (const char *)memchr(fact, ';', name - fact);
+    if (factEnd == NULL)
+      factEnd = name;
 
-  unsigned long _m = millis();
+    const char *value = (const char *)memchr(fact, '=', factEnd - fact);
+    if (value != NULL)
+    {
+      size_t keyLength = value - fact;
+      value++;
+      size_t valueLength = factEnd - value;
 
-  while (!GetDataClient()->available() && millis() < _m + timeout)
-    delay(1);
+      if (keyLength == 4 && strncasecmp(fact, "type", 4) == 0)
+      {
+        if (valueLength == 4 && strncasecmp(value, "file", 4) == 0)
+          entry->type = FTP_ENTRY_FILE;
+        else if (valueLength == 3 && strncasecmp(value, "dir", 3) == 0)
+          entry->type = FTP_ENTRY_DIR;
+        else if (valueLength == 4 && strncasecmp(value, "cdir", 4) == 0)
+          entry->type = FTP_ENTRY_CDIR;
+        else if (valueLength == 4 && strncasecmp(value, "pdir", 4) == 0)
+          entry->type = FTP_ENTRY_PDIR;
+      }
+      else if (keyLength == 4 && strncasecmp(fact, "size", 4) == 0)
+      {
+        entry->size = strtoull(value, NULL, 10);
+      }
+      else if (keyLength == 6 && strncasecmp(fact, "modify", 6) == 0)
+      {
+        entry->modify = ParseFtpTime(value, valueLength);
+      }
+    }
+
+    fact = factEnd + 1;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Convert an FTP time value "YYYYMMDDHHMMSS[.sss]" (UTC) to seconds since 1970, 0 when malformed.
+ */
+uint32_t M5_Ethernet_FtpClient::ParseFtpTime(const char *value, size_t length)
+{
+  if (length < 14)
+    return 0;
+
+  int field[6];
+  const uint8_t width[6] = {4, 2, 2, 2, 2, 2};
+  for (uint8_t i = 0; i < 6; i++)
+  {
+    field[i] = 0;
+    for (uint8_t j = 0; j < width[i]; j++)
+    {
+      if (!isdigit(*value))
+        return 0;
+      field[i] = field[i] * 10 + (*value++ - '0');
+    }
+  }
+
+  // Days from civil date, valid for the proleptic Gregorian calendar
+  int year = field[0] - (field[1] <= 2);
+  int era = year / 400;
+  int yearOfEra = year - era * 400;
+  int dayOfYear = (153 * (field[1] + (field[1] > 2 ? -3 : 9)) + 2) / 5 + field[2] - 1;
+  int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  long days = (long)era * 146097 + dayOfEra - 719468;
+
+  return (uint32_t)(days * 86400L + field[3] * 3600L + field[4] * 60L + field[5]);
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::GetLastModifiedTime(const char *fileName, char *result)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("GetLastModifiedTime: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send MDTM");
+  WriteCommand(FTP_COMMAND_FILE_LAST_MOD_TIME, fileName);
+  return GetCmdAnswer(result, 4);
+}
+
+/**
+ * @brief Ask the server for the modification time of a file (MDTM).
+ *
+ * @param modify receives seconds since 1970 (UTC), 0 when the reply could not be parsed
+ */
+uint16_t M5_Ethernet_FtpClient::GetLastModifiedTime(const char *fileName, uint32_t *modify)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("GetLastModifiedTime: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
 
-  while (GetDataClient()->available())
-    str += GetDataClient()->readString();
+  FTP_LOGINFO("Send MDTM");
+  WriteCommand(FTP_COMMAND_FILE_LAST_MOD_TIME, fileName);
+  uint16_t responseCode = GetCmdAnswer();
+  if (responseCode == FTP_RESCODE_FILE_STATUS)
+    *modify = ParseFtpTime(outBuf + 4, strcspn(outBuf + 4, "\r\n"));
 
   return responseCode;
 }
 
 /////////////////////////////////////////////
 
-uint16_t M5_Ethernet_FtpClient::DownloadFile(const char *filename, unsigned char *buf, size_t length, bool printUART)
+uint16_t M5_Ethernet_FtpClient::Write(const char *str)
 {
-  FTP_LOGINFO("Send RETR");
+  if (!isConnected())
+  {
+    FTP_LOGERROR("Write: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGDEBUG(F("Write File"));
+  return WriteClientBuffered(dclient, (const unsigned char *)str, strlen(str));
+}
 
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::CloseDataClient()
+{
   if (!isConnected())
   {
-    FTP_LOGERROR("DownloadFile: Not connected error");
+    FTP_LOGERROR("CloseFile: Not connected error");
     return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
   }
 
-  client.print(FTP_COMMAND_DOWNLOAD);
-  client.println(filename);
+  FTP_LOGDEBUG(F("Close File"));
 
-  char _resp[sizeof(outBuf)];
-  uint16_t responseCode = GetCmdAnswer(_resp);
+  if (isDeflating)
+  {
+    isDeflating = false;
+    bool isFinished = deflater.Finish(DeflateSink, this);
+    compressionStats = deflater.GetStats();
+    FTP_LOGINFO5("Deflate bytes in =", compressionStats.inputBytes, ", out =", compressionStats.outputBytes,
+                 ", cpu us =", compressionStats.cpuMicros);
 
-  char _buf[2];
+    if (!isFinished)
+    {
+      dclient->Stop();
+      GetCmdAnswer();
+      return FTP_RESCODE_DATA_CONNECTION_ERROR;
+    }
+  }
 
-  unsigned long _m = millis();
+  dclient->Stop();
 
-  while (!dclient.available() && millis() < _m + timeout)
-    delay(1);
+  return GetCmdAnswer();
+}
+
+/**
+ * @brief Compress uploads with MODE Z (deflate) on servers that list it in FEAT.
+ *
+ * Transfers fall back to stream mode when the server does not offer MODE Z or no compressor is built in.
+ * GetCompressionStats() reports the byte counts and CPU time of the last compressed upload.
+ */
+void M5_Ethernet_FtpClient::SetCompression(bool enable)
+{
+  compression = enable;
+}
 
-  while (dclient.available())
+/**
+ * @brief Ask FEAT once whether the server offers MODE Z.
+ */
+bool M5_Ethernet_FtpClient::isModeZSupported()
+{
+  if (modeZSupported < 0)
   {
-    if (!printUART)
-      dclient.readBytes(buf, length);
-    else
+    FTP_LOGINFO("Send FEAT");
+    WriteCommand(FTP_COMMAND_FEATURES);
+    uint16_t responseCode = GetCmdAnswer();
+    if (responseCode == FTP_RESCODE_CLIENT_ISNOT_CONNECTED || responseCode == FTP_RESCODE_SERVICE_NOT_AVAILABLE)
+      return false;
+
+    modeZSupported = !isErrorCode(responseCode) && strstr(outBuf, "MODE Z") != NULL ? 1 : 0;
+    FTP_LOGINFO1("MODE Z offered: ", modeZSupported);
+  }
+
+  return modeZSupported == 1;
+}
+
+/**
+ * @brief Close the data connection after a download or listing and read the transfer completion reply.
+ *
+ * responseCode is the reply to RETR/LIST/MLSD; only a 1xx reply is followed by a completion reply.
+ * isStopped tells that the caller ended the transfer early. The server then reports the aborted transfer,
+ * usually with 426, which is the same value as FTP_RESCODE_CLIENT_ISNOT_CONNECTED; that reply is consumed
+ * and responseCode returned, as long as the command connection is still up.
+ */
+uint16_t M5_Ethernet_FtpClient::CloseTransfer(uint16_t responseCode, bool isStopped)
+{
+  dclient->Stop();
+  if (responseCode < 100 || responseCode >= 200)
+    return responseCode;
+
+  uint16_t closeCode = GetCmdAnswer();
+  if (isStopped && isConnected())
+    return responseCode;
+  return isErrorCode(closeCode) ? closeCode : responseCode;
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::RenameFile(const char *from, const char *to)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("RenameFile: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send RNFR/RNTO");
+  if (BatchCommand(FTP_COMMAND_RENAME_FILE_FROM, from, strlen(from)))
+    BatchCommand(FTP_COMMAND_RENAME_FILE_TO, to, strlen(to));
+
+  uint16_t responseCodes[2];
+  uint16_t responseCode = SendBatch(responseCodes, 2);
+  if (responseCode == FTP_RESCODE_CLIENT_ISNOT_CONNECTED || responseCode == FTP_RESCODE_COMMAND_TOO_LONG)
+    return responseCode;
+
+  // RNTO is refused with 503 when RNFR failed, report the RNFR error instead
+  return isErrorCode(responseCodes[0]) ? responseCodes[0] : responseCodes[1];
+}
+
+uint16_t M5_Ethernet_FtpClient::RenameFile(const String &from, const String &to)
+{
+  return RenameFile(from.c_str(), to.c_str());
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::NewFile(const char *fileName)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("NewFile: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send STOR");
+  WriteCommand(FTP_COMMAND_FILE_UPLOAD, fileName);
+  return GetCmdAnswer();
+}
+
+uint16_t M5_Ethernet_FtpClient::NewFile(const String &fileName)
+{
+  return NewFile(fileName.c_str());
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::ChangeWorkDir(const char *dir)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("ChangeWorkDir: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send CWD");
+  WriteCommand(FTP_COMMAND_CURRENT_WORKING_DIR, dir);
+  return GetCmdAnswer();
+}
+
+uint16_t M5_Ethernet_FtpClient::ChangeWorkDir(const String &dir)
+{
+  return ChangeWorkDir(dir.c_str());
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::MakeDir(const char *dir)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("MakeDir: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send MKD");
+  WriteCommand(FTP_COMMAND_MAKE_DIR, dir);
+  return GetCmdAnswer();
+}
+
+uint16_t M5_Ethernet_FtpClient::MakeDir(const String &dir)
+{
+  return MakeDir(dir.c_str());
+}
+
+uint16_t M5_Ethernet_FtpClient::MakeDirRecursive(const char *dir)
+{
+  return MakeDirRecursive(dir, strlen(dir));
+}
+
+uint16_t M5_Ethernet_FtpClient::MakeDirRecursive(const String &dir)
+{
+  return MakeDirRecursive(dir.c_str(), dir.length());
+}
+
+uint16_t M5_Ethernet_FtpClient::MakeDirRecursive(const char *dir, size_t length)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("MakeDirRecursive: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  if (IsDirCached(dir, length))
+    return FTP_RESCODE_ACTION_SUCCESS;
+
+  FTP_LOGINFO("Send MKD Recursive");
+
+  // Normalize to "/a/b/c" so every prefix ending before a '/' is a parent directory
+  char path[FTP_PATH_MAX];
+  size_t pathLength = 0;
+  for (const char *c = dir; c < dir + length && *c != 0; c++)
+  {
+    if (*c == '/' && pathLength > 0 && path[pathLength - 1] == '/')
+      continue;
+    if (pathLength + (pathLength == 0 && *c != '/' ? 2 : 1) > sizeof(path) - 1)
     {
-      for (size_t _b = 0; _b < length; _b++)
-      {
-        dclient.readBytes(_buf, 1);
-        // FTP_LOGDEBUG0(_buf[0]);
-      }
+      // A shortened path would create, and cache, a different directory
+      FTP_LOGERROR1(F("MakeDirRecursive: Path longer than FTP_PATH_MAX, length ="), length);
+      return FTP_RESCODE_COMMAND_TOO_LONG;
     }
+    if (pathLength == 0 && *c != '/')
+      path[pathLength++] = '/';
+    path[pathLength++] = *c;
   }
+  if (pathLength > 1 && path[pathLength - 1] == '/')
+    pathLength--;
+  path[pathLength] = 0;
 
-  return responseCode;
+  // One MKD per missing component, sent back-to-back
+  for (size_t i = 1; i <= pathLength; i++)
+  {
+    if ((i == pathLength || path[i] == '/') && !IsDirCached(path, i))
+      BatchCommand(FTP_COMMAND_MAKE_DIR, path, i);
+  }
+
+  uint16_t responseCodes[FTP_BATCH_MAX];
+  uint8_t count = batchCount;
+  uint16_t res = SendBatch(responseCodes, FTP_BATCH_MAX);
+  if (res == FTP_RESCODE_CLIENT_ISNOT_CONNECTED)
+    return res;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (isErrorCode(responseCodes[i]) && responseCodes[i] != FTP_RESCODE_FILE_UNAVAILABLE)
+    { // Ignore "Directory already exists" error
+      return responseCodes[i];
+    }
+  }
+
+  CacheDir(path, pathLength);
+  return FTP_RESCODE_ACTION_SUCCESS;
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::RemoveDir(const char *dir)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("RemoveDir: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send RMD");
+  WriteCommand(FTP_COMMAND_REMOVE_DIR, dir);
+  return GetCmdAnswer();
+}
+
+uint16_t M5_Ethernet_FtpClient::RemoveDir(const String &dir)
+{
+  return RemoveDir(dir.c_str());
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Let AppendTextLine() and SubmitAppend() create missing directories themselves.
+ *
+ * APPE is sent first and the parent directories are only created when the server refuses it,
+ * so callers no longer need MakeDirRecursive() before every append.
+ */
+void M5_Ethernet_FtpClient::SetLazyMakeDir(bool enable)
+{
+  lazyMakeDir = enable;
+}
+
+void M5_Ethernet_FtpClient::ClearDirCache()
+{
+  for (uint8_t i = 0; i < FTP_DIR_CACHE_SIZE; i++)
+    dirCache[i][0] = 0;
+  dirCacheNext = 0;
+}
+
+/**
+ * @brief A directory is known to exist when it, or one of its subdirectories, is in the cache.
+ */
+bool M5_Ethernet_FtpClient::IsDirCached(const char *dir, size_t length)
+{
+  while (length > 1 && dir[length - 1] == '/')
+    length--;
+
+  for (uint8_t i = 0; i < FTP_DIR_CACHE_SIZE; i++)
+  {
+    const char *cached = dirCache[i];
+    if (cached[0] != 0 && strncmp(cached, dir, length) == 0 && (cached[length] == 0 || cached[length] == '/'))
+      return true;
+  }
+  return false;
+}
+
+void M5_Ethernet_FtpClient::CacheDir(const char *dir, size_t length)
+{
+  while (length > 1 && dir[length - 1] == '/')
+    length--;
+
+  if (length == 0 || length >= FTP_PATH_MAX || IsDirCached(dir, length))
+    return;
+
+  memcpy(dirCache[dirCacheNext], dir, length);
+  dirCache[dirCacheNext][length] = 0;
+  dirCacheNext = (dirCacheNext + 1) % FTP_DIR_CACHE_SIZE;
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::AppendFile(const char *fileName)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("AppendFile: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send APPE");
+  WriteCommand(FTP_COMMAND_APPEND_FILE, fileName);
+
+  return GetCmdAnswer();
+}
+
+uint16_t M5_Ethernet_FtpClient::AppendFile(const String &fileName)
+{
+  return AppendFile(fileName.c_str());
 }
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::AppendTextLine(const char *filePath, const char *textLine, size_t lineLength)
+{
+  uint16_t responseCode = BeginAppend(filePath, 'A');
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  responseCode = WriteData((const unsigned char *)textLine, lineLength);
+  if (!isErrorCode(responseCode))
+    responseCode = WriteData((const unsigned char *)"\r\n", 2);
+
+  if (isErrorCode(responseCode))
+  {
+    dclient->Stop();
+    return responseCode;
+  }
+
+  return CloseDataClient();
+}
+
+uint16_t M5_Ethernet_FtpClient::AppendTextLine(const char *filePath, const char *textLine)
+{
+  return AppendTextLine(filePath, textLine, strlen(textLine));
+}
+
+uint16_t M5_Ethernet_FtpClient::AppendTextLine(const String &filePath, const String &textLine)
+{
+  return AppendTextLine(filePath.c_str(), textLine.c_str(), textLine.length());
+}
+
+/**
+ * @brief Append a block of data to a remote file in a single APPE transfer.
+ */
+uint16_t M5_Ethernet_FtpClient::AppendData(const char *filePath, const unsigned char *data, int dataLength, bool binary)
+{
+  uint16_t responseCode = BeginAppend(filePath, binary ? 'I' : 'A');
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  responseCode = WriteData(data, dataLength);
+  if (isErrorCode(responseCode))
+  {
+    dclient->Stop();
+    return responseCode;
+  }
+
+  return CloseDataClient();
+}
+
+/**
+ * @brief Open the data connection in the given TYPE ('A' or 'I') and send APPE for filePath.
+ *
+ * In lazy mode the parent directories are created when the server refuses APPE, then APPE is tried once more.
+ * On success the data connection is left open for the caller to write to.
+ */
+uint16_t M5_Ethernet_FtpClient::BeginAppend(const char *filePath, char type)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("BeginAppend: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  uint16_t responseCode = InitPassiveMode(type, compression);
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  responseCode = AppendFile(filePath);
+
+  const char *lastSlash = strrchr(filePath, '/');
+  size_t dirLength = lastSlash != NULL ? lastSlash - filePath : 0;
+  if (lazyMakeDir && dirLength > 0 &&
+      (responseCode == FTP_RESCODE_FILE_UNAVAILABLE || responseCode == FTP_RESCODE_FILE_NAME_NOT_ALLOWED))
+  {
+    FTP_LOGINFO("APPE refused, creating directories");
+    dclient->Stop();
+    ClearDirCache(); // The cached entries did not match the server any more
+
+    responseCode = MakeDirRecursive(filePath, dirLength);
+    if (isErrorCode(responseCode))
+      return responseCode;
+
+    responseCode = InitPassiveMode(type, compression);
+    if (isErrorCode(responseCode))
+      return responseCode;
+
+    responseCode = AppendFile(filePath);
+  }
+
+  if (isErrorCode(responseCode))
+  {
+    dclient->Stop();
+    return responseCode;
+  }
+
+  if (dirLength > 0)
+    CacheDir(filePath, dirLength);
+
+  return responseCode;
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Buffer a text line for a remote file instead of sending it right away.
+ *
+ * Lines for the same file are collected in RAM and sent with one APPE transfer by FlushAppendBuffers().
+ * A slot is only flushed here when the new line does not fit into it any more.
+ */
+uint16_t M5_Ethernet_FtpClient::QueueTextLine(const char *filePath, const char *textLine, size_t lineLength)
+{
+  if (lineLength + 2 > appendMaxBytes || strlen(filePath) >= FTP_PATH_MAX)
+    return AppendTextLine(filePath, textLine, lineLength);
+
+  FtpAppendSlot *slot = GetAppendSlot(filePath);
+  if (slot == NULL)
+  {
+    FTP_LOGERROR("QueueTextLine: No free append slot");
+    return FTP_RESCODE_DATA_CONNECTION_ERROR;
+  }
+
+  if (slot->length + lineLength + 2 > appendMaxBytes)
+  {
+    uint16_t responseCode = FlushAppendSlot(slot);
+    if (isErrorCode(responseCode))
+      return responseCode;
+  }
+
+  StartAppendSlot(slot, filePath);
+  slot->recordOpen = false; // Binary records after this line start a new block
+
+  memcpy(slot->data + slot->length, textLine, lineLength);
+  slot->length += lineLength;
+  slot->data[slot->length++] = '\r';
+  slot->data[slot->length++] = '\n';
+  slot->lines++;
+
+  return FTP_RESCODE_ACTION_SUCCESS;
+}
+
+uint16_t M5_Ethernet_FtpClient::QueueTextLine(const char *filePath, const char *textLine)
+{
+  return QueueTextLine(filePath, textLine, strlen(textLine));
+}
+
+uint16_t M5_Ethernet_FtpClient::QueueTextLine(const String &filePath, const String &textLine)
+{
+  return QueueTextLine(filePath.c_str(), textLine.c_str(), textLine.length());
+}
+
+/**
+ * @brief Append one binary record (see M5_Ethernet_FtpRecordFormat.hpp) as a block of its own.
+ *
+ * @param timestampMs milliseconds since 1970
+ * @param values one float per channel, 1 .. FTP_BIN_MAX_CHANNELS channels
+ */
+uint16_t M5_Ethernet_FtpClient::AppendRecord(const char *filePath, uint64_t timestampMs, const float *values, uint8_t channels)
+{
+  if (channels == 0 || channels > FTP_BIN_MAX_CHANNELS)
+    return FTP_RESCODE_SYNTAX_ERROR;
+
+  uint8_t block[FTP_BIN_HEADER_SIZE(FTP_BIN_MAX_CHANNELS)];
+  uint32_t bits[FTP_BIN_MAX_CHANNELS];
+  size_t length = FtpBinWriteHeader(block, timestampMs, values, channels, bits);
+
+  return AppendData(filePath, block, length, true);
+}
+
+/**
+ * @brief Buffer a binary record like QueueTextLine() buffers a line.
+ *
+ * Records buffered for the same file form one block: the first one goes into the sync header with
+ * absolute values, the following ones are stored as timestamp and value deltas and counted in the header.
+ */
+uint16_t M5_Ethernet_FtpClient::QueueRecord(const char *filePath, uint64_t timestampMs, const float *values, uint8_t channels)
+{
+  if (channels == 0 || channels > FTP_BIN_MAX_CHANNELS)
+    return FTP_RESCODE_SYNTAX_ERROR;
+
+  if ((size_t)FTP_BIN_HEADER_SIZE(channels) > appendMaxBytes || strlen(filePath) >= FTP_PATH_MAX)
+    return AppendRecord(filePath, timestampMs, values, channels);
+
+  FtpAppendSlot *slot = GetAppendSlot(filePath);
+  if (slot == NULL)
+  {
+    FTP_LOGERROR("QueueRecord: No free append slot");
+    return FTP_RESCODE_DATA_CONNECTION_ERROR;
+  }
+
+  bool isNewBlock = !slot->recordOpen || slot->recordChannels != channels ||
+                    FtpBinGetLE(slot->data + slot->recordHeader + 6, 2) == 0xFFFF;
+  size_t needed = isNewBlock ? FTP_BIN_HEADER_SIZE(channels) : FTP_BIN_RECORD_MAX(channels);
+
+  if (slot->length + needed > appendMaxBytes)
+  {
+    uint16_t responseCode = FlushAppendSlot(slot);
+    if (isErrorCode(responseCode))
+      return responseCode;
+
+    isNewBlock = true;
+    needed = FTP_BIN_HEADER_SIZE(channels);
+  }
+
+  StartAppendSlot(slot, filePath);
+  slot->hasRecords = true;
+
+  if (isNewBlock)
+  {
+    slot->recordOpen = true;
+    slot->recordHeader = slot->length;
+    slot->recordChannels = channels;
+    slot->length += FtpBinWriteHeader(slot->data + slot->length, timestampMs, values, channels, slot->recordBits);
+  }
+  else
+  {
+    uint8_t *header = slot->data + slot->recordHeader;
+    slot->length += FtpBinWriteDelta(slot->data + slot->length, (int64_t)(timestampMs - slot->recordTime), values, channels, slot->recordBits);
+    FtpBinPutLE(header + 6, FtpBinGetLE(header + 6, 2) + 1, 2);
+  }
+
+  slot->recordTime = timestampMs;
+  slot->lines++;
+
+  return FTP_RESCODE_ACTION_SUCCESS;
+}
+
+/**
+ * @brief Send buffered lines to the server.
+ *
+ * With force == false only slots that reached the line count, byte size or age threshold are sent.
+ * Slots that fail keep their data and are tried again on the next call.
+ */
+uint16_t M5_Ethernet_FtpClient::FlushAppendBuffers(bool force)
+{
+  uint16_t result = FTP_RESCODE_ACTION_SUCCESS;
+
+  for (uint8_t i = 0; i < FTP_APPEND_SLOTS; i++)
+  {
+    FtpAppendSlot *slot = &appendSlots[i];
+    if (slot->length == 0)
+      continue;
+
+    bool due = force || slot->lines >= appendMaxLines || slot->length >= appendMaxBytes ||
+               millis() - slot->firstMillis >= appendMaxAge;
+    if (!due)
+      continue;
+
+    uint16_t responseCode = FlushAppendSlot(slot);
+    if (isErrorCode(responseCode))
+      result = responseCode;
+  }
+
+  return result;
+}
+
+void M5_Ethernet_FtpClient::SetAppendThresholds(uint16_t maxLines, size_t maxBytes, unsigned long maxAgeMs)
+{
+  appendMaxLines = maxLines;
+  appendMaxBytes = maxBytes < FTP_APPEND_BUFFER_SIZE ? maxBytes : FTP_APPEND_BUFFER_SIZE;
+  appendMaxAge = maxAgeMs;
+}
+
+size_t M5_Ethernet_FtpClient::GetBufferedBytes()
+{
+  size_t total = 0;
+  for (uint8_t i = 0; i < FTP_APPEND_SLOTS; i++)
+    total += appendSlots[i].length;
+  return total;
+}
+
+/**
+ * @brief Take an empty slot over for filePath before the first line or record goes into it.
+ */
+void M5_Ethernet_FtpClient::StartAppendSlot(FtpAppendSlot *slot, const char *filePath)
+{
+  if (slot->length > 0)
+    return;
+
+  if (strcmp(slot->path, filePath) != 0)
+  {
+    strcpy(slot->path, filePath);
+    slot->remoteSizeKnown = false;
+    slot->needsReconcile = false;
+  }
+  slot->firstMillis = millis();
+  slot->recordOpen = false;
+  slot->hasRecords = false;
+}
+
+/**
+ * @brief Find the slot buffering filePath, or free one up for it.
+ *
+ * When every slot holds another file the oldest one is flushed first; NULL is returned if that fails.
+ */
+FtpAppendSlot *M5_Ethernet_FtpClient::GetAppendSlot(const char *filePath)
+{
+  FtpAppendSlot *freeSlot = NULL;
+  FtpAppendSlot *oldestSlot = NULL;
+
+  for (uint8_t i = 0; i < FTP_APPEND_SLOTS; i++)
+  {
+    FtpAppendSlot *slot = &appendSlots[i];
+
+    // An empty slot that last held this file still knows its remote size
+    if (strcmp(slot->path, filePath) == 0)
+      return slot;
+
+    if (slot->length == 0)
+    {
+      if (freeSlot == NULL)
+        freeSlot = slot;
+      continue;
+    }
+
+    if (oldestSlot == NULL || (long)(slot->firstMillis - oldestSlot->firstMillis) < 0)
+      oldestSlot = slot;
+  }
+
+  if (freeSlot != NULL)
+    return freeSlot;
+
+  if (isErrorCode(FlushAppendSlot(oldestSlot)))
+    return NULL;
+
+  return oldestSlot;
+}
+
+/**
+ * @brief Append a slot's data to its file exactly once.
+ *
+ * The remote size is read with SIZE the first time a file is written and tracked from then on.
+ * After a failed transfer the next flush asks for SIZE again and only sends the bytes the server does not have yet.
+ * Slots are sent in binary mode so the remote size grows by exactly the bytes sent.
+ */
+uint16_t M5_Ethernet_FtpClient::FlushAppendSlot(FtpAppendSlot *slot)
+{
+  uint16_t responseCode;
+
+  if (sizeSupported && (!slot->remoteSizeKnown || slot->needsReconcile))
+  {
+    uint32_t serverSize = 0;
+    responseCode = GetFileSize(slot->path, &serverSize);
+
+    if (responseCode == FTP_RESCODE_FILE_UNAVAILABLE)
+    {
+      serverSize = 0; // Not created yet
+    }
+    else if (responseCode == FTP_RESCODE_SYNTAX_ERROR || responseCode == FTP_RESCODE_NOT_IMPLEMENTED)
+    {
+      FTP_LOGWARN("SIZE not supported, appends may repeat after errors");
+      sizeSupported = false;
+    }
+    else if (isErrorCode(responseCode))
+    {
+      return responseCode;
+    }
+
+    if (sizeSupported)
+    {
+      if (slot->needsReconcile && slot->remoteSizeKnown && serverSize > slot->remoteSize)
+      {
+        size_t landed = serverSize - slot->remoteSize;
+        if (landed > slot->length)
+          landed = slot->length;
+
+        FTP_LOGINFO3("Reconcile:", slot->path, ", bytes already on server =", landed);
+        memmove(slot->data, slot->data + landed, slot->length - landed);
+        slot->length -= landed;
+
+        // Record bytes may be 0x0A, with binary blocks in the slot the old count stays as an upper bound
+        if (!slot->hasRecords)
+        {
+          slot->lines = 0;
+          for (size_t i = 0; i < slot->length; i++)
+          {
+            if (slot->data[i] == '\n')
+              slot->lines++;
+          }
+        }
+      }
+
+      slot->remoteSize = serverSize;
+      slot->remoteSizeKnown = true;
+      slot->needsReconcile = false;
+    }
+
+    if (slot->length == 0)
+      return FTP_RESCODE_ACTION_SUCCESS;
+  }
+
+  FTP_LOGINFO2("Flush append buffer:", slot->path, slot->lines);
+
+  responseCode = AppendData(slot->path, slot->data, slot->length, true);
+  if (isErrorCode(responseCode))
+  {
+    // Part of the data may have reached the server, find out how much before sending again.
+    // The header of an open binary block may be among it, so later records start a new block.
+    slot->needsReconcile = true;
+    slot->recordOpen = false;
+    return responseCode;
+  }
+
+  slot->remoteSize += slot->length;
+  slot->length = 0;
+  slot->lines = 0;
+  slot->recordOpen = false;
+  return responseCode;
+}
+
+/**
+ * @brief Ask the server for the size of a file in bytes (SIZE, sent in binary mode).
+ */
+uint16_t M5_Ethernet_FtpClient::GetFileSize(const char *fileName, uint32_t *size)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("GetFileSize: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  // Servers refuse or convert SIZE in ASCII mode
+  uint16_t responseCode = SetTransferType('I');
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  FTP_LOGINFO("Send SIZE");
+  WriteCommand(FTP_COMMAND_FILE_SIZE, fileName);
+  responseCode = GetCmdAnswer();
+  if (responseCode == FTP_RESCODE_FILE_STATUS)
+    *size = strtoul(outBuf + 4, NULL, 10);
+
+  return responseCode;
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::DeleteFile(const char *file)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("DeleteFile: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FTP_LOGINFO("Send DELE");
+  WriteCommand(FTP_COMMAND_DELETE_FILE, file);
+
+  return GetCmdAnswer();
+}
+
+uint16_t M5_Ethernet_FtpClient::DeleteFile(const String &file)
+{
+  return DeleteFile(file.c_str());
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::WriteData(const unsigned char *data, int dataLength)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("WriteData: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+  FTP_LOGDEBUG1("WriteData: datalen =", dataLength);
+  return WriteTransferData(&data[0], dataLength);
+}
+
+uint16_t M5_Ethernet_FtpClient::WriteData(const String &data)
+{
+  return WriteData((unsigned char *)data.c_str(), data.length());
+}
+
+/**
+ * @brief Write upload data to the data connection, through the compressor in MODE Z.
+ */
+uint16_t M5_Ethernet_FtpClient::WriteTransferData(const unsigned char *data, int dataLength)
+{
+  if (!isDeflating)
+    return WriteClientBuffered(dclient, data, dataLength);
+
+  if (!deflater.Write(data, dataLength, DeflateSink, this))
+  {
+    FTP_LOGERROR("WriteTransferData: Deflate error");
+    return FTP_RESCODE_DATA_CONNECTION_ERROR;
+  }
+  return FTP_RESCODE_ACTION_SUCCESS;
+}
+
+bool M5_Ethernet_FtpClient::DeflateSink(void *context, const uint8_t *data, size_t length)
+{
+  M5_Ethernet_FtpClient *ftp = (M5_Ethernet_FtpClient *)context;
+  return !ftp->isErrorCode(ftp->WriteClientBuffered(ftp->dclient, data, length));
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Write data to a client straight from the caller's buffer, as much at a time as its TX buffer has room for.
+ *
+ * write() on the W5500 spins on the SPI bus until the whole chunk fits, so a full TX buffer is waited out
+ * here with PollWait() instead, which lets other tasks run. Fails when nothing could be sent for DataTimeout().
+ */
+uint16_t M5_Ethernet_FtpClient::WriteClientBuffered(FtpTransport *cli, const unsigned char *data, int dataLength)
+{
+  if (!isConnected())
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+
+  int index = 0;
+  unsigned long _m = millis();
+  unsigned long _us = micros();
+
+  while (index < dataLength)
+  {
+    size_t written = 0;
+    int space = cli->AvailableForWrite();
+    if (space > 0)
+    {
+      size_t chunk = dataLength - index;
+      if (chunk > (size_t)space)
+        chunk = space;
+      written = cli->Write(data + index, chunk);
+      FTP_LOGDEBUG3("Written: num bytes =", written, ", index =", index);
+    }
+
+    if (written == 0)
+    {
+      if (!cli->isConnected() || millis() - _m >= DataTimeout())
+      {
+        FTP_LOGERROR("WriteClientBuffered: Data connection write error");
+        return FTP_RESCODE_DATA_CONNECTION_ERROR;
+      }
+      metrics.sendWaits++;
+      PollWait(_us);
+      continue;
+    }
+
+    index += written;
+    metrics.bytesSent += written;
+    _m = millis();
+    _us = micros();
+  }
+
+  return FTP_RESCODE_ACTION_SUCCESS;
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Open a binary data connection and send STOR (or APPE with append).
+ *
+ * On success the caller writes the file with WriteData() and finishes it with CloseDataClient().
+ */
+uint16_t M5_Ethernet_FtpClient::BeginUpload(const char *fileName, bool append)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("BeginUpload: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  uint16_t responseCode = InitPassiveMode('I', compression);
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  FTP_LOGINFO(append ? "Send APPE" : "Send STOR");
+  WriteCommand(append ? FTP_COMMAND_APPEND_FILE : FTP_COMMAND_FILE_UPLOAD, fileName);
+  responseCode = GetCmdAnswer();
+  if (isErrorCode(responseCode))
+    dclient->Stop();
+
+  return responseCode;
+}
+
+/**
+ * @brief Free space in the data socket's transmit buffer, 0 while the TX window is full.
+ */
+int M5_Ethernet_FtpClient::GetDataWriteSpace()
+{
+  return dclient->AvailableForWrite();
+}
+
+bool M5_Ethernet_FtpClient::isDataConnected()
+{
+  return dclient->isConnected();
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Upload a stream of data in binary mode (TYPE I).
+ *
+ * reader is called until it returns 0 and each span it hands out is written to the data connection as is,
+ * so the data is never copied into a staging buffer. A negative return value from reader aborts the upload.
+ *
+ * @param append send APPE instead of STOR
+ * @param stats receives the byte count, elapsed time and achieved throughput, may be NULL
+ */
+uint16_t M5_Ethernet_FtpClient::UploadStream(const char *fileName, FtpReadCallback reader, void *context,
+                                             FtpTransferStats *stats, bool append)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("UploadStream: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  uint16_t responseCode = BeginUpload(fileName, append);
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  unsigned long startMillis = millis();
+  uint32_t totalBytes = 0;
+
+  while (true)
+  {
+    const uint8_t *span = NULL;
+    int spanLength = reader(context, &span);
+    if (spanLength == 0)
+      break;
+
+    if (spanLength < 0)
+    {
+      FTP_LOGERROR("UploadStream: Reader error");
+      responseCode = FTP_RESCODE_DATA_CONNECTION_ERROR;
+      break;
+    }
+
+    responseCode = WriteTransferData(span, spanLength);
+    if (isErrorCode(responseCode))
+      break;
+
+    totalBytes += spanLength;
+  }
+
+  if (isErrorCode(responseCode))
+  {
+    // Closing without reading the reply would leave it for the next command
+    dclient->Stop();
+    GetCmdAnswer();
+    return responseCode;
+  }
+
+  responseCode = CloseDataClient();
+
+  if (stats != NULL)
+  {
+    stats->bytes = totalBytes;
+    stats->elapsedMs = millis() - startMillis;
+    stats->bytesPerSecond = stats->elapsedMs > 0 ? (uint32_t)((uint64_t)totalBytes * 1000 / stats->elapsedMs) : totalBytes;
+    FTP_LOGINFO3("Upload bytes =", stats->bytes, ", bytes/sec =", stats->bytesPerSecond);
+  }
+
+  return responseCode;
+}
+
+/////////////////////////////////////////////
+uint16_t M5_Ethernet_FtpClient::DownloadString(const char *filename, String &str)
+{
+  FTP_LOGINFO("Send RETR");
+
+  if (!isConnected())
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+
+  WriteCommand(FTP_COMMAND_DOWNLOAD, filename);
+
+  char _resp[sizeof(outBuf)];
+  uint16_t responseCode = GetCmdAnswer(_resp);
+
+  if (isErrorCode(responseCode))
+    return CloseTransfer(responseCode);
+
+  unsigned long _m = millis();
+  unsigned long _us = micros();
+
+  while (true)
+  {
+    int received = ReadData();
+    if (received == 0)
+    {
+      if (!dclient->isConnected() || millis() - _m >= DataTimeout())
+        break;
+      PollWait(_us);
+      continue;
+    }
+    _m = millis();
+    _us = micros();
+
+    str.reserve(str.length() + received);
+    for (int i = 0; i < received; i++)
+      str += (char)dataRx[i];
+  }
+
+  return CloseTransfer(responseCode);
+}
+
+/////////////////////////////////////////////
+
+uint16_t M5_Ethernet_FtpClient::DownloadFile(const char *filename, unsigned char *buf, size_t length, bool printUART)
+{
+  FTP_LOGINFO("Send RETR");
+
+  if (!isConnected())
+  {
+    FTP_LOGERROR("DownloadFile: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  WriteCommand(FTP_COMMAND_DOWNLOAD, filename);
+
+  char _resp[sizeof(outBuf)];
+  uint16_t responseCode = GetCmdAnswer(_resp);
+
+  if (isErrorCode(responseCode))
+    return CloseTransfer(responseCode);
+
+  // Up to length bytes go to buf; with printUART they are read and discarded
+  size_t filled = 0;
+  unsigned long _m = millis();
+  unsigned long _us = micros();
+
+  while (filled < length)
+  {
+    int received = printUART ? ReadData() : dclient->Read(buf + filled, length - filled);
+    if (received <= 0)
+    {
+      if (!dclient->isConnected() || millis() - _m >= DataTimeout())
+        break;
+      PollWait(_us);
+      continue;
+    }
+    _m = millis();
+    _us = micros();
+
+    if (printUART)
+    {
+      if ((size_t)received > length - filled)
+        received = length - filled;
+    }
+    else
+      metrics.bytesReceived += received;
+    filled += received;
+  }
+
+  return CloseTransfer(responseCode);
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Download a file in binary mode and hand it to sink chunk by chunk.
+ *
+ * When *offset is not 0 the transfer starts there (REST). *offset is advanced by every byte given to sink,
+ * so after an interrupted transfer the same call continues where it stopped.
+ *
+ * @param offset start position in, next position out; may be NULL to always start at 0
+ * @param stats receives the bytes and throughput of this call, may be NULL
+ * @return the reply to RETR (150 or 125) when the file arrived completely, otherwise the error
+ */
+uint16_t M5_Ethernet_FtpClient::DownloadStream(const char *fileName, FtpWriteCallback sink, void *context,
+                                               uint32_t *offset, FtpTransferStats *stats)
+{
+  if (!isConnected())
+  {
+    FTP_LOGERROR("DownloadStream: Not connected error");
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  uint16_t responseCode = InitBinaryPassiveMode();
+  if (isErrorCode(responseCode))
+    return responseCode;
+
+  if (offset != NULL && *offset > 0)
+  {
+    char restart[12];
+    snprintf(restart, sizeof(restart), "%lu", (unsigned long)*offset);
+
+    FTP_LOGINFO1("Send REST", restart);
+    WriteCommand(FTP_COMMAND_RESTART, restart);
+    responseCode = GetCmdAnswer();
+    if (responseCode != FTP_RESCODE_PENDING_FURTHER_INFO)
+    {
+      dclient->Stop();
+      return isErrorCode(responseCode) ? responseCode : FTP_RESCODE_SYNTAX_ERROR;
+    }
+  }
+
+  FTP_LOGINFO("Send RETR");
+  WriteCommand(FTP_COMMAND_DOWNLOAD, fileName);
+  responseCode = GetCmdAnswer();
+  if (isErrorCode(responseCode))
+  {
+    dclient->Stop();
+    return responseCode;
+  }
+
+  uint32_t totalBytes = 0;
+  unsigned long startMillis = millis();
+  unsigned long _m = startMillis;
+  unsigned long _us = micros();
+
+  while (true)
+  {
+    int received = ReadData();
+    if (received == 0)
+    {
+      if (!dclient->isConnected())
+        break;
+      if (millis() - _m >= DataTimeout())
+      {
+        FTP_LOGERROR("DownloadStream: Data connection timeout");
+        CloseTransfer(responseCode);
+        return FTP_RESCODE_DATA_CONNECTION_ERROR;
+      }
+      PollWait(_us);
+      continue;
+    }
+    _m = millis();
+    _us = micros();
+
+    if (!sink(context, dataRx, received))
+    {
+      FTP_LOGERROR("DownloadStream: Sink error");
+      CloseTransfer(responseCode);
+      return FTP_RESCODE_LOCAL_WRITE_ERROR;
+    }
+
+    totalBytes += received;
+    if (offset != NULL)
+      *offset += received;
+  }
+
+  if (stats != NULL)
+  {
+    stats->bytes = totalBytes;
+    stats->elapsedMs = millis() - startMillis;
+    stats->bytesPerSecond = stats->elapsedMs > 0 ? (uint32_t)((uint64_t)totalBytes * 1000 / stats->elapsedMs) : totalBytes;
+    FTP_LOGINFO3("Download bytes =", stats->bytes, ", bytes/sec =", stats->bytesPerSecond);
+  }
+
+  // The 150/125 opening reply once the completion reply confirmed the file, 426/451 when the server aborted it
+  return CloseTransfer(responseCode);
+}
+
+/**
+ * @brief DownloadStream() with reconnects: a transfer that breaks off is resumed from *offset.
+ *
+ * Transient (4xx) failures are retried up to attempts times, permanent (5xx) and local ones are returned at once.
+ * Attempts are spaced like the reconnects of EnsureSession(), and never before its own backoff has run out.
+ */
+uint16_t M5_Ethernet_FtpClient::DownloadResume(const char *fileName, FtpWriteCallback sink, void *context,
+                                               uint32_t *offset, uint8_t attempts, FtpTransferStats *stats)
+{
+  uint16_t responseCode = FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+
+  for (uint8_t attempt = 0; attempt < attempts; attempt++)
+  {
+    if (attempt > 0)
+    {
+      unsigned long waitMs = ReconnectBackoff(attempt < 16 ? attempt : 16);
+      if (reconnectFailures > 0 && (long)(reconnectMillis - millis()) > (long)waitMs)
+        waitMs = reconnectMillis - millis();
+      FTP_LOGWARN1(F("Download retry in ms: "), waitMs);
+      delay(waitMs);
+    }
+
+    responseCode = EnsureSession();
+    if (isErrorCode(responseCode))
+      continue;
+
+    responseCode = DownloadStream(fileName, sink, context, offset, stats);
+    if (!isErrorCode(responseCode) || responseCode >= 500)
+      return responseCode;
+
+    FTP_LOGWARN1("Download interrupted, resume at", offset != NULL ? *offset : 0);
+  }
+
+  return responseCode;
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Start an APPE of data in asynchronous mode; the call returns at once and poll() does the work.
+ *
+ * data must stay valid until the operation has finished. While isBusy() the blocking calls of this
+ * client must not be used, they would take the replies poll() is waiting for. SetLazyMakeDir() applies as well.
+ * @return false when another operation is still running
+ */
+bool M5_Ethernet_FtpClient::SubmitAppend(const char *filePath, const uint8_t *data, size_t length, FtpAsyncCallback callback, void *context)
+{
+  if (!SubmitAsync(FTP_ASYNC_OP_APPEND, filePath, callback, context))
+    return false;
+
+  asyncData = data;
+  asyncLength = length;
+  return true;
+}
+
+/**
+ * @brief Create dir and its missing parents in asynchronous mode, one MKD per poll() like MakeDirRecursive().
+ */
+bool M5_Ethernet_FtpClient::SubmitMakeDir(const char *dir, FtpAsyncCallback callback, void *context)
+{
+  return SubmitAsync(FTP_ASYNC_OP_MKDIR, dir, callback, context);
+}
+
+/**
+ * @brief Start a RETR in asynchronous mode, sink receives the data from poll().
+ */
+bool M5_Ethernet_FtpClient::SubmitDownload(const char *fileName, FtpWriteCallback sink, void *sinkContext, FtpAsyncCallback callback, void *context)
+{
+  if (!SubmitAsync(FTP_ASYNC_OP_DOWNLOAD, fileName, callback, context))
+    return false;
+
+  asyncSink = sink;
+  asyncSinkContext = sinkContext;
+  return true;
+}
+
+bool M5_Ethernet_FtpClient::SubmitAsync(uint8_t op, const char *path, FtpAsyncCallback callback, void *context)
+{
+  if (asyncState != FTP_ASYNC_IDLE || strlen(path) >= FTP_PATH_MAX)
+    return false;
+
+  strcpy(asyncPath, path);
+  asyncOp = op;
+  asyncCallback = callback;
+  asyncContext = context;
+  asyncResult = 0;
+  asyncError = 0;
+  asyncSent = 0;
+  asyncDirPos = 0;
+  asyncDirLength = 0;
+
+  EnterAsyncState(_isConnected && client->isConnected() ? FTP_ASYNC_BEGIN : FTP_ASYNC_CONNECT);
+  return true;
+}
+
+/**
+ * @brief Advance the submitted operation as far as it gets without waiting. Call it from every loop().
+ *
+ * Each call reads what has arrived, sends what the socket takes and returns. Opening a socket is the
+ * only step that waits, for at most FTP_ASYNC_CONNECT_TIMEOUT_MS.
+ * @return true while the operation is still running
+ */
+bool M5_Ethernet_FtpClient::poll()
+{
+  uint16_t responseCode;
+
+  switch (asyncState)
+  {
+  case FTP_ASYNC_IDLE:
+    return false;
+
+  case FTP_ASYNC_CONNECT:
+    client->Stop();
+    dclient->Stop();
+    _isConnected = false;
+    transferType = 0;
+    transferMode = 'S';
+    ResetCmdAnswer();
+    pendingCount = 0;
+    cmdRxPos = cmdRxLength = 0;
+
+    FTP_LOGINFO1(F("Connecting to: "), serverAdress);
+    if (!client->Connect(serverAdress.c_str(), port, FTP_ASYNC_CONNECT_TIMEOUT_MS))
+    {
+      FTP_LOGERROR(F("Command connection failed"));
+      metrics.connectFailures++;
+      FinishAsync(FTP_RESCODE_CLIENT_ISNOT_CONNECTED);
+      break;
+    }
+    EnterAsyncState(FTP_ASYNC_GREETING);
+    break;
+
+  case FTP_ASYNC_GREETING:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    if (isErrorCode(responseCode))
+    {
+      client->Stop();
+      metrics.connectFailures++;
+      FinishAsync(responseCode);
+      break;
+    }
+    WriteCommand(FTP_COMMAND_USER, userName);
+    EnterAsyncState(FTP_ASYNC_USER);
+    break;
+
+  case FTP_ASYNC_USER:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    if (isErrorCode(responseCode))
+    {
+      client->Stop();
+      metrics.connectFailures++;
+      FinishAsync(responseCode);
+      break;
+    }
+    WriteCommand(FTP_COMMAND_PASS, passWord);
+    EnterAsyncState(FTP_ASYNC_PASS);
+    break;
+
+  case FTP_ASYNC_PASS:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    if (isErrorCode(responseCode))
+    {
+      client->Stop();
+      _isConnected = false;
+      metrics.connectFailures++;
+      FinishAsync(responseCode);
+      break;
+    }
+    metrics.connects++;
+    EnterAsyncState(FTP_ASYNC_BEGIN);
+    break;
+
+  case FTP_ASYNC_BEGIN:
+    if (asyncOp == FTP_ASYNC_OP_MKDIR && asyncDirLength == 0)
+    {
+      FTP_LOGINFO("Send MKD Recursive");
+      asyncDirLength = strlen(asyncPath);
+      if (!SendAsyncMakeDir())
+        FinishAsync(FTP_RESCODE_ACTION_SUCCESS);
+    }
+    else if (transferMode != 'S')
+    {
+      FTP_LOGINFO("Send MODE S");
+      WriteCommand(FTP_COMMAND_MODE_STREAM);
+      EnterAsyncState(FTP_ASYNC_MODE);
+    }
+    else if (transferType != 'I')
+    {
+      FTP_LOGINFO("Send TYPE I");
+      WriteCommand(FTP_COMMAND_TYPE_BINARY);
+      EnterAsyncState(FTP_ASYNC_TYPE);
+    }
+    else
+    {
+      SendAsyncPassive();
+    }
+    break;
+
+  case FTP_ASYNC_MKD:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    if (isErrorCode(responseCode) && responseCode != FTP_RESCODE_FILE_UNAVAILABLE)
+    { // Ignore "Directory already exists" error
+      FinishAsync(responseCode);
+      break;
+    }
+    if (SendAsyncMakeDir())
+      break;
+
+    CacheDir(asyncPath, asyncDirLength);
+    if (asyncOp == FTP_ASYNC_OP_MKDIR)
+      FinishAsync(FTP_RESCODE_ACTION_SUCCESS);
+    else
+      EnterAsyncState(FTP_ASYNC_BEGIN); // Directories are there, APPE once more
+    break;
+
+  case FTP_ASYNC_MODE:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    if (isErrorCode(responseCode))
+    {
+      FinishAsync(responseCode);
+      break;
+    }
+    transferMode = 'S';
+    EnterAsyncState(FTP_ASYNC_BEGIN);
+    break;
+
+  case FTP_ASYNC_TYPE:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    transferType = isErrorCode(responseCode) ? 0 : 'I';
+    if (isErrorCode(responseCode))
+      FinishAsync(responseCode);
+    else
+      SendAsyncPassive();
+    break;
+
+  case FTP_ASYNC_PASSIVE:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    if (epsvSupported)
+    {
+      if (responseCode == FTP_ENTERING_EXTENDED_PASSIVE_MODE && ParseExtendedPassiveAnswer(outBuf))
+      {
+        _dataAddress = client->RemoteIP();
+        ConnectAsyncData();
+      }
+      else if (responseCode == FTP_RESCODE_CLIENT_ISNOT_CONNECTED || responseCode == FTP_RESCODE_SERVICE_NOT_AVAILABLE)
+      {
+        FinishAsync(responseCode);
+      }
+      else
+      {
+        FTP_LOGINFO("EPSV not supported, using PASV");
+        epsvSupported = false;
+        SendAsyncPassive();
+      }
+    }
+    else if (responseCode == FTP_ENTERING_PASSIVE_MODE && ParsePassiveAnswer(outBuf))
+    {
+      ConnectAsyncData();
+    }
+    else
+    {
+      FinishAsync(isErrorCode(responseCode) ? responseCode : FTP_RESCODE_SYNTAX_ERROR);
+    }
+    break;
+
+  case FTP_ASYNC_TRANSFER:
+    if ((responseCode = PollAsyncReply()) == 0)
+      break;
+    if (asyncOp == FTP_ASYNC_OP_APPEND && lazyMakeDir && asyncDirLength == 0 &&
+        (responseCode == FTP_RESCODE_FILE_UNAVAILABLE || responseCode == FTP_RESCODE_FILE_NAME_NOT_ALLOWED))
+    {
+      // As in BeginAppend(): create the parent directories, then try APPE once more
+      const char *lastSlash = strrchr(asyncPath, '/');
+      if (lastSlash != NULL && lastSlash > asyncPath)
+      {
+        FTP_LOGINFO("APPE refused, creating directories");
+        dclient->Stop();
+        ClearDirCache(); // The cached entries did not match the server any more
+        asyncDirLength = lastSlash - asyncPath;
+        if (!SendAsyncMakeDir())
+          FinishAsync(responseCode);
+        break;
+      }
+    }
+    if (isErrorCode(responseCode))
+    {
+      FinishAsync(responseCode);
+      break;
+    }
+    EnterAsyncState(asyncOp == FTP_ASYNC_OP_APPEND ? FTP_ASYNC_SEND : FTP_ASYNC_RECEIVE);
+    break;
+
+  case FTP_ASYNC_SEND:
+  {
+    // Only hand the socket what fits into its TX buffer, so write() never waits
+    int space = dclient->AvailableForWrite();
+    size_t chunk = asyncLength - asyncSent;
+    if (space >= 0 && chunk > (size_t)space)
+      chunk = space;
+
+    if (chunk > 0)
+    {
+      size_t written = dclient->Write(asyncData + asyncSent, chunk);
+      if (written > 0)
+      {
+        asyncSent += written;
+        metrics.bytesSent += written;
+        asyncMillis = millis();
+      }
+    }
+
+    if (asyncSent >= asyncLength)
+    {
+      dclient->Stop();
+      EnterAsyncState(FTP_ASYNC_COMPLETE);
+    }
+    else if (!dclient->isConnected() || millis() - asyncMillis >= DataTimeout())
+    {
+      FTP_LOGERROR("poll: Data connection write error");
+      asyncError = FTP_RESCODE_DATA_CONNECTION_ERROR;
+      dclient->Stop();
+      EnterAsyncState(FTP_ASYNC_COMPLETE);
+    }
+    break;
+  }
+
+  case FTP_ASYNC_RECEIVE:
+  {
+    int received = ReadData();
+    if (received > 0)
+    {
+      asyncMillis = millis();
+      asyncSent += received;
+      if (!asyncSink(asyncSinkContext, dataRx, received))
+      {
+        FTP_LOGERROR("poll: Sink error");
+        asyncError = FTP_RESCODE_LOCAL_WRITE_ERROR;
+        dclient->Stop();
+        EnterAsyncState(FTP_ASYNC_COMPLETE);
+      }
+    }
+    else if (!dclient->isConnected())
+    {
+      dclient->Stop();
+      EnterAsyncState(FTP_ASYNC_COMPLETE);
+    }
+    else if (millis() - asyncMillis >= DataTimeout())
+    {
+      FTP_LOGERROR("poll: Data connection timeout");
+      asyncError = FTP_RESCODE_DATA_CONNECTION_ERROR;
+      dclient->Stop();
+      EnterAsyncState(FTP_ASYNC_COMPLETE);
+    }
+    break;
+  }
+
+  case FTP_ASYNC_COMPLETE:
+    if ((responseCode = PollAsyncReply()) != 0)
+      FinishAsync(asyncError != 0 ? asyncError : responseCode);
+    break;
+  }
+
+  return asyncState != FTP_ASYNC_IDLE;
+}
+
+bool M5_Ethernet_FtpClient::isBusy()
+{
+  return asyncState != FTP_ASYNC_IDLE;
+}
+
+/**
+ * @brief Final reply code of the last asynchronous operation, 0 while it is running.
+ */
+uint16_t M5_Ethernet_FtpClient::GetAsyncResult()
+{
+  return asyncResult;
+}
+
+void M5_Ethernet_FtpClient::EnterAsyncState(uint8_t state)
+{
+  asyncState = state;
+  asyncMillis = millis();
+}
+
+/**
+ * @brief GetCmdAnswer() for poll(): 0 while the reply is incomplete, 426 once CmdAnswerTimeout() has passed.
+ */
+uint16_t M5_Ethernet_FtpClient::PollAsyncReply()
+{
+  uint16_t responseCode = PollCmdAnswer();
+  if (responseCode != 0)
+  {
+    lastActivityMillis = millis();
+    ObserveReply(responseCode);
+    _isConnected = responseCode != FTP_RESCODE_SERVICE_NOT_AVAILABLE;
+    FTP_LOGDEBUG0("->");
+    FTP_LOGDEBUG0(outBuf);
+    return responseCode;
+  }
+
+  unsigned long waitMs = CmdAnswerTimeout();
+  if (millis() - asyncMillis >= waitMs || (!client->isConnected() && !client->Available()))
+  {
+    if (millis() - asyncMillis >= waitMs)
+      ObserveTimeout();
+    pendingCount = 0;
+    ResetCmdAnswer();
+    _isConnected = false;
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  return 0;
+}
+
+void M5_Ethernet_FtpClient::SendAsyncPassive()
+{
+  FTP_LOGINFO(epsvSupported ? "Send EPSV" : "Send PASV");
+  WriteCommand(epsvSupported ? FTP_COMMAND_EXTENDED_PASSIVE_MODE : FTP_COMMAND_PASSIVE_MODE);
+  EnterAsyncState(FTP_ASYNC_PASSIVE);
+}
+
+/**
+ * @brief Send MKD for the next directory of the first asyncDirLength characters of asyncPath.
+ *
+ * Empty components and cached directories are skipped.
+ * @return false when no directory was left
+ */
+bool M5_Ethernet_FtpClient::SendAsyncMakeDir()
+{
+  while (asyncDirPos < asyncDirLength)
+  {
+    size_t end = asyncDirPos + 1;
+    while (end < asyncDirLength && asyncPath[end] != '/')
+      end++;
+    asyncDirPos = end;
+
+    if (asyncPath[end - 1] == '/' || IsDirCached(asyncPath, end))
+      continue;
+
+    FTP_LOGINFO("Send MKD");
+    WriteCommand(FTP_COMMAND_MAKE_DIR, asyncPath, end);
+    EnterAsyncState(FTP_ASYNC_MKD);
+    return true;
+  }
+
+  return false;
+}
+
+void M5_Ethernet_FtpClient::ConnectAsyncData()
+{
+  FTP_LOGINFO3(F("dataAddress:"), _dataAddress, F(", dataPort:"), _dataPort);
+
+  if (!dclient->Connect(_dataAddress, _dataPort, FTP_ASYNC_CONNECT_TIMEOUT_MS))
+  {
+    FTP_LOGDEBUG(F("Data connection not established error"));
+    FinishAsync(FTP_RESCODE_DATA_CONNECTION_ERROR);
+    return;
+  }
+
+  if (asyncOp == FTP_ASYNC_OP_APPEND)
+  {
+    FTP_LOGINFO("Send APPE");
+    WriteCommand(FTP_COMMAND_APPEND_FILE, asyncPath);
+  }
+  else
+  {
+    FTP_LOGINFO("Send RETR");
+    WriteCommand(FTP_COMMAND_DOWNLOAD, asyncPath);
+  }
+  EnterAsyncState(FTP_ASYNC_TRANSFER);
+}
+
+void M5_Ethernet_FtpClient::FinishAsync(uint16_t responseCode)
+{
+  if (isErrorCode(responseCode))
+    dclient->Stop();
+
+  asyncState = FTP_ASYNC_IDLE;
+  asyncOp = FTP_ASYNC_OP_NONE;
+  asyncResult = responseCode;
+
+  if (asyncCallback != NULL)
+    asyncCallback(asyncContext, responseCode);
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Write the counters and the per-verb latency histograms of this client.
+ *
+ * Verbs that were never sent are left out.
+ */
+void M5_Ethernet_FtpClient::WriteMetrics(MetricsWriter &writer)
+{
+  writer.Header("ftp_connected", "gauge", "1 while the command connection is logged in.");
+  writer.Value("ftp_connected", _isConnected ? 1 : 0);
+  writer.Header("ftp_connects_total", "counter", "Successful logins.");
+  writer.Value("ftp_connects_total", metrics.connects);
+  writer.Header("ftp_connect_failures_total", "counter", "Failed connects and logins.");
+  writer.Value("ftp_connect_failures_total", metrics.connectFailures);
+  writer.Header("ftp_reconnects_total", "counter", "Sessions reopened by EnsureSession().");
+  writer.Value("ftp_reconnects_total", metrics.reconnects);
+  writer.Header("ftp_reply_timeouts_total", "counter", "Replies that did not arrive within the timeout.");
+  writer.Value("ftp_reply_timeouts_total", metrics.timeouts);
+  writer.Header("ftp_reply_rtt_smoothed_microseconds", "gauge", "Smoothed reply time the timeouts are derived from.");
+  writer.Value("ftp_reply_rtt_smoothed_microseconds", srttMicros);
+  writer.Header("ftp_reply_timeout_milliseconds", "gauge", "Current wait for the reply to a command.");
+  writer.Value("ftp_reply_timeout_milliseconds", ReplyTimeout());
+  writer.Header("ftp_commands_total", "counter", "Commands sent on the control connection.");
+  writer.Value("ftp_commands_total", metrics.commands);
+  writer.Header("ftp_error_replies_total", "counter", "4xx and 5xx replies.");
+  writer.Value("ftp_error_replies_total", metrics.errorReplies);
+  writer.Header("ftp_data_sent_bytes_total", "counter", "Bytes written to data connections.");
+  writer.Value("ftp_data_sent_bytes_total", metrics.bytesSent);
+  writer.Header("ftp_data_send_waits_total", "counter", "Times an upload found the socket TX buffer full and yielded.");
+  writer.Value("ftp_data_send_waits_total", metrics.sendWaits);
+  writer.Header("ftp_data_received_bytes_total", "counter", "Bytes read from data connections.");
+  writer.Value("ftp_data_received_bytes_total", metrics.bytesReceived);
+  writer.Header("ftp_append_buffered_bytes", "gauge", "Bytes queued by QueueTextLine() and not flushed yet.");
+  writer.Value("ftp_append_buffered_bytes", GetBufferedBytes());
+
+  writer.Header("ftp_command_duration_seconds", "histogram", "Time from writing a command to its first reply.");
+  char labels[16];
+  for (uint8_t i = 0; i < FTP_METRICS_VERBS; i++)
+  {
+    if (metrics.latency[i].count == 0)
+      continue;
+    snprintf(labels, sizeof(labels), "verb=\"%s\"", i < FTP_METRICS_VERBS - 1 ? metricsVerbs[i] : "other");
+    writer.Histogram("ftp_command_duration_seconds", metrics.latency[i], labels);
+  }
+}
+
+/////////////////////////////////////////////
+
+FtpPath::FtpPath()
+{
+  Clear();
+}
+
+FtpPath &FtpPath::Clear()
+{
+  path[0] = 0;
+  pathLength = 0;
+  overflow = false;
+  return *this;
+}
+
+FtpPath &FtpPath::Append(const char *str)
+{
+  return Append(str, strlen(str));
+}
+
+/**
+ * @brief Append characters; what does not fit is dropped and isOverflow() becomes true.
+ */
+FtpPath &FtpPath::Append(const char *str, size_t length)
+{
+  if (pathLength + length > sizeof(path) - 1)
+  {
+    length = sizeof(path) - 1 - pathLength;
+    overflow = true;
+  }
+
+  memcpy(path + pathLength, str, length);
+  pathLength += length;
+  path[pathLength] = 0;
+  return *this;
+}
+
+FtpPath &FtpPath::Append(char c)
+{
+  return Append(&c, 1);
+}
+
+/**
+ * @brief Append a decimal number, zero padded to width digits.
+ */
+FtpPath &FtpPath::AppendNumber(unsigned long value, uint8_t width)
+{
+  char digits[12];
+  uint8_t count = 0;
+  do
+  {
+    digits[sizeof(digits) - 1 - count] = '0' + value % 10;
+    value /= 10;
+    count++;
+  } while (value > 0 && count < sizeof(digits));
+
+  while (count < width && count < sizeof(digits))
+  {
+    digits[sizeof(digits) - 1 - count] = '0';
+    count++;
+  }
+
+  return Append(digits + sizeof(digits) - count, count);
+}
\ No newline at end of file
@@ -27,7 +27,10 @@ SOFTWARE.
 #include <M5Unified.h>
 #include <SPI.h>
 #include <M5_Ethernet.h>
-#include <vector>
+#include "M5_Ethernet_FtpDeflate.hpp"
+#include "M5_Ethernet_FtpRecordFormat.hpp"
+#include "M5_Ethernet_FtpTransport.hpp"
+#include "M5_Ethernet_Metrics.hpp"
 
 #ifndef M5_Ethernet_FtpClient_H
 #define M5_Ethernet_FtpClient_H
@@ -37,23 +40,65 @@ SOFTWARE.
 #define F(string_literal) (FPSTR(PSTR(string_literal)))
 
 #define FTP_PORT 21
-#define FTP_BUFFER_SIZE 1500
 #define FTP_TIMEOUT_MS 10000UL
+#define FTP_KEEPALIVE_MS 30000UL // Idle time before a NOOP is sent to check the command connection
 #define FTP_ENTERING_PASSIVE_MODE 227
-
+#define FTP_ENTERING_EXTENDED_PASSIVE_MODE 229
+#define FTP_PATH_MAX 128     // Longest remote path kept in fixed buffers
+#define FTP_DIR_CACHE_SIZE 4 // Directories remembered as existing on the server
+#define FTP_COMMAND_BUFFER_SIZE 512 // Command lines are assembled here and sent with one write
+#define FTP_LIST_NAME_MAX FTP_PATH_MAX // Longer names are truncated in FtpListEntry, see isTruncated
+#define FTP_LIST_LINE_MAX 384       // Longest listing line that is parsed as a whole, facts and name
+#define FTP_BATCH_MAX (FTP_PATH_MAX / 2) // Reply codes of one pipelined batch, one MKD per component of the longest path
+#define FTP_BUFFER_SIZE 1500         // Deprecated and unused: uploads are sized by availableForWrite() of the data socket
+#define FTP_RX_BUFFER_SIZE 2048     // Data connection reads, one block of the W5500's default 2 KB socket RX memory
+#define FTP_CMD_RX_BUFFER_SIZE 256  // Control connection reads, replies are short
+#define FTP_POLL_SPIN_US 250        // Receive loops poll without sleeping this long before falling back to delay(1)
+
+#define FTP_APPEND_SLOTS 2              // Target files buffered at the same time
+#define FTP_APPEND_BUFFER_SIZE 4096     // Bytes buffered per target file
+#define FTP_APPEND_MAX_LINES 60         // Default line count that triggers a flush
+#define FTP_APPEND_MAX_AGE_MS 60000UL   // Default age of the oldest buffered line that triggers a flush
+#define FTP_ASYNC_CONNECT_TIMEOUT_MS 1000 // Socket connect is the one step poll() waits for, keep it short
+#define FTP_METRICS_VERBS 23              // Verbs with their own latency histogram, the last one counts the rest
+#define FTP_METRICS_PENDING 8             // Commands awaiting a reply that are timed for the histograms
+
+// Timeouts are derived from the smoothed reply time (RFC 6298 style) and capped by the timeout given to the constructor
+#define FTP_RTO_INITIAL_MS 1000       // Reply timeout until the first reply has been timed
+#define FTP_RTO_MIN_MS 300            // Lower bound, leaves room for one W5500 retransmission (200 ms)
+#define FTP_RTO_MAX_BACKOFF 4         // Doublings of the reply timeout after consecutive timeouts
+#define FTP_RTO_CONNECT_FACTOR 2      // Socket connect and the greeting
+#define FTP_RTO_DATA_FACTOR 4         // Data connection idle and the completion reply, the server may be writing to disk
+#define FTP_DATA_TIMEOUT_MIN_MS 5000  // Lower bound of those, a busy or spun-down disk takes seconds where the LAN takes 1 ms
+#define FTP_RECONNECT_BACKOFF_MIN_MS 500UL   // Wait after the first failed reconnect, doubled on each further failure
+#define FTP_RECONNECT_BACKOFF_MAX_MS 30000UL // Longest wait between reconnect attempts
+
+#define FTP_RESCODE_SERVICE_NOT_AVAILABLE 421 // Server is closing the control connection.
+#define FTP_RESCODE_FILE_STATUS 213           // Reply to SIZE/MDTM.
+#define FTP_RESCODE_PENDING_FURTHER_INFO 350  // REST accepted, waiting for RETR/STOR.
 #define FTP_RESCODE_CLIENT_ISNOT_CONNECTED 426
 #define FTP_RESCODE_DATA_CONNECTION_ERROR 425
 #define FTP_RESCODE_ACTION_SUCCESS 200 // The requested action has been successfully.
 #define FTP_RESCODE_SYNTAX_ERROR 500
+#define FTP_RESCODE_NOT_IMPLEMENTED 502
+#define FTP_RESCODE_FILE_UNAVAILABLE 550      // File not found or no access, also "directory already exists" on MKD.
+#define FTP_RESCODE_FILE_NAME_NOT_ALLOWED 553 // vsftpd answers this to APPE/STOR into a missing directory.
+
+// Local results, outside the 100-599 range of server replies; isErrorCode() counts them as errors
+#define FTP_RESCODE_LOCAL_ERROR 900
+#define FTP_RESCODE_COMMAND_TOO_LONG 901 // The argument does not fit the command buffer or FTP_PATH_MAX, nothing was sent.
+#define FTP_RESCODE_LOCAL_WRITE_ERROR 902 // The local sink refused downloaded data (e.g. storage full).
 
 #define FTP_COMMAND_QUIT F("QUIT")
 #define FTP_COMMAND_USER F("USER ")
 #define FTP_COMMAND_PASS F("PASS ")
+#define FTP_COMMAND_NOOP F("NOOP")
 
 #define FTP_COMMAND_RENAME_FILE_FROM F("RNFR ")
 #define FTP_COMMAND_RENAME_FILE_TO F("RNTO ")
 
 #define FTP_COMMAND_FILE_LAST_MOD_TIME F("MDTM ")
+#define FTP_COMMAND_FILE_SIZE F("SIZE ")
 
 #define FTP_COMMAND_APPEND_FILE F("APPE ")
 #define FTP_COMMAND_DELETE_FILE F("DELE ")
@@ -66,19 +111,176 @@ SOFTWARE.
 
 #define FTP_COMMAND_DOWNLOAD F("RETR ")
 #define FTP_COMMAND_FILE_UPLOAD F("STOR ")
+#define FTP_COMMAND_RESTART F("REST ")
 
 #define FTP_COMMAND_PASSIVE_MODE F("PASV")
+#define FTP_COMMAND_EXTENDED_PASSIVE_MODE F("EPSV")
+#define FTP_COMMAND_TYPE_ASCII F("TYPE A")
+#define FTP_COMMAND_TYPE_BINARY F("TYPE I")
+#define FTP_COMMAND_MODE_STREAM F("MODE S")
+#define FTP_COMMAND_MODE_DEFLATE F("MODE Z")
+#define FTP_COMMAND_FEATURES F("FEAT")
+
+/// @brief Fixed-capacity path buffer, builds remote paths without heap allocation
+class FtpPath
+{
+private:
+    char path[FTP_PATH_MAX];
+    size_t pathLength;
+    bool overflow;
+
+public:
+    FtpPath();
+    FtpPath &Clear();
+    FtpPath &Append(const char *str);
+    FtpPath &Append(const char *str, size_t length);
+    FtpPath &Append(char c);
+    FtpPath &AppendNumber(unsigned long value, uint8_t width = 0);
+    const char *c_str() const { return path; }
+    size_t length() const { return pathLength; }
+    bool isOverflow() const { return overflow; }
+};
+
+#define FTP_ENTRY_UNKNOWN 0
+#define FTP_ENTRY_FILE 1
+#define FTP_ENTRY_DIR 2
+#define FTP_ENTRY_CDIR 3 // The listed directory itself
+#define FTP_ENTRY_PDIR 4 // Its parent
+
+/// @brief One directory entry parsed from an MLSD line
+struct FtpListEntry
+{
+    char name[FTP_LIST_NAME_MAX];
+    uint8_t type;
+    uint64_t size;
+    uint32_t modify;  // Seconds since 1970 (UTC), 0 when not reported
+    bool isTruncated; // name holds only the start of a longer name
+};
+
+/// @brief Receives one directory entry; return false to stop the listing
+typedef bool (*FtpListCallback)(void *context, const FtpListEntry &entry);
+
+/// @brief Receives one line of a listing without CR/LF, return false to stop
+typedef bool (*FtpLineCallback)(void *context, char *line, size_t length);
+
+/// @brief Hands out the next span of upload data in *data; returns its length, 0 at the end, negative on error
+typedef int (*FtpReadCallback)(void *context, const uint8_t **data);
+
+/// @brief Receives the next chunk of download data; return false to abort the transfer
+typedef bool (*FtpWriteCallback)(void *context, const uint8_t *data, size_t length);
+
+/// @brief Called from poll() when an operation submitted in asynchronous mode has finished
+typedef void (*FtpAsyncCallback)(void *context, uint16_t responseCode);
+
+#define FTP_ASYNC_OP_NONE 0
+#define FTP_ASYNC_OP_APPEND 1
+#define FTP_ASYNC_OP_MKDIR 2
+#define FTP_ASYNC_OP_DOWNLOAD 3
+
+#define FTP_ASYNC_IDLE 0
+#define FTP_ASYNC_CONNECT 1
+#define FTP_ASYNC_GREETING 2
+#define FTP_ASYNC_USER 3
+#define FTP_ASYNC_PASS 4
+#define FTP_ASYNC_BEGIN 5
+#define FTP_ASYNC_MKD 6
+#define FTP_ASYNC_TYPE 7
+#define FTP_ASYNC_PASSIVE 8
+#define FTP_ASYNC_TRANSFER 9 // Waiting for the 150 reply to APPE/RETR
+#define FTP_ASYNC_SEND 10
+#define FTP_ASYNC_RECEIVE 11
+#define FTP_ASYNC_COMPLETE 12 // Waiting for the 226 reply
+#define FTP_ASYNC_MODE 13     // Waiting for the reply to MODE S
+
+/// @brief Result of a transfer
+struct FtpTransferStats
+{
+    uint32_t bytes;
+    uint32_t elapsedMs;
+    uint32_t bytesPerSecond;
+};
+
+/// @brief Counters and latency histograms of one client, see WriteMetrics()
+struct FtpClientMetrics
+{
+    uint32_t connects;
+    uint32_t connectFailures; // Socket connect or login failed
+    uint32_t reconnects;      // Sessions EnsureSession() found dropped
+    uint32_t timeouts;        // Replies that did not arrive within the timeout
+    uint32_t commands;
+    uint32_t errorReplies;    // 4xx and 5xx
+    uint64_t bytesSent;       // Data connection, after compression
+    uint32_t sendWaits;       // Uploads found the socket TX buffer full
+    uint64_t bytesReceived;   // Data connection
+    MetricsHistogram latency[FTP_METRICS_VERBS]; // From writing the command to its first reply
+};
+
+/// @brief Lines waiting to be appended to one remote file
+struct FtpAppendSlot
+{
+    char path[FTP_PATH_MAX];
+    unsigned char data[FTP_APPEND_BUFFER_SIZE];
+    size_t length;
+    uint16_t lines;
+    unsigned long firstMillis;
+    uint32_t remoteSize;  // Size of the remote file before data[], valid when remoteSizeKnown
+    bool remoteSizeKnown;
+    bool needsReconcile;  // A transfer failed, part of data[] may already be on the server
+    bool recordOpen;      // data[recordHeader] starts a binary block that new records are added to
+    bool hasRecords;      // data[] holds binary blocks, lines can not be counted by '\n' then
+    uint16_t recordHeader;
+    uint8_t recordChannels;
+    uint64_t recordTime;
+    uint32_t recordBits[FTP_BIN_MAX_CHANNELS];
+};
 
 class M5_Ethernet_FtpClient
 {
 private:
-    uint16_t WriteClientBuffered(EthernetClient *cli, unsigned char *data, int dataLength);
-
-    EthernetClient client;
-    EthernetClient dclient;
+    uint16_t WriteClientBuffered(FtpTransport *cli, const unsigned char *data, int dataLength);
+    uint16_t InitPassiveMode(char type, bool compress = false);
+    uint16_t SetTransferType(char type);
+    uint16_t SetTransferMode(char mode);
+    uint16_t WriteTransferData(const unsigned char *data, int dataLength);
+    static bool DeflateSink(void *context, const uint8_t *data, size_t length);
+
+    FtpEthernetTransport ethernetControl;
+    FtpEthernetTransport ethernetData;
+    FtpTransport *client = &ethernetControl; // Command connection, see SetTransport()
+    FtpTransport *dclient = &ethernetData;   // Data connection
 
     char outBuf[1024];
-    unsigned char outCount;
+    size_t outCount = 0;
+
+    // Reply parser state, kept between calls so a reply may arrive in pieces
+    uint16_t replyCode = 0;   // Code of the first line, 0 until it is known
+    uint8_t replyLineLen = 0; // Characters seen on the current line, up to the 4 in replyLineHead
+    char replyLineHead[4];
+    bool replyDone = true;
+    uint8_t cmdRx[FTP_CMD_RX_BUFFER_SIZE]; // Reply bytes read from the socket but not parsed yet
+    uint16_t cmdRxPos = 0;
+    uint16_t cmdRxLength = 0;
+    void ResetCmdAnswer();
+    uint16_t PollCmdAnswer();
+    bool ParsePassiveAnswer(const char *answer);
+    bool ParseExtendedPassiveAnswer(const char *answer);
+    uint16_t CloseTransfer(uint16_t responseCode, bool isStopped = false);
+    bool ParseListEntry(const char *line, FtpListEntry *entry);
+    static bool ListDirLine(void *context, char *line, size_t length);
+
+    uint8_t dataRx[FTP_RX_BUFFER_SIZE];
+    int ReadData();
+    void PollWait(unsigned long sinceMicros);
+    bool ReadDataLines(FtpLineCallback sink, void *context);
+
+    char cmdBuf[FTP_COMMAND_BUFFER_SIZE];
+    size_t cmdLength = 0;
+    uint8_t batchCount = 0;
+    bool commandRejected = false; // BatchCommand() refused a line, reported by the next reply read
+    void WriteCommand(const __FlashStringHelper *command, const char *argument = "");
+    void WriteCommand(const __FlashStringHelper *command, const String &argument);
+    void WriteCommand(const __FlashStringHelper *command, const char *argument, size_t argumentLength);
+    void FlushBatch();
 
     String userName;
     String passWord;
@@ -86,19 +288,82 @@ private:
     uint16_t port;
 
     bool _isConnected = false;
-    unsigned char clientBuf[FTP_BUFFER_SIZE];
-    size_t bufferSize = FTP_BUFFER_SIZE;
+    unsigned long lastActivityMillis = 0;
+    unsigned long keepAliveInterval = FTP_KEEPALIVE_MS;
     uint16_t timeout = FTP_TIMEOUT_MS;
 
-    EthernetClient *GetDataClient();
-
     IPAddress _dataAddress;
     uint16_t _dataPort;
 
-    bool inASCIIMode = false;
-    bool isErrorCode(uint16_t responseCode);
-
-    std::vector<String> SplitPath(const String &path);
+    char transferType = 0;     // TYPE negotiated on this session, 'A', 'I' or 0 when unknown
+    bool epsvSupported = true; // Cleared when the server rejects EPSV
+
+    char transferMode = 'S';  // MODE on this session, stream after login
+    bool compression = false; // SetCompression(), used when the server offers MODE Z
+    int8_t modeZSupported = -1; // From FEAT, -1 until asked
+    bool isDeflating = false;   // The open data connection carries a zlib stream
+    FtpDeflate deflater;
+    FtpCompressionStats compressionStats;
+
+    bool lazyMakeDir = false;
+    char dirCache[FTP_DIR_CACHE_SIZE][FTP_PATH_MAX];
+    uint8_t dirCacheNext = 0;
+    bool IsDirCached(const char *dir, size_t length);
+    void CacheDir(const char *dir, size_t length);
+
+    FtpAppendSlot appendSlots[FTP_APPEND_SLOTS];
+    uint16_t appendMaxLines = FTP_APPEND_MAX_LINES;
+    size_t appendMaxBytes = FTP_APPEND_BUFFER_SIZE;
+    unsigned long appendMaxAge = FTP_APPEND_MAX_AGE_MS;
+    FtpAppendSlot *GetAppendSlot(const char *filePath);
+    void StartAppendSlot(FtpAppendSlot *slot, const char *filePath);
+    uint16_t FlushAppendSlot(FtpAppendSlot *slot);
+    uint16_t BeginAppend(const char *filePath, char type);
+    bool sizeSupported = true; // Cleared when the server rejects SIZE
+
+    // Asynchronous mode, advanced by poll()
+    uint8_t asyncOp = FTP_ASYNC_OP_NONE;
+    uint8_t asyncState = FTP_ASYNC_IDLE;
+    unsigned long asyncMillis = 0;  // Start of the current state, or last progress of a transfer
+    uint16_t asyncResult = 0;
+    uint16_t asyncError = 0;        // Local failure reported once the completion reply was read
+    char asyncPath[FTP_PATH_MAX];
+    const uint8_t *asyncData = NULL;
+    size_t asyncLength = 0;
+    size_t asyncSent = 0;
+    size_t asyncDirPos = 0;    // End of the last directory of asyncPath sent with MKD
+    size_t asyncDirLength = 0; // Directories of asyncPath poll() creates, 0 until it started
+    FtpWriteCallback asyncSink = NULL;
+    void *asyncSinkContext = NULL;
+    FtpAsyncCallback asyncCallback = NULL;
+    void *asyncContext = NULL;
+    bool SubmitAsync(uint8_t op, const char *path, FtpAsyncCallback callback, void *context);
+    void EnterAsyncState(uint8_t state);
+    uint16_t PollAsyncReply();
+    void SendAsyncPassive();
+    bool SendAsyncMakeDir();
+    void ConnectAsyncData();
+    void FinishAsync(uint16_t responseCode);
+
+    FtpClientMetrics metrics;
+    uint8_t pendingVerbs[FTP_METRICS_PENDING]; // Commands written but not answered yet, oldest first
+    unsigned long pendingMicros[FTP_METRICS_PENDING];
+    uint8_t pendingHead = 0;
+    uint8_t pendingCount = 0;
+    void ObserveReply(uint16_t responseCode);
+
+    // Smoothed reply time of this client, in microseconds, 0 until the first sample
+    uint32_t srttMicros = 0;
+    uint32_t rttVarMicros = 0;
+    uint8_t rtoBackoff = 0;         // Consecutive reply timeouts, each doubles the reply timeout
+    uint8_t reconnectFailures = 0;  // Consecutive failed reconnects
+    unsigned long reconnectMillis = 0; // No reconnect is attempted before this time
+    unsigned long ReconnectBackoff(uint8_t failures);
+    void ObserveRtt(uint32_t sampleMicros);
+    void ObserveTimeout();
+    unsigned long ReplyTimeout();
+    unsigned long ConnectTimeout();
+    unsigned long CmdAnswerTimeout();
 
 public:
     //    M5_Ethernet_FtpClient(char *_serverAdress, uint16_t _port, char *_userName, char *_passWord, uint16_t _timeout = 10000);
@@ -110,28 +375,148 @@ public:
     uint16_t OpenConnection();
     void CloseConnection();
     bool isConnected();
+    void SetTransport(FtpTransport *control, FtpTransport *data);
+    bool isErrorCode(uint16_t responseCode);
+    uint16_t EnsureSession();
+    uint16_t Noop();
+    void SetKeepAliveInterval(unsigned long intervalMs);
     uint16_t InitAsciiPassiveMode();
-    uint16_t NewFile(String fileName);
-    uint16_t AppendFile(String fileName);
-    uint16_t AppendTextLine(String filePath, String textLine);
-    uint16_t WriteData(unsigned char *data, int dataLength);
-    uint16_t WriteData(String data);
+    uint16_t InitBinaryPassiveMode();
+    uint16_t NewFile(const char *fileName);
+    uint16_t NewFile(const String &fileName);
+    uint16_t AppendFile(const char *fileName);
+    uint16_t AppendFile(const String &fileName);
+    uint16_t AppendTextLine(const char *filePath, const char *textLine, size_t lineLength);
+    uint16_t AppendTextLine(const char *filePath, const char *textLine);
+    uint16_t AppendTextLine(const String &filePath, const String &textLine);
+    uint16_t AppendData(const char *filePath, const unsigned char *data, int dataLength, bool binary = false);
+    uint16_t QueueTextLine(const char *filePath, const char *textLine, size_t lineLength);
+    uint16_t QueueTextLine(const char *filePath, const char *textLine);
+    uint16_t QueueTextLine(const String &filePath, const String &textLine);
+    uint16_t AppendRecord(const char *filePath, uint64_t timestampMs, const float *values, uint8_t channels);
+    uint16_t QueueRecord(const char *filePath, uint64_t timestampMs, const float *values, uint8_t channels);
+    uint16_t FlushAppendBuffers(bool force = true);
+    void SetAppendThresholds(uint16_t maxLines, size_t maxBytes, unsigned long maxAgeMs);
+    size_t GetBufferedBytes();
+    uint16_t WriteData(const unsigned char *data, int dataLength);
+    uint16_t WriteData(const String &data);
     uint16_t CloseDataClient();
+    uint16_t BeginUpload(const char *fileName, bool append = false);
+    void SetCompression(bool enable);
+    bool isModeZSupported();
+    const FtpCompressionStats &GetCompressionStats() const { return compressionStats; }
+    int GetDataWriteSpace();
+    bool isDataConnected();
+    unsigned long DataTimeout();
     uint16_t GetCmdAnswer(char *result = NULL, int offsetStart = 0);
+    bool BatchCommand(const __FlashStringHelper *command, const char *argument, size_t argumentLength);
+    uint16_t SendBatch(uint16_t *responseCodes, uint8_t maxCodes);
     uint16_t GetLastModifiedTime(const char *fileName, char *result);
-    uint16_t RenameFile(String from, String to);
+    uint16_t GetLastModifiedTime(const char *fileName, uint32_t *modify);
+    uint16_t GetFileSize(const char *fileName, uint32_t *size);
+    uint16_t RenameFile(const char *from, const char *to);
+    uint16_t RenameFile(const String &from, const String &to);
     uint16_t Write(const char *str);
-    uint16_t ChangeWorkDir(String dir);
-    uint16_t DeleteFile(String file);
-    uint16_t MakeDir(String dir);
-    uint16_t MakeDirRecursive(String dir);
-    uint16_t RemoveDir(String dir);
+    uint16_t ChangeWorkDir(const char *dir);
+    uint16_t ChangeWorkDir(const String &dir);
+    uint16_t DeleteFile(const char *file);
+    uint16_t DeleteFile(const String &file);
+    uint16_t MakeDir(const char *dir);
+    uint16_t MakeDir(const String &dir);
+    uint16_t MakeDirRecursive(const char *dir, size_t length);
+    uint16_t MakeDirRecursive(const char *dir);
+    uint16_t MakeDirRecursive(const String &dir);
+    uint16_t RemoveDir(const char *dir);
+    uint16_t RemoveDir(const String &dir);
+    void SetLazyMakeDir(bool enable);
+    void ClearDirCache();
     uint16_t ContentList(const char *dir, String *list);
     uint16_t ContentListWithListCommand(const char *dir, String *list);
+    uint16_t ListDir(const char *dir, FtpListCallback callback, void *context, uint32_t *count = NULL);
+    static uint32_t ParseFtpTime(const char *value, size_t length);
+    uint16_t UploadStream(const char *fileName, FtpReadCallback reader, void *context,
+                          FtpTransferStats *stats = NULL, bool append = false);
     uint16_t DownloadString(const char *filename, String &str);
     uint16_t DownloadFile(const char *filename, unsigned char *buf, size_t length, bool printUART = false);
+    uint16_t DownloadStream(const char *fileName, FtpWriteCallback sink, void *context,
+                            uint32_t *offset = NULL, FtpTransferStats *stats = NULL);
+    uint16_t DownloadResume(const char *fileName, FtpWriteCallback sink, void *context,
+                            uint32_t *offset, uint8_t attempts = 3, FtpTransferStats *stats = NULL);
+
+    bool SubmitAppend(const char *filePath, const uint8_t *data, size_t length, FtpAsyncCallback callback = NULL, void *context = NULL);
+    bool SubmitMakeDir(const char *dir, FtpAsyncCallback callback = NULL, void *context = NULL);
+    bool SubmitDownload(const char *fileName, FtpWriteCallback sink, void *sinkContext, FtpAsyncCallback callback = NULL, void *context = NULL);
+    bool poll();
+    bool isBusy();
+    uint16_t GetAsyncResult();
+
+    const FtpClientMetrics &GetMetrics() const { return metrics; }
+    uint32_t GetSmoothedRtt() const { return srttMicros; }
+    void WriteMetrics(MetricsWriter &writer);
 };
 
+#if FTP_LOG_TOKENIZED
+// Build with -D FTP_LOG_TOKENIZED=1 to record log calls into FtpLog instead of printing them,
+// see M5_Ethernet_FtpLogFormat.hpp. The macros below keep the names and levels of the printing ones.
+#include "M5_Ethernet_FtpLog.hpp"
+
+// Arguments are stringified here, in the outer macros, because F("...") is expanded before it reaches FTP_LOG_n
+#define FTP_LOG_BEGIN(level)                                           \
+    if (_FTP_LOGLEVEL_ >= level)                                       \
+    {                                                                  \
+        constexpr uint32_t _ftpLogId = FtpLogHash(__FILE__, __LINE__); \
+        FtpLogEntry _ftpLogEntry(_ftpLogId, level);
+#define FTP_LOG_ARG(x, text) FtpLogArg(_ftpLogEntry, x, FtpLogIsLiteral(text, sizeof(text) - 1));
+#define FTP_LOG_END                 \
+        FtpLog.Write(_ftpLogEntry); \
+    }
+
+#define FTP_LOG_1(level, x, xt) FTP_LOG_BEGIN(level) FTP_LOG_ARG(x, xt) FTP_LOG_END
+#define FTP_LOG_2(level, x, xt, y, yt) FTP_LOG_BEGIN(level) FTP_LOG_ARG(x, xt) FTP_LOG_ARG(y, yt) FTP_LOG_END
+#define FTP_LOG_3(level, x, xt, y, yt, z, zt) \
+    FTP_LOG_BEGIN(level) FTP_LOG_ARG(x, xt) FTP_LOG_ARG(y, yt) FTP_LOG_ARG(z, zt) FTP_LOG_END
+#define FTP_LOG_4(level, x, xt, y, yt, z, zt, w, wt) \
+    FTP_LOG_BEGIN(level) FTP_LOG_ARG(x, xt) FTP_LOG_ARG(y, yt) FTP_LOG_ARG(z, zt) FTP_LOG_ARG(w, wt) FTP_LOG_END
+#define FTP_LOG_6(level, x, xt, y, yt, z, zt, w, wt, xx, xxt, yy, yyt)                                  \
+    FTP_LOG_BEGIN(level) FTP_LOG_ARG(x, xt) FTP_LOG_ARG(y, yt) FTP_LOG_ARG(z, zt) FTP_LOG_ARG(w, wt) \
+    FTP_LOG_ARG(xx, xxt) FTP_LOG_ARG(yy, yyt) FTP_LOG_END
+
+#define FTP_LOGERROR(x) FTP_LOG_1(1, x, #x)
+#define FTP_LOGERROR_LINE(x) FTP_LOG_1(1, x, #x)
+#define FTP_LOGERROR0(x) FTP_LOG_1(1, x, #x)
+#define FTP_LOGERROR1(x, y) FTP_LOG_2(1, x, #x, y, #y)
+#define FTP_LOGERROR2(x, y, z) FTP_LOG_3(1, x, #x, y, #y, z, #z)
+#define FTP_LOGERROR3(x, y, z, w) FTP_LOG_4(1, x, #x, y, #y, z, #z, w, #w)
+#define FTP_LOGERROR5(x, y, z, w, xx, yy) FTP_LOG_6(1, x, #x, y, #y, z, #z, w, #w, xx, #xx, yy, #yy)
+
+#define FTP_LOGWARN(x) FTP_LOG_1(2, x, #x)
+#define FTP_LOGWARN_LINE(x) FTP_LOG_1(2, x, #x)
+#define FTP_LOGWARN0(x) FTP_LOG_1(2, x, #x)
+#define FTP_LOGWARN1(x, y) FTP_LOG_2(2, x, #x, y, #y)
+#define FTP_LOGWARN2(x, y, z) FTP_LOG_3(2, x, #x, y, #y, z, #z)
+#define FTP_LOGWARN3(x, y, z, w) FTP_LOG_4(2, x, #x, y, #y, z, #z, w, #w)
+#define FTP_LOGWARN5(x, y, z, w, xx, yy) FTP_LOG_6(2, x, #x, y, #y, z, #z, w, #w, xx, #xx, yy, #yy)
+
+#define FTP_LOGINFO(x) FTP_LOG_1(3, x, #x)
+#define FTP_LOGINFO_LINE(x) FTP_LOG_1(3, x, #x)
+#define FTP_LOGINFO0(x) FTP_LOG_1(3, x, #x)
+#define FTP_LOGINFO1(x, y) FTP_LOG_2(3, x, #x, y, #y)
+#define FTP_LOGINFO2(x, y, z) FTP_LOG_3(3, x, #x, y, #y, z, #z)
+#define FTP_LOGINFO3(x, y, z, w) FTP_LOG_4(3, x, #x, y, #y, z, #z, w, #w)
+#define FTP_LOGINFO5(x, y, z, w, xx, yy) FTP_LOG_6(3, x, #x, y, #y, z, #z, w, #w, xx, #xx, yy, #yy)
+
+#define FTP_LOGDEBUG(x) FTP_LOG_1(4, x, #x)
+#define FTP_LOGDEBUG_LINE(x) FTP_LOG_1(4, x, #x)
+#define FTP_LOGDEBUG0m(x) FTP_LOG_1(4, x, #x)
+#define FTP_LOGDEBUG0(x) FTP_LOG_1(4, x, #x)
+#define FTP_LOGDEBUG1(x, y) FTP_LOG_2(4, x, #x, y, #y)
+#define FTP_LOGHEXDEBUG1(x, y) FTP_LOG_2(4, x, #x, y, #y)
+#define FTP_LOGDEBUG2(x, y, z) FTP_LOG_3(4, x, #x, y, #y, z, #z)
+#define FTP_LOGDEBUG3(x, y, z, w) FTP_LOG_4(4, x, #x, y, #y, z, #z, w, #w)
+#define FTP_LOGDEBUG5(x, y, z, w, xx, yy) FTP_LOG_6(4, x, #x, y, #y, z, #z, w, #w, xx, #xx, yy, #yy)
+
+#else
+
 #define FTP_DEBUG_OUTPUT M5.Lcd
 // #define FTP_DEBUG_OUTPUT      Serial
 
@@ -428,4 +813,6 @@ const char FTP_LINE[] = "========================================\n";
         FTP_PRINTLN(yy);                  \
     }
 
+#endif // FTP_LOG_TOKENIZED
+
 #endif
\ No newline at end of file
@@ -0,0 +1,177 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include "M5_Ethernet_FtpDeflate.hpp"
+
+#if FTP_DEFLATE_MINIZ
+#if CONFIG_IDF_TARGET_ESP32S3
+#include "esp32s3/rom/miniz.h"
+#else
+#include "rom/miniz.h"
+#endif
+#include "esp_heap_caps.h"
+#elif FTP_DEFLATE_ZLIB
+#include <zlib.h>
+#endif
+
+FtpDeflate::FtpDeflate()
+{
+  state = NULL;
+  isStarted = false;
+  memset(&stats, 0, sizeof(stats));
+}
+
+FtpDeflate::~FtpDeflate()
+{
+  Release();
+}
+
+bool FtpDeflate::isAvailable()
+{
+#if FTP_DEFLATE_MINIZ || FTP_DEFLATE_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Start a new zlib stream. Returns false when there is no compressor or no memory for it.
+ */
+bool FtpDeflate::Begin()
+{
+  memset(&stats, 0, sizeof(stats));
+  isStarted = false;
+
+#if FTP_DEFLATE_MINIZ
+  if (state == NULL)
+  {
+    state = heap_caps_malloc(sizeof(tdefl_compressor), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (state == NULL)
+      state = malloc(sizeof(tdefl_compressor));
+  }
+  if (state == NULL)
+    return false;
+
+  isStarted = tdefl_init((tdefl_compressor *)state, NULL, NULL, TDEFL_WRITE_ZLIB_HEADER | FTP_DEFLATE_PROBES) == TDEFL_STATUS_OKAY;
+#elif FTP_DEFLATE_ZLIB
+  if (state == NULL)
+    state = calloc(1, sizeof(z_stream));
+  else
+    deflateEnd((z_stream *)state);
+  if (state == NULL)
+    return false;
+
+  memset(state, 0, sizeof(z_stream));
+  isStarted = deflateInit((z_stream *)state, Z_BEST_SPEED) == Z_OK;
+#endif
+
+  return isStarted;
+}
+
+bool FtpDeflate::Write(const uint8_t *data, size_t length, FtpDeflateSink sink, void *context)
+{
+  return Run(data, length, false, sink, context);
+}
+
+/**
+ * @brief Flush what the compressor still holds and write the stream trailer.
+ */
+bool FtpDeflate::Finish(FtpDeflateSink sink, void *context)
+{
+  bool success = Run(NULL, 0, true, sink, context);
+  isStarted = false;
+  return success;
+}
+
+void FtpDeflate::Release()
+{
+#if FTP_DEFLATE_ZLIB
+  if (state != NULL)
+    deflateEnd((z_stream *)state);
+#endif
+  free(state);
+  state = NULL;
+  isStarted = false;
+}
+
+/////////////////////////////////////////////
+
+bool FtpDeflate::Run(const uint8_t *data, size_t length, bool finish, FtpDeflateSink sink, void *context)
+{
+  if (!isStarted)
+    return false;
+
+  stats.inputBytes += length;
+
+  while (true)
+  {
+    unsigned long startMicros = micros();
+    size_t outLength = sizeof(out);
+    bool isDone;
+
+#if FTP_DEFLATE_MINIZ
+    size_t inLength = length;
+    tdefl_status status = tdefl_compress((tdefl_compressor *)state, data, &inLength, out, &outLength,
+                                         finish ? TDEFL_FINISH : TDEFL_NO_FLUSH);
+    if (status < TDEFL_STATUS_OKAY)
+      return false;
+
+    data += inLength;
+    length -= inLength;
+    isDone = finish ? status == TDEFL_STATUS_DONE : length == 0 && outLength < sizeof(out);
+#elif FTP_DEFLATE_ZLIB
+    z_stream *stream = (z_stream *)state;
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = length;
+    stream->next_out = out;
+    stream->avail_out = sizeof(out);
+
+    int status = deflate(stream, finish ? Z_FINISH : Z_NO_FLUSH);
+    if (status == Z_STREAM_ERROR)
+      return false;
+
+    data = stream->next_in;
+    length = stream->avail_in;
+    outLength = sizeof(out) - stream->avail_out;
+    isDone = finish ? status == Z_STREAM_END : length == 0 && stream->avail_out > 0;
+#else
+    (void)finish;
+    return false;
+#endif
+
+    stats.cpuMicros += micros() - startMicros;
+
+    if (outLength > 0)
+    {
+      stats.outputBytes += outLength;
+      if (!sink(context, out, outLength))
+        return false;
+    }
+
+    if (isDone)
+      return true;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+
+#ifndef M5_Ethernet_FtpDeflate_H
+#define M5_Ethernet_FtpDeflate_H
+
+// The ESP32 ROM carries miniz' tdefl compressor, host builds can use zlib instead
+#if defined(ESP32)
+#define FTP_DEFLATE_MINIZ 1
+#elif defined(FTP_CLIENT_USING_ZLIB)
+#define FTP_DEFLATE_ZLIB 1
+#endif
+
+#define FTP_DEFLATE_OUT_SIZE 1024 // Compressed bytes collected before they are handed to the sink
+#define FTP_DEFLATE_PROBES 16     // tdefl match probes; low values keep the CPU cost down on text
+
+/// @brief Receives compressed data; return false to abort
+typedef bool (*FtpDeflateSink)(void *context, const uint8_t *data, size_t length);
+
+/// @brief Byte counts and CPU time of one compressed transfer
+struct FtpCompressionStats
+{
+  uint32_t inputBytes;
+  uint32_t outputBytes;
+  uint32_t cpuMicros; // Time spent inside the compressor, socket writes not included
+};
+
+/**
+ * @brief Streaming deflate with a zlib header (RFC 1950), the data format of FTP MODE Z.
+ *
+ * The compressor state is about 300 KB for tdefl, so it is allocated on first use, in PSRAM when
+ * there is some, and kept for later transfers.
+ */
+class FtpDeflate
+{
+private:
+  void *state;
+  bool isStarted;
+  uint8_t out[FTP_DEFLATE_OUT_SIZE];
+  FtpCompressionStats stats;
+
+  bool Run(const uint8_t *data, size_t length, bool finish, FtpDeflateSink sink, void *context);
+
+public:
+  FtpDeflate();
+  ~FtpDeflate();
+
+  static bool isAvailable();
+  bool Begin();
+  bool Write(const uint8_t *data, size_t length, FtpDeflateSink sink, void *context);
+  bool Finish(FtpDeflateSink sink, void *context);
+  void Release();
+  const FtpCompressionStats &GetStats() const { return stats; }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,250 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "M5_Ethernet_FtpLog.hpp"
+
+#if FTP_LOG_TOKENIZED
+FtpLogBuffer FtpLog; // Only builds that log through it pay for the ring
+#endif
+
+FtpLogEntry::FtpLogEntry(uint32_t id, uint8_t level)
+{
+  uint32_t now = millis();
+  data[0] = FTP_LOG_HEADER_SIZE;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    data[1 + i] = (uint8_t)(id >> (8 * i));
+    data[5 + i] = (uint8_t)(now >> (8 * i));
+  }
+  data[9] = level;
+  length = FTP_LOG_HEADER_SIZE;
+}
+
+void FtpLogEntry::AddUnsigned(uint64_t value)
+{
+  if (!Reserve(11))
+    return;
+  data[length++] = FTP_LOG_ARG_UINT;
+  length += FtpBinPutVarint(data + length, value);
+  data[0] = length;
+}
+
+void FtpLogEntry::AddSigned(int64_t value)
+{
+  if (!Reserve(11))
+    return;
+  data[length++] = FTP_LOG_ARG_INT;
+  length += FtpBinPutVarint(data + length, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+  data[0] = length;
+}
+
+void FtpLogEntry::AddChar(char c)
+{
+  if (!Reserve(2))
+    return;
+  data[length++] = FTP_LOG_ARG_CHAR;
+  data[length++] = c;
+  data[0] = length;
+}
+
+void FtpLogEntry::AddString(const char *str, size_t strLength)
+{
+  if (strLength > FTP_LOG_STRING_MAX)
+    strLength = FTP_LOG_STRING_MAX;
+  if (!Reserve(2 + strLength))
+    return;
+  data[length++] = FTP_LOG_ARG_STRING;
+  data[length++] = strLength;
+  memcpy(data + length, str, strLength);
+  length += strLength;
+  data[0] = length;
+}
+
+void FtpLogEntry::AddIP(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+{
+  if (!Reserve(5))
+    return;
+  data[length++] = FTP_LOG_ARG_IP;
+  data[length++] = a;
+  data[length++] = b;
+  data[length++] = c;
+  data[length++] = d;
+  data[0] = length;
+}
+
+void FtpLogEntry::AddFloat(float value)
+{
+  if (!Reserve(5))
+    return;
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  data[length++] = FTP_LOG_ARG_FLOAT;
+  for (uint8_t i = 0; i < 4; i++)
+    data[length++] = (uint8_t)(bits >> (8 * i));
+  data[0] = length;
+}
+
+/////////////////////////////////////////////
+
+FtpLogBuffer::FtpLogBuffer() : head(0), tail(0), droppedCount(0)
+{
+#ifdef ESP32
+  portMUX_INITIALIZE(&lock);
+#endif
+}
+
+void FtpLogBuffer::Lock()
+{
+#ifdef ESP32
+  portENTER_CRITICAL(&lock);
+#else
+  lock.lock();
+#endif
+}
+
+void FtpLogBuffer::Unlock()
+{
+#ifdef ESP32
+  portEXIT_CRITICAL(&lock);
+#else
+  lock.unlock();
+#endif
+}
+
+void FtpLogBuffer::CopyOut(uint32_t position, uint8_t *out, size_t length)
+{
+  size_t offset = position % FTP_LOG_BUFFER_SIZE;
+  size_t first = FTP_LOG_BUFFER_SIZE - offset;
+  if (first > length)
+    first = length;
+  memcpy(out, ring + offset, first);
+  memcpy(out + first, ring, length - first);
+}
+
+/**
+ * @brief Copy an entry into the ring, dropping the oldest entries when there is no room.
+ */
+void FtpLogBuffer::Write(const FtpLogEntry &entry)
+{
+  const uint8_t *data = entry.GetData();
+  uint8_t length = entry.GetLength();
+
+  Lock();
+  while (FTP_LOG_BUFFER_SIZE - (head - tail) < length)
+  {
+    tail += ring[tail % FTP_LOG_BUFFER_SIZE];
+    droppedCount++;
+  }
+
+  size_t offset = head % FTP_LOG_BUFFER_SIZE;
+  size_t first = FTP_LOG_BUFFER_SIZE - offset;
+  if (first > length)
+    first = length;
+  memcpy(ring + offset, data, first);
+  memcpy(ring, data + first, length - first);
+  head += length;
+  Unlock();
+}
+
+/**
+ * @brief Move the oldest entry to out; 0 when the ring is empty or the entry does not fit into size.
+ */
+size_t FtpLogBuffer::TakeEntry(uint8_t *out, size_t size)
+{
+  size_t length = 0;
+  Lock();
+  if (head != tail)
+  {
+    length = ring[tail % FTP_LOG_BUFFER_SIZE];
+    if (length <= size)
+    {
+      CopyOut(tail, out, length);
+      tail += length;
+    }
+    else
+      length = 0;
+  }
+  Unlock();
+  return length;
+}
+
+/**
+ * @brief Move whole entries to buffer, oldest first, in the format of M5_Ethernet_FtpLogFormat.hpp.
+ *
+ * @return bytes written to buffer
+ */
+size_t FtpLogBuffer::Read(uint8_t *buffer, size_t size)
+{
+  size_t total = 0;
+  size_t length;
+  while ((length = TakeEntry(buffer + total, size - total)) > 0)
+    total += length;
+  return total;
+}
+
+/**
+ * @brief Print entries as "FTPLOG <hex>" lines, the input tools/ftp_log_decode.cpp reads from a Serial capture.
+ *
+ * Stops when the ring is empty or maxBytes of entries have been taken, so writers on another task can not
+ * keep the caller here. The ring lock is only held while an entry is copied out, not while it is printed.
+ *
+ * @return number of entries printed
+ */
+uint16_t FtpLogBuffer::Dump(Print &out, size_t maxBytes)
+{
+  static const char digits[] = "0123456789abcdef";
+  uint8_t entry[FTP_LOG_ENTRY_MAX];
+  char line[7 + 2 * FTP_LOG_ENTRY_MAX + 1];
+
+  uint16_t count = 0;
+  size_t taken = 0;
+  size_t length;
+  while (taken < maxBytes && (length = TakeEntry(entry, sizeof(entry))) > 0)
+  {
+    memcpy(line, "FTPLOG ", 7);
+    for (size_t i = 0; i < length; i++)
+    {
+      line[7 + 2 * i] = digits[entry[i] >> 4];
+      line[8 + 2 * i] = digits[entry[i] & 0x0F];
+    }
+    line[7 + 2 * length] = 0;
+    out.println(line);
+    taken += length;
+    count++;
+  }
+  return count;
+}
+
+uint32_t FtpLogBuffer::GetUsedBytes()
+{
+  Lock();
+  uint32_t used = head - tail;
+  Unlock();
+  return used;
+}
+
+uint32_t FtpLogBuffer::GetDroppedCount()
+{
+  return droppedCount;
+}
\ No newline at end of file
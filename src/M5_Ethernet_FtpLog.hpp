@@ -0,0 +1,125 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include "M5_Ethernet_FtpLogFormat.hpp"
+
+#ifndef ESP32
+#include <mutex>
+#endif
+
+#ifndef M5_Ethernet_FtpLog_H
+#define M5_Ethernet_FtpLog_H
+
+#ifndef FTP_LOG_BUFFER_SIZE
+#define FTP_LOG_BUFFER_SIZE 8192 // RAM ring for log entries; the oldest are dropped when it is full
+#endif
+
+/// @brief One log entry being assembled on the caller's stack
+class FtpLogEntry
+{
+private:
+  uint8_t data[FTP_LOG_ENTRY_MAX];
+  uint8_t length;
+
+  bool Reserve(size_t size) { return length + size <= FTP_LOG_ENTRY_MAX; }
+
+public:
+  FtpLogEntry(uint32_t id, uint8_t level);
+
+  void AddUnsigned(uint64_t value);
+  void AddSigned(int64_t value);
+  void AddChar(char c);
+  void AddString(const char *str, size_t strLength);
+  void AddIP(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+  void AddFloat(float value);
+
+  const uint8_t *GetData() const { return data; }
+  uint8_t GetLength() const { return length; }
+};
+
+// Argument encoders, picked by type. Literal arguments are in the sources and are not recorded.
+
+inline void FtpLogArg(FtpLogEntry &entry, const char *value, bool literal)
+{
+  if (literal)
+    return;
+  size_t length = 0;
+  while (length < FTP_LOG_STRING_MAX && value[length] != 0)
+    length++;
+  entry.AddString(value, length);
+}
+inline void FtpLogArg(FtpLogEntry &entry, const __FlashStringHelper *value, bool literal)
+{
+  FtpLogArg(entry, reinterpret_cast<const char *>(value), literal);
+}
+inline void FtpLogArg(FtpLogEntry &entry, const String &value, bool) { entry.AddString(value.c_str(), value.length()); }
+inline void FtpLogArg(FtpLogEntry &entry, char value, bool) { entry.AddChar(value); }
+inline void FtpLogArg(FtpLogEntry &entry, int value, bool) { entry.AddSigned(value); }
+inline void FtpLogArg(FtpLogEntry &entry, long value, bool) { entry.AddSigned(value); }
+inline void FtpLogArg(FtpLogEntry &entry, long long value, bool) { entry.AddSigned(value); }
+inline void FtpLogArg(FtpLogEntry &entry, unsigned int value, bool) { entry.AddUnsigned(value); }
+inline void FtpLogArg(FtpLogEntry &entry, unsigned long value, bool) { entry.AddUnsigned(value); }
+inline void FtpLogArg(FtpLogEntry &entry, unsigned long long value, bool) { entry.AddUnsigned(value); }
+inline void FtpLogArg(FtpLogEntry &entry, double value, bool) { entry.AddFloat((float)value); }
+inline void FtpLogArg(FtpLogEntry &entry, const IPAddress &value, bool) { entry.AddIP(value[0], value[1], value[2], value[3]); }
+
+/**
+ * @brief RAM ring of tokenized log entries, filled by the FTP_LOG* macros and drained elsewhere.
+ *
+ * Write() only copies the entry under a short lock and never waits for an output device, so logging
+ * at debug level does not change the timing of the network code. Entries are read with Read() (raw,
+ * e.g. for an HTTP response) or Dump() (hex lines for Serial); each entry is handed out once.
+ */
+class FtpLogBuffer
+{
+private:
+  uint8_t ring[FTP_LOG_BUFFER_SIZE];
+  uint32_t head; // Bytes ever written, the write position is head % FTP_LOG_BUFFER_SIZE
+  uint32_t tail; // Bytes ever read or dropped
+  uint32_t droppedCount;
+#ifdef ESP32
+  portMUX_TYPE lock;
+#else
+  std::mutex lock;
+#endif
+
+  void Lock();
+  void Unlock();
+  void CopyOut(uint32_t position, uint8_t *out, size_t length);
+  size_t TakeEntry(uint8_t *out, size_t size);
+
+public:
+  FtpLogBuffer();
+
+  void Write(const FtpLogEntry &entry);
+  size_t Read(uint8_t *buffer, size_t size);
+  uint16_t Dump(Print &out, size_t maxBytes);
+  uint32_t GetUsedBytes();
+  uint32_t GetDroppedCount();
+};
+
+extern FtpLogBuffer FtpLog;
+
+#endif
\ No newline at end of file
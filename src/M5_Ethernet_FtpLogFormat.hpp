@@ -0,0 +1,108 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "M5_Ethernet_FtpRecordFormat.hpp"
+
+#ifndef M5_Ethernet_FtpLogFormat_H
+#define M5_Ethernet_FtpLogFormat_H
+
+/*
+Tokenized log entries, written by the FTP_LOG* macros when FTP_LOG_TOKENIZED is set and read by
+tools/ftp_log_decode.cpp.
+
+The format strings are not stored. Each call site is identified by FtpLogHash() of its file name and
+line, and the decoder finds the call in the sources. Literal arguments ("..." or F("...")) are taken
+from the source as well; only the other arguments are recorded.
+
+  offset  size  field
+  0       1     entry length, this byte included
+  1       4     call site id (LE)
+  5       4     millis() (LE)
+  9       1     level, 1 error .. 4 debug
+  10      ...   arguments, each a type byte and its value
+
+  FTP_LOG_ARG_UINT    varint
+  FTP_LOG_ARG_INT     varint of zigzag(value)
+  FTP_LOG_ARG_CHAR    1 byte
+  FTP_LOG_ARG_STRING  1 byte length, then the characters (cut at FTP_LOG_STRING_MAX)
+  FTP_LOG_ARG_IP      4 bytes
+  FTP_LOG_ARG_FLOAT   float32 (LE)
+*/
+
+#define FTP_LOG_ENTRY_MAX 255
+#define FTP_LOG_HEADER_SIZE 10
+#define FTP_LOG_STRING_MAX 64
+
+#define FTP_LOG_ARG_UINT 1
+#define FTP_LOG_ARG_INT 2
+#define FTP_LOG_ARG_CHAR 3
+#define FTP_LOG_ARG_STRING 4
+#define FTP_LOG_ARG_IP 5
+#define FTP_LOG_ARG_FLOAT 6
+
+#define FTP_LOG_FNV_OFFSET 2166136261UL
+#define FTP_LOG_FNV_PRIME 16777619UL
+
+// Written as single-return recursions so they stay constexpr under C++11
+
+constexpr const char *FtpLogBaseName(const char *path, const char *base)
+{
+  return *path == 0 ? base : FtpLogBaseName(path + 1, (*path == '/' || *path == '\\') ? path + 1 : base);
+}
+
+constexpr uint32_t FtpLogFnv(uint32_t hash, uint8_t byte)
+{
+  return (uint32_t)((hash ^ byte) * FTP_LOG_FNV_PRIME);
+}
+
+constexpr uint32_t FtpLogFnvString(uint32_t hash, const char *str)
+{
+  return *str == 0 ? hash : FtpLogFnvString(FtpLogFnv(hash, (uint8_t)*str), str + 1);
+}
+
+/// @brief Call site id: FNV-1a over the file name without directories, then the line as 4 bytes LE
+constexpr uint32_t FtpLogHash(const char *file, uint32_t line)
+{
+  return FtpLogFnv(FtpLogFnv(FtpLogFnv(FtpLogFnv(FtpLogFnvString(FTP_LOG_FNV_OFFSET, FtpLogBaseName(file, file)),
+                                                 line & 0xFF),
+                                       (line >> 8) & 0xFF),
+                             (line >> 16) & 0xFF),
+                   line >> 24);
+}
+
+/// @brief True for an argument spelled as a string literal or F("..."), judged from its source text
+constexpr bool FtpLogIsLiteral(const char *text, size_t length)
+{
+  return length >= 2 && ((text[0] == '"' && text[length - 1] == '"') ||
+                         (length >= 5 && text[0] == 'F' && text[1] == '(' && text[2] == '"' && text[length - 2] == '"' && text[length - 1] == ')'));
+}
+
+static inline uint32_t FtpLogGetLE32(const uint8_t *in)
+{
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,260 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include "M5_Ethernet_FtpPool.hpp"
+
+/**
+ * @brief clients are owned by the caller; at most FTP_POOL_MAX_SESSIONS of them are used.
+ */
+M5_Ethernet_FtpPool::M5_Ethernet_FtpPool(M5_Ethernet_FtpClient **clients, uint8_t count)
+{
+  sessionCount = count < FTP_POOL_MAX_SESSIONS ? count : FTP_POOL_MAX_SESSIONS;
+  for (uint8_t i = 0; i < sessionCount; i++)
+  {
+    sessions[i].client = clients[i];
+    sessions[i].isBusy = false;
+  }
+
+  queueHead = 0;
+  queueCount = 0;
+  doneCallback = NULL;
+  failedCount = 0;
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Log in every session. Returns the first error, sessions that did connect stay usable.
+ */
+uint16_t M5_Ethernet_FtpPool::Open()
+{
+  uint16_t result = FTP_RESCODE_ACTION_SUCCESS;
+  for (uint8_t i = 0; i < sessionCount; i++)
+  {
+    uint16_t responseCode = sessions[i].client->EnsureSession();
+    if (sessions[i].client->isErrorCode(responseCode))
+    {
+      FTP_LOGERROR1("Pool: Session failed to open: ", i);
+      result = responseCode;
+    }
+  }
+  return result;
+}
+
+void M5_Ethernet_FtpPool::Close()
+{
+  for (uint8_t i = 0; i < sessionCount; i++)
+    sessions[i].client->CloseConnection();
+}
+
+/**
+ * @brief Add an upload to the work queue; reader and context are used as in UploadStream().
+ */
+bool M5_Ethernet_FtpPool::Enqueue(const char *fileName, FtpReadCallback reader, void *context, bool append)
+{
+  if (queueCount >= FTP_POOL_QUEUE_SIZE || strlen(fileName) >= FTP_PATH_MAX)
+    return false;
+
+  FtpPoolJob *job = &queue[(queueHead + queueCount) % FTP_POOL_QUEUE_SIZE];
+  strcpy(job->fileName, fileName);
+  job->reader = reader;
+  job->context = context;
+  job->append = append;
+  queueCount++;
+
+  return true;
+}
+
+/**
+ * @brief Work through the queue until every upload has finished.
+ *
+ * @param stats receives the bytes sent by all sessions together and the combined throughput, may be NULL
+ * @return FTP_RESCODE_ACTION_SUCCESS or the last error; GetFailedCount() tells how many uploads failed
+ */
+uint16_t M5_Ethernet_FtpPool::Run(FtpTransferStats *stats)
+{
+  uint16_t result = FTP_RESCODE_ACTION_SUCCESS;
+  unsigned long startMillis = millis();
+  uint32_t totalBytes = 0;
+
+  while (true)
+  {
+    bool isActive = false;
+    bool progressed = false;
+
+    for (uint8_t i = 0; i < sessionCount; i++)
+    {
+      FtpPoolSession *session = &sessions[i];
+      if (!session->isBusy)
+      {
+        if (queueCount == 0)
+          continue;
+
+        uint16_t responseCode = StartJob(session);
+        if (session->client->isErrorCode(responseCode))
+          result = responseCode;
+        progressed = true;
+      }
+      else
+      {
+        uint16_t responseCode = StepJob(session, &totalBytes, &progressed);
+        if (session->client->isErrorCode(responseCode))
+          result = responseCode;
+      }
+
+      isActive |= session->isBusy;
+    }
+
+    if (!isActive && queueCount == 0)
+      break;
+
+    // Every TX window is full, give the W5500 time to get ACKs back
+    if (!progressed)
+      delay(1);
+  }
+
+  if (stats != NULL)
+  {
+    stats->bytes = totalBytes;
+    stats->elapsedMs = millis() - startMillis;
+    stats->bytesPerSecond = stats->elapsedMs > 0 ? (uint32_t)((uint64_t)totalBytes * 1000 / stats->elapsedMs) : totalBytes;
+    FTP_LOGINFO3("Pool upload bytes =", stats->bytes, ", bytes/sec =", stats->bytesPerSecond);
+  }
+
+  return result;
+}
+
+/////////////////////////////////////////////
+
+void M5_Ethernet_FtpPool::SetDoneCallback(FtpPoolDoneCallback callback)
+{
+  doneCallback = callback;
+}
+
+uint8_t M5_Ethernet_FtpPool::GetSessionCount()
+{
+  return sessionCount;
+}
+
+uint8_t M5_Ethernet_FtpPool::GetQueuedCount()
+{
+  return queueCount;
+}
+
+uint32_t M5_Ethernet_FtpPool::GetFailedCount()
+{
+  return failedCount;
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Take the next job from the queue and open its data connection on session.
+ */
+uint16_t M5_Ethernet_FtpPool::StartJob(FtpPoolSession *session)
+{
+  session->job = queue[queueHead];
+  queueHead = (queueHead + 1) % FTP_POOL_QUEUE_SIZE;
+  queueCount--;
+
+  M5_Ethernet_FtpClient *client = session->client;
+  uint16_t responseCode = client->EnsureSession();
+  if (!client->isErrorCode(responseCode))
+    responseCode = client->BeginUpload(session->job.fileName, session->job.append);
+
+  if (client->isErrorCode(responseCode))
+  {
+    FinishJob(session, responseCode);
+    return responseCode;
+  }
+
+  session->isBusy = true;
+  session->progressMillis = millis();
+  return responseCode;
+}
+
+/**
+ * @brief Write the next span of the session's upload, or finish it when the reader is done.
+ *
+ * Nothing is read while the data socket has no room, so a slow connection does not hold up the others.
+ * A socket that stays full, because the peer stopped ACKing or reset the connection (the W5500 then
+ * reports no room either), fails the upload after DataTimeout() like WriteClientBuffered() does.
+ */
+uint16_t M5_Ethernet_FtpPool::StepJob(FtpPoolSession *session, uint32_t *bytes, bool *progressed)
+{
+  M5_Ethernet_FtpClient *client = session->client;
+  if (client->GetDataWriteSpace() <= 0)
+  {
+    if (client->isDataConnected() && millis() - session->progressMillis < client->DataTimeout())
+      return FTP_RESCODE_ACTION_SUCCESS;
+
+    FTP_LOGERROR1("Pool: Data connection stalled: ", session->job.fileName);
+    client->CloseDataClient();
+    FinishJob(session, FTP_RESCODE_DATA_CONNECTION_ERROR);
+    return FTP_RESCODE_DATA_CONNECTION_ERROR;
+  }
+
+  *progressed = true;
+
+  const uint8_t *span = NULL;
+  int spanLength = session->job.reader(session->job.context, &span);
+  if (spanLength == 0)
+  {
+    uint16_t responseCode = client->CloseDataClient();
+    FinishJob(session, responseCode);
+    return responseCode;
+  }
+
+  uint16_t responseCode = FTP_RESCODE_DATA_CONNECTION_ERROR;
+  if (spanLength > 0)
+    responseCode = client->WriteData(span, spanLength);
+  else
+    FTP_LOGERROR("Pool: Reader error");
+
+  if (client->isErrorCode(responseCode))
+  {
+    // Read the reply the server sends for the aborted transfer
+    client->CloseDataClient();
+    FinishJob(session, responseCode);
+    return responseCode;
+  }
+
+  *bytes += spanLength;
+  session->progressMillis = millis();
+  return responseCode;
+}
+
+void M5_Ethernet_FtpPool::FinishJob(FtpPoolSession *session, uint16_t responseCode)
+{
+  session->isBusy = false;
+  if (session->client->isErrorCode(responseCode))
+  {
+    FTP_LOGERROR1("Pool: Upload failed: ", session->job.fileName);
+    failedCount++;
+  }
+
+  if (doneCallback != NULL)
+    doneCallback(session->job.context, session->job.fileName, responseCode);
+}
\ No newline at end of file
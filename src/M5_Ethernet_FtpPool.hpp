@@ -0,0 +1,96 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include "M5_Ethernet_FtpClient.hpp"
+
+#ifndef M5_Ethernet_FtpPool_H
+#define M5_Ethernet_FtpPool_H
+
+// Each session takes two of the W5500's MAX_SOCK_NUM (8) sockets, the HTTP server and NTP need one each
+#define FTP_POOL_MAX_SESSIONS 3
+#define FTP_POOL_QUEUE_SIZE 16
+
+/**
+ * @brief Called when a pooled upload has finished, responseCode is the transfer completion reply.
+ */
+typedef void (*FtpPoolDoneCallback)(void *context, const char *fileName, uint16_t responseCode);
+
+struct FtpPoolJob
+{
+  char fileName[FTP_PATH_MAX];
+  FtpReadCallback reader;
+  void *context;
+  bool append;
+};
+
+struct FtpPoolSession
+{
+  M5_Ethernet_FtpClient *client;
+  FtpPoolJob job;
+  bool isBusy;
+  unsigned long progressMillis; // Last time the upload got data into its socket
+};
+
+/**
+ * @brief Spread independent file uploads over several logged-in sessions.
+ *
+ * Run() starts one upload per session and then hands the next span of every running upload to its
+ * data socket in turn, skipping sockets whose TX window is full. While one socket waits for its ACKs
+ * the W5500 keeps sending on the others, so round trips overlap instead of adding up.
+ * Readers should hand out spans no larger than the socket TX buffer (2 KB by default) for this to work.
+ * An upload whose socket takes nothing for the client's DataTimeout() fails with FTP_RESCODE_DATA_CONNECTION_ERROR.
+ */
+class M5_Ethernet_FtpPool
+{
+private:
+  FtpPoolSession sessions[FTP_POOL_MAX_SESSIONS];
+  uint8_t sessionCount;
+
+  FtpPoolJob queue[FTP_POOL_QUEUE_SIZE];
+  uint8_t queueHead;
+  uint8_t queueCount;
+
+  FtpPoolDoneCallback doneCallback;
+  uint32_t failedCount;
+
+  uint16_t StartJob(FtpPoolSession *session);
+  uint16_t StepJob(FtpPoolSession *session, uint32_t *bytes, bool *progressed);
+  void FinishJob(FtpPoolSession *session, uint16_t responseCode);
+
+public:
+  M5_Ethernet_FtpPool(M5_Ethernet_FtpClient **clients, uint8_t count);
+
+  uint16_t Open();
+  void Close();
+  bool Enqueue(const char *fileName, FtpReadCallback reader, void *context, bool append = false);
+  uint16_t Run(FtpTransferStats *stats = NULL);
+
+  void SetDoneCallback(FtpPoolDoneCallback callback);
+  uint8_t GetSessionCount();
+  uint8_t GetQueuedCount();
+  uint32_t GetFailedCount();
+};
+
+#endif
\ No newline at end of file
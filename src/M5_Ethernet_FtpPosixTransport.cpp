@@ -0,0 +1,222 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <Arduino.h>
+#include "M5_Ethernet_FtpPosixTransport.hpp"
+
+#if FTP_TRANSPORT_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+FtpPosixTransport::FtpPosixTransport() : fd(-1), peerClosed(false)
+{
+}
+
+FtpPosixTransport::~FtpPosixTransport()
+{
+  Stop();
+}
+
+bool FtpPosixTransport::ConnectAddress(const void *address, unsigned int length, int family, uint16_t timeoutMs)
+{
+  Stop();
+
+  fd = socket(family, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE
+  int noSigPipe = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+
+  int result = ::connect(fd, (const struct sockaddr *)address, length);
+  if (result < 0 && errno == EINPROGRESS)
+  {
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    if (poll(&pfd, 1, timeoutMs) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error == 0)
+      result = 0;
+  }
+
+  if (result < 0)
+  {
+    Stop();
+    return false;
+  }
+
+  // Commands and small blocks go out at once, as they do on the W5500
+  int noDelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  return true;
+}
+
+bool FtpPosixTransport::Connect(const char *host, uint16_t port, uint16_t timeoutMs)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *info = NULL;
+  if (getaddrinfo(host, NULL, &hints, &info) != 0 || info == NULL)
+    return false;
+
+  struct sockaddr_in address;
+  memcpy(&address, info->ai_addr, sizeof(address));
+  freeaddrinfo(info);
+  address.sin_port = htons(port);
+  return ConnectAddress(&address, sizeof(address), AF_INET, timeoutMs);
+}
+
+bool FtpPosixTransport::Connect(IPAddress ip, uint16_t port, uint16_t timeoutMs)
+{
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = (uint32_t)ip;
+  return ConnectAddress(&address, sizeof(address), AF_INET, timeoutMs);
+}
+
+bool FtpPosixTransport::isConnected()
+{
+  if (fd < 0)
+    return false;
+  return Pending() > 0 || !peerClosed;
+}
+
+void FtpPosixTransport::Stop()
+{
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+  peerClosed = false;
+}
+
+int FtpPosixTransport::Available()
+{
+  return Pending();
+}
+
+/**
+ * @brief Bytes waiting in the receive buffer; notices a closed peer on the way.
+ */
+int FtpPosixTransport::Pending()
+{
+  if (fd < 0)
+    return 0;
+
+  int count = 0;
+  if (ioctl(fd, FIONREAD, &count) < 0)
+    return 0;
+
+  if (count == 0 && !peerClosed)
+  {
+    // A zero-byte peek means the server has closed its side
+    char c;
+    ssize_t result = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+      peerClosed = true;
+  }
+
+  return count;
+}
+
+int FtpPosixTransport::Read(uint8_t *buffer, size_t size)
+{
+  if (fd < 0 || size == 0)
+    return -1;
+
+  ssize_t result = recv(fd, buffer, size, MSG_DONTWAIT);
+  if (result == 0)
+    peerClosed = true;
+  return result > 0 ? (int)result : -1;
+}
+
+/**
+ * @brief Free space in the kernel's send buffer, 0 while it is full.
+ */
+int FtpPosixTransport::AvailableForWrite()
+{
+  if (fd < 0)
+    return 0;
+
+#ifdef __linux__
+  int queued = 0;
+  int bufferSize = 0;
+  socklen_t length = sizeof(bufferSize);
+  if (ioctl(fd, SIOCOUTQ, &queued) == 0 && getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, &length) == 0)
+  {
+    int space = bufferSize / 2 - queued; // The kernel reports twice the usable size, the rest is bookkeeping
+    return space > 0 ? space : 0;
+  }
+#endif
+  return FTP_POSIX_WRITE_SPACE;
+}
+
+/**
+ * @brief Queue as much as the send buffer takes without blocking, 0 when it is full or the socket failed.
+ */
+size_t FtpPosixTransport::Write(const uint8_t *buffer, size_t size)
+{
+  if (fd < 0)
+    return 0;
+
+  ssize_t result;
+  do
+    result = send(fd, buffer, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+  while (result < 0 && errno == EINTR);
+  return result > 0 ? (size_t)result : 0;
+}
+
+IPAddress FtpPosixTransport::RemoteIP()
+{
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  if (fd < 0 || getpeername(fd, (struct sockaddr *)&address, &length) != 0)
+    return IPAddress();
+  return IPAddress((uint32_t)address.sin_addr.s_addr);
+}
+
+#endif
\ No newline at end of file
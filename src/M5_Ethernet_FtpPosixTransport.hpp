@@ -0,0 +1,67 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <Arduino.h>
+#include "M5_Ethernet_FtpTransport.hpp"
+
+#ifndef M5_Ethernet_FtpPosixTransport_H
+#define M5_Ethernet_FtpPosixTransport_H
+
+// BSD sockets of the host, for running the client on a Linux (or macOS) machine
+#if defined(__linux__) || defined(__APPLE__)
+#define FTP_TRANSPORT_POSIX 1
+
+#define FTP_POSIX_WRITE_SPACE 65536 // AvailableForWrite() where the free send buffer cannot be queried
+
+/**
+ * @brief TCP socket of the host's network stack, non-blocking after connect, Nagle off.
+ *
+ * Unlike the W5500 there is no 2 KB socket memory behind it, reads and writes take as much as the kernel
+ * buffers hold.
+ */
+class FtpPosixTransport : public FtpTransport
+{
+private:
+  int fd;
+  bool peerClosed;
+
+  bool ConnectAddress(const void *address, unsigned int length, int family, uint16_t timeoutMs);
+  int Pending();
+
+public:
+  FtpPosixTransport();
+  ~FtpPosixTransport();
+
+  bool Connect(const char *host, uint16_t port, uint16_t timeoutMs);
+  bool Connect(IPAddress address, uint16_t port, uint16_t timeoutMs);
+  bool isConnected();
+  void Stop();
+  int Available();
+  int Read(uint8_t *buffer, size_t size);
+  int AvailableForWrite();
+  size_t Write(const uint8_t *buffer, size_t size);
+  IPAddress RemoteIP();
+};
+
+#endif
+#endif
\ No newline at end of file
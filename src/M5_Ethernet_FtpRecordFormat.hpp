@@ -0,0 +1,195 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef M5_Ethernet_FtpRecordFormat_H
+#define M5_Ethernet_FtpRecordFormat_H
+
+/*
+Binary record files, written by QueueRecord()/AppendRecord() and read by tools/ftp_record_decode.cpp.
+
+A file is a sequence of blocks; every block starts with a sync header that carries absolute values,
+so a block can be decoded without the ones before it and a damaged block is skipped by searching
+for the next magic.
+
+  offset  size  field
+  0       4     magic F5 'F' 'R' 'B'
+  4       1     version (1)
+  5       1     channel count (1 .. FTP_BIN_MAX_CHANNELS)
+  6       2     record count in this block, including the first one (LE)
+  8       8     timestamp of the first record, ms since 1970 (LE)
+  16      4*n   values of the first record, float32 (LE)
+
+Each further record of the block is
+  varint  zigzag(timestamp - previous timestamp)
+  varint  bits(value) XOR bits(previous value), once per channel
+*/
+
+#define FTP_BIN_VERSION 1
+#define FTP_BIN_MAX_CHANNELS 16
+#define FTP_BIN_HEADER_SIZE(channels) (16 + 4 * (channels))
+#define FTP_BIN_RECORD_MAX(channels) (10 + 5 * (channels)) // Longest delta record
+
+static const uint8_t FTP_BIN_MAGIC[4] = {0xF5, 'F', 'R', 'B'};
+
+static inline size_t FtpBinPutVarint(uint8_t *out, uint64_t value)
+{
+  size_t length = 0;
+  while (value >= 0x80)
+  {
+    out[length++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+static inline bool FtpBinGetVarint(const uint8_t **in, const uint8_t *end, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (uint8_t shift = 0; shift < 64 && *in < end; shift += 7)
+  {
+    uint8_t byte = *(*in)++;
+    result |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline uint64_t FtpBinZigZag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t FtpBinUnZigZag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint32_t FtpBinFloatBits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static inline float FtpBinBitsFloat(uint32_t bits)
+{
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static inline void FtpBinPutLE(uint8_t *out, uint64_t value, uint8_t size)
+{
+  for (uint8_t i = 0; i < size; i++)
+    out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint64_t FtpBinGetLE(const uint8_t *in, uint8_t size)
+{
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < size; i++)
+    value |= (uint64_t)in[i] << (8 * i);
+  return value;
+}
+
+/**
+ * @brief Write a sync header holding one record; bits receives the raw value bits for the next delta.
+ */
+static inline size_t FtpBinWriteHeader(uint8_t *out, uint64_t timestampMs, const float *values, uint8_t channels, uint32_t *bits)
+{
+  memcpy(out, FTP_BIN_MAGIC, sizeof(FTP_BIN_MAGIC));
+  out[4] = FTP_BIN_VERSION;
+  out[5] = channels;
+  FtpBinPutLE(out + 6, 1, 2);
+  FtpBinPutLE(out + 8, timestampMs, 8);
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    bits[i] = FtpBinFloatBits(values[i]);
+    FtpBinPutLE(out + 16 + 4 * i, bits[i], 4);
+  }
+  return FTP_BIN_HEADER_SIZE(channels);
+}
+
+/**
+ * @brief Write one delta record against the previous one and update bits.
+ */
+static inline size_t FtpBinWriteDelta(uint8_t *out, int64_t deltaMs, const float *values, uint8_t channels, uint32_t *bits)
+{
+  size_t length = FtpBinPutVarint(out, FtpBinZigZag(deltaMs));
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    uint32_t valueBits = FtpBinFloatBits(values[i]);
+    length += FtpBinPutVarint(out + length, valueBits ^ bits[i]);
+    bits[i] = valueBits;
+  }
+  return length;
+}
+
+/**
+ * @brief Read the sync header at in; returns its record count, or 0 when the header is damaged or cut off.
+ */
+static inline uint16_t FtpBinReadHeader(const uint8_t *in, const uint8_t *end, uint8_t *channels, uint64_t *timestampMs, uint32_t *bits)
+{
+  if (end - in < FTP_BIN_HEADER_SIZE(1) || memcmp(in, FTP_BIN_MAGIC, sizeof(FTP_BIN_MAGIC)) != 0 || in[4] != FTP_BIN_VERSION)
+    return 0;
+
+  *channels = in[5];
+  if (*channels == 0 || *channels > FTP_BIN_MAX_CHANNELS || end - in < FTP_BIN_HEADER_SIZE(*channels))
+    return 0;
+
+  *timestampMs = FtpBinGetLE(in + 8, 8);
+  for (uint8_t i = 0; i < *channels; i++)
+    bits[i] = FtpBinGetLE(in + 16 + 4 * i, 4);
+  return FtpBinGetLE(in + 6, 2);
+}
+
+/**
+ * @brief Read one delta record and apply it to timestampMs and bits; false when it is cut off.
+ */
+static inline bool FtpBinReadDelta(const uint8_t **in, const uint8_t *end, uint8_t channels, uint64_t *timestampMs, uint32_t *bits)
+{
+  uint64_t value;
+  if (!FtpBinGetVarint(in, end, &value))
+    return false;
+  *timestampMs += FtpBinUnZigZag(value);
+
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    if (!FtpBinGetVarint(in, end, &value))
+      return false;
+    bits[i] ^= (uint32_t)value;
+  }
+  return true;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,521 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "M5_Ethernet_FtpSpool.hpp"
+
+M5_Ethernet_FtpSpool::M5_Ethernet_FtpSpool(const char *_baseDir, uint32_t _segmentSize, uint16_t _maxSegments)
+{
+  strncpy(baseDir, _baseDir, FTP_SPOOL_DIR_MAX - 1);
+  baseDir[FTP_SPOOL_DIR_MAX - 1] = '\0';
+  segmentSize = _segmentSize;
+  maxSegments = _maxSegments > 1 ? _maxSegments : 2;
+
+  readSegment = 1;
+  readOffset = 0;
+  writeSegment = 1;
+  writeOffset = 0;
+  replayPending = false;
+  pendingSegment = 0;
+  pendingOffset = 0;
+  pendingBytes = 0;
+  droppedSegments = 0;
+  droppedRecords = 0;
+  ready = false;
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Open the spool directory and restore the read cursor and write position.
+ *
+ * The file system (LittleFS, SD) has to be mounted before. A segment that ends in a torn record
+ * (power loss during Write) is closed and writing continues in a new segment.
+ */
+bool M5_Ethernet_FtpSpool::Begin()
+{
+  mkdir(baseDir, 0777);
+
+  DIR *dir = opendir(baseDir);
+  if (dir == NULL)
+  {
+    FTP_LOGERROR1("Spool: Can not open ", baseDir);
+    return false;
+  }
+
+  uint32_t firstSegment = 0;
+  uint32_t lastSegment = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    unsigned long segment;
+    if (sscanf(entry->d_name, "seg_%08lu.log", &segment) != 1 || segment == 0)
+      continue;
+    if (firstSegment == 0 || segment < firstSegment)
+      firstSegment = segment;
+    if (segment > lastSegment)
+      lastSegment = segment;
+  }
+  closedir(dir);
+
+  if (!LoadCursor())
+  {
+    readSegment = firstSegment > 0 ? firstSegment : 1;
+    readOffset = 0;
+  }
+
+  writeSegment = lastSegment > readSegment ? lastSegment : readSegment;
+
+  bool isTorn = false;
+  writeOffset = ScanSegment(writeSegment, &isTorn);
+  if (isTorn)
+  {
+    FTP_LOGWARN1("Spool: Torn record at the end of segment ", writeSegment);
+    writeSegment++;
+    writeOffset = 0;
+  }
+
+  replayPending = false;
+  ready = true;
+  pendingBytes = CountPendingBytes();
+
+  FTP_LOGINFO3("Spool: Read segment ", readSegment, ", write segment ", writeSegment);
+  return true;
+}
+
+/**
+ * @brief Append one text line for filePath to the spool.
+ *
+ * Lines longer than FTP_SPOOL_LINE_MAX are refused, Replay() could not hand them to the client's append buffer.
+ */
+bool M5_Ethernet_FtpSpool::Write(const char *filePath, const char *textLine, size_t lineLength)
+{
+  size_t pathLength = strlen(filePath);
+  if (!ready || pathLength == 0 || pathLength >= FTP_PATH_MAX || lineLength > FTP_SPOOL_LINE_MAX)
+    return false;
+
+  uint32_t recordSize = FTP_SPOOL_RECORD_HEADER + pathLength + lineLength;
+  if (writeOffset > 0 && writeOffset + recordSize > segmentSize)
+  {
+    writeSegment++;
+    writeOffset = 0;
+    if (writeSegment - readSegment + 1 > maxSegments)
+      DropOldestSegment();
+  }
+
+  char segmentPath[FTP_SPOOL_DIR_MAX + 20];
+  SegmentPath(writeSegment, segmentPath, sizeof(segmentPath));
+
+  FILE *file = fopen(segmentPath, "ab");
+  if (file == NULL)
+  {
+    FTP_LOGERROR1("Spool: Can not open ", segmentPath);
+    return false;
+  }
+
+  uint8_t header[FTP_SPOOL_RECORD_HEADER] = {FTP_SPOOL_RECORD_MAGIC, (uint8_t)pathLength, (uint8_t)(lineLength & 0xFF), (uint8_t)(lineLength >> 8)};
+  bool success = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                 fwrite(filePath, 1, pathLength, file) == pathLength &&
+                 fwrite(textLine, 1, lineLength, file) == lineLength;
+  success = fclose(file) == 0 && success;
+
+  if (!success)
+  {
+    // The segment may end in a partial record now, keep it closed for writing
+    FTP_LOGERROR1("Spool: Write failed on ", segmentPath);
+    writeSegment++;
+    writeOffset = 0;
+    pendingBytes = CountPendingBytes();
+    return false;
+  }
+
+  writeOffset += recordSize;
+  pendingBytes += recordSize;
+  return true;
+}
+
+bool M5_Ethernet_FtpSpool::Write(const char *filePath, const char *textLine)
+{
+  return Write(filePath, textLine, strlen(textLine));
+}
+
+/**
+ * @brief Move spooled lines into the client's append buffers and send them.
+ *
+ * Reads sequentially from the cursor until about maxBytes were taken, then flushes with FlushAppendBuffers().
+ * The cursor is saved only after a successful flush. When the flush fails the lines stay in the client
+ * (which reconciles them with SIZE) and the cursor is saved on the next call once they went out.
+ * @return Number of records taken from the spool.
+ */
+uint32_t M5_Ethernet_FtpSpool::Replay(M5_Ethernet_FtpClient &ftp, uint32_t maxBytes)
+{
+  if (!ready || !ftp.isConnected())
+    return 0;
+
+  if (replayPending)
+  {
+    if (ftp.isErrorCode(ftp.FlushAppendBuffers()))
+      return 0;
+    CommitPending();
+  }
+
+  uint32_t segment = readSegment;
+  uint32_t offset = readOffset;
+  uint32_t records = 0;
+  uint32_t bytes = 0;
+  FILE *file = NULL;
+
+  char filePath[FTP_PATH_MAX];
+
+  while (bytes < maxBytes && !(segment == writeSegment && offset >= writeOffset))
+  {
+    if (file == NULL)
+    {
+      char segmentPath[FTP_SPOOL_DIR_MAX + 20];
+      SegmentPath(segment, segmentPath, sizeof(segmentPath));
+      file = fopen(segmentPath, "rb");
+      if (file == NULL || fseek(file, offset, SEEK_SET) != 0)
+      {
+        if (file != NULL)
+          fclose(file);
+        file = NULL;
+        if (segment >= writeSegment)
+          break;
+
+        // Missing segment, continue with the next one
+        segment++;
+        offset = 0;
+        replayPending = true;
+        pendingSegment = segment;
+        pendingOffset = offset;
+        continue;
+      }
+    }
+
+    uint8_t header[FTP_SPOOL_RECORD_HEADER];
+    size_t lineLength = 0;
+    bool isSkipped = false;
+    bool isRecord = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+                    header[0] == FTP_SPOOL_RECORD_MAGIC && header[1] > 0 && header[1] < FTP_PATH_MAX;
+    if (isRecord)
+    {
+      lineLength = header[2] | (header[3] << 8);
+      if (lineLength > sizeof(textLine))
+      {
+        // Written before Write() had the limit, it can never be queued
+        isSkipped = true;
+        isRecord = fseek(file, header[1] + lineLength, SEEK_CUR) == 0;
+      }
+      else
+        isRecord = fread(filePath, 1, header[1], file) == header[1] &&
+                   fread(textLine, 1, lineLength, file) == lineLength;
+    }
+
+    if (!isRecord)
+    {
+      fclose(file);
+      file = NULL;
+      if (segment >= writeSegment)
+        break;
+
+      // End of a closed segment, a torn tail is skipped as well
+      segment++;
+      offset = 0;
+      replayPending = true;
+      pendingSegment = segment;
+      pendingOffset = offset;
+      continue;
+    }
+
+    if (!isSkipped)
+    {
+      filePath[header[1]] = '\0';
+      uint16_t responseCode = ftp.QueueTextLine(filePath, textLine, lineLength);
+      if (ftp.isErrorCode(responseCode))
+      {
+        // Transient failures and a lost connection are retried on the next call
+        if (responseCode < 500 || !ftp.isConnected())
+          break;
+
+        // Refused for good (e.g. 553, FTP_RESCODE_COMMAND_TOO_LONG), retrying it would stall the spool
+        FTP_LOGERROR3("Spool: Record refused, skipped, reply ", responseCode, " for ", filePath);
+        isSkipped = true;
+      }
+    }
+
+    uint32_t recordSize = FTP_SPOOL_RECORD_HEADER + header[1] + lineLength;
+    offset += recordSize;
+    bytes += recordSize;
+    if (isSkipped)
+      droppedRecords++;
+    else
+      records++;
+
+    replayPending = true;
+    pendingSegment = segment;
+    pendingOffset = offset;
+  }
+
+  if (file != NULL)
+    fclose(file);
+
+  if (replayPending && !ftp.isErrorCode(ftp.FlushAppendBuffers()))
+    CommitPending();
+
+  if (records > 0)
+    FTP_LOGINFO3("Spool: Replayed ", records, " records, bytes ", bytes);
+
+  return records;
+}
+
+/////////////////////////////////////////////
+
+bool M5_Ethernet_FtpSpool::isReady()
+{
+  return ready;
+}
+
+bool M5_Ethernet_FtpSpool::isEmpty()
+{
+  return !ready || (readSegment == writeSegment && readOffset >= writeOffset);
+}
+
+/**
+ * @brief Bytes in the spool that were not confirmed by the server yet, as of the last Write() or Replay().
+ */
+uint32_t M5_Ethernet_FtpSpool::GetPendingBytes()
+{
+  return pendingBytes;
+}
+
+/**
+ * @brief Size of the segments from the cursor on; walks the file system, so only the owning task calls it.
+ */
+uint32_t M5_Ethernet_FtpSpool::CountPendingBytes()
+{
+  if (isEmpty())
+    return 0;
+
+  uint32_t total = 0;
+  for (uint32_t segment = readSegment; segment < writeSegment; segment++)
+  {
+    char segmentPath[FTP_SPOOL_DIR_MAX + 20];
+    SegmentPath(segment, segmentPath, sizeof(segmentPath));
+    struct stat info;
+    if (stat(segmentPath, &info) == 0)
+      total += info.st_size;
+  }
+  total += writeOffset;
+
+  return total > readOffset ? total - readOffset : 0;
+}
+
+uint32_t M5_Ethernet_FtpSpool::GetDroppedSegments()
+{
+  return droppedSegments;
+}
+
+uint32_t M5_Ethernet_FtpSpool::GetDroppedRecords()
+{
+  return droppedRecords;
+}
+
+/////////////////////////////////////////////
+
+void M5_Ethernet_FtpSpool::SegmentPath(uint32_t segment, char *buffer, size_t size)
+{
+  snprintf(buffer, size, "%s/seg_%08lu.log", baseDir, (unsigned long)segment);
+}
+
+void M5_Ethernet_FtpSpool::CursorPath(char *buffer, size_t size, bool temporary)
+{
+  snprintf(buffer, size, temporary ? "%s/cursor.tmp" : "%s/cursor", baseDir);
+}
+
+/**
+ * @brief Read the cursor file, or its temporary copy if a SaveCursor() was cut short.
+ */
+bool M5_Ethernet_FtpSpool::LoadCursor()
+{
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    char cursorPath[FTP_SPOOL_DIR_MAX + 12];
+    CursorPath(cursorPath, sizeof(cursorPath), i == 1);
+
+    FILE *file = fopen(cursorPath, "r");
+    if (file == NULL)
+      continue;
+
+    unsigned long segment, offset;
+    int count = fscanf(file, "%lu %lu", &segment, &offset);
+    fclose(file);
+
+    if (count == 2 && segment > 0)
+    {
+      readSegment = segment;
+      readOffset = offset;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Write the cursor to a temporary file and rename it over the old one.
+ */
+bool M5_Ethernet_FtpSpool::SaveCursor(uint32_t segment, uint32_t offset)
+{
+  char cursorPath[FTP_SPOOL_DIR_MAX + 12];
+  char tempPath[FTP_SPOOL_DIR_MAX + 12];
+  CursorPath(cursorPath, sizeof(cursorPath), false);
+  CursorPath(tempPath, sizeof(tempPath), true);
+
+  FILE *file = fopen(tempPath, "w");
+  if (file == NULL)
+  {
+    FTP_LOGERROR1("Spool: Can not open ", tempPath);
+    return false;
+  }
+
+  bool success = fprintf(file, "%lu %lu\n", (unsigned long)segment, (unsigned long)offset) > 0 && fflush(file) == 0;
+  fsync(fileno(file));
+  success = fclose(file) == 0 && success;
+
+  // FAT does not replace an existing file on rename, LoadCursor() falls back to the temporary file
+  if (success && rename(tempPath, cursorPath) != 0)
+  {
+    remove(cursorPath);
+    success = rename(tempPath, cursorPath) == 0;
+  }
+
+  if (!success)
+    FTP_LOGERROR("Spool: Saving the cursor failed");
+
+  return success;
+}
+
+/**
+ * @brief Walk the records of a segment and return the offset after the last complete one.
+ */
+uint32_t M5_Ethernet_FtpSpool::ScanSegment(uint32_t segment, bool *isTorn)
+{
+  *isTorn = false;
+
+  char segmentPath[FTP_SPOOL_DIR_MAX + 20];
+  SegmentPath(segment, segmentPath, sizeof(segmentPath));
+  FILE *file = fopen(segmentPath, "rb");
+  if (file == NULL)
+    return 0;
+
+  fseek(file, 0, SEEK_END);
+  long fileSize = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  uint32_t offset = 0;
+  uint8_t header[FTP_SPOOL_RECORD_HEADER];
+  while ((long)offset < fileSize)
+  {
+    uint32_t bodySize = 0;
+    bool isRecord = (long)(offset + sizeof(header)) <= fileSize &&
+                    fread(header, 1, sizeof(header), file) == sizeof(header) &&
+                    header[0] == FTP_SPOOL_RECORD_MAGIC && header[1] > 0;
+    if (isRecord)
+    {
+      bodySize = header[1] + (header[2] | (header[3] << 8));
+      isRecord = (long)(offset + sizeof(header) + bodySize) <= fileSize && fseek(file, bodySize, SEEK_CUR) == 0;
+    }
+
+    if (!isRecord)
+    {
+      *isTorn = true;
+      break;
+    }
+
+    offset += sizeof(header) + bodySize;
+  }
+
+  fclose(file);
+  return offset;
+}
+
+/**
+ * @brief Throw away the oldest segment when the spool reached maxSegments.
+ */
+void M5_Ethernet_FtpSpool::DropOldestSegment()
+{
+  char segmentPath[FTP_SPOOL_DIR_MAX + 20];
+  SegmentPath(readSegment, segmentPath, sizeof(segmentPath));
+  remove(segmentPath);
+
+  FTP_LOGWARN1("Spool: Full, dropped segment ", readSegment);
+  droppedSegments++;
+
+  readSegment++;
+  readOffset = 0;
+  if (replayPending && pendingSegment < readSegment)
+    replayPending = false;
+
+  SaveCursor(readSegment, readOffset);
+  pendingBytes = CountPendingBytes();
+}
+
+/**
+ * @brief Save the cursor after a successful replay and delete the segments it left behind.
+ *
+ * When everything was sent the current segment is deleted too and writing starts in a fresh one.
+ */
+void M5_Ethernet_FtpSpool::CommitPending()
+{
+  replayPending = false;
+
+  uint32_t segment = pendingSegment;
+  uint32_t offset = pendingOffset;
+  bool isDrained = segment == writeSegment && offset >= writeOffset && writeOffset > 0;
+  if (isDrained)
+  {
+    writeSegment++;
+    writeOffset = 0;
+    segment = writeSegment;
+    offset = 0;
+  }
+
+  if (!SaveCursor(segment, offset))
+    return;
+
+  for (uint32_t consumed = readSegment; consumed < segment; consumed++)
+  {
+    char segmentPath[FTP_SPOOL_DIR_MAX + 20];
+    SegmentPath(consumed, segmentPath, sizeof(segmentPath));
+    remove(segmentPath);
+  }
+
+  readSegment = segment;
+  readOffset = offset;
+  pendingBytes = CountPendingBytes();
+}
\ No newline at end of file
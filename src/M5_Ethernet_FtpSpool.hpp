@@ -0,0 +1,100 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <atomic>
+#include "M5_Ethernet_FtpClient.hpp"
+
+#ifndef M5_Ethernet_FtpSpool_H
+#define M5_Ethernet_FtpSpool_H
+
+#define FTP_SPOOL_SEGMENT_SIZE 65536UL
+#define FTP_SPOOL_MAX_SEGMENTS 16
+#define FTP_SPOOL_REPLAY_BYTES 16384UL
+#define FTP_SPOOL_DIR_MAX 48
+#define FTP_SPOOL_RECORD_MAGIC 0xA5
+#define FTP_SPOOL_RECORD_HEADER 4
+#define FTP_SPOOL_LINE_MAX (FTP_APPEND_BUFFER_SIZE - 2) // Longest line kept, with CR/LF it fills one append buffer
+
+/**
+ * @brief Store-and-forward spool for text lines that could not be sent to the FTP server.
+ *
+ * Lines are appended to segment files (seg_00000001.log, ...) in a local directory, for example
+ * "/littlefs/spool" or "/sd/spool" on the device, or any plain directory on a host build.
+ * Each record is [0xA5][path length][line length, 2 bytes LE][path][line].
+ * The read position is kept in the file "cursor", which is replaced by rename so it is never half written.
+ * Replay() moves records into the client's append buffers and advances the cursor only after they were flushed.
+ * A record the server refuses for good (5xx) is skipped and counted, so one bad line does not hold up the rest.
+ *
+ * Begin(), Write() and Replay() have to be called from one task, the uploader's. GetPendingBytes() and the
+ * dropped counters only read values that task publishes, so /metrics can call them from another one.
+ */
+class M5_Ethernet_FtpSpool
+{
+private:
+  char baseDir[FTP_SPOOL_DIR_MAX];
+  uint32_t segmentSize;
+  uint16_t maxSegments;
+
+  uint32_t readSegment;
+  uint32_t readOffset;
+  uint32_t writeSegment;
+  uint32_t writeOffset;
+
+  bool replayPending;
+  uint32_t pendingSegment;
+  uint32_t pendingOffset;
+
+  std::atomic<uint32_t> pendingBytes; // CountPendingBytes() after the last change of the cursor or a segment
+  std::atomic<uint32_t> droppedSegments;
+  std::atomic<uint32_t> droppedRecords;
+  std::atomic<bool> ready;
+
+  char textLine[FTP_SPOOL_LINE_MAX]; // Replay() reads one line at a time into here
+
+  void SegmentPath(uint32_t segment, char *buffer, size_t size);
+  void CursorPath(char *buffer, size_t size, bool temporary);
+  bool LoadCursor();
+  bool SaveCursor(uint32_t segment, uint32_t offset);
+  uint32_t ScanSegment(uint32_t segment, bool *isTorn);
+  uint32_t CountPendingBytes();
+  void DropOldestSegment();
+  void CommitPending();
+
+public:
+  M5_Ethernet_FtpSpool(const char *_baseDir, uint32_t _segmentSize = FTP_SPOOL_SEGMENT_SIZE, uint16_t _maxSegments = FTP_SPOOL_MAX_SEGMENTS);
+
+  bool Begin();
+  bool Write(const char *filePath, const char *textLine, size_t lineLength);
+  bool Write(const char *filePath, const char *textLine);
+  uint32_t Replay(M5_Ethernet_FtpClient &ftp, uint32_t maxBytes = FTP_SPOOL_REPLAY_BYTES);
+
+  bool isReady(); // Begin() succeeded
+  bool isEmpty();
+  uint32_t GetPendingBytes();
+  uint32_t GetDroppedSegments();
+  uint32_t GetDroppedRecords();
+};
+
+#endif
\ No newline at end of file
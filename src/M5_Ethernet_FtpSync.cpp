@@ -0,0 +1,319 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "M5_Ethernet_FtpSync.hpp"
+
+/// @brief State of one isRemoteTailEqual() download
+struct FtpSyncCompare
+{
+  const uint8_t *expected;
+  size_t length;
+  size_t position;
+  bool isEqual;
+};
+
+static bool CompareTail(void *context, const uint8_t *data, size_t length)
+{
+  FtpSyncCompare *compare = (FtpSyncCompare *)context;
+  if (compare->position + length > compare->length || memcmp(compare->expected + compare->position, data, length) != 0)
+  {
+    compare->isEqual = false;
+    return false;
+  }
+  compare->position += length;
+  return true;
+}
+
+M5_Ethernet_FtpSync::M5_Ethernet_FtpSync()
+{
+  remoteCount = 0;
+  isListed = false;
+  isComplete = false;
+  flags = FTP_SYNC_DEFAULT;
+  file = NULL;
+}
+
+/////////////////////////////////////////////
+
+/**
+ * @brief Upload the regular files of localDir that remoteDir does not have yet or has in an older version.
+ *
+ * A file that fails is counted in filesFailed and the run goes on with the next one, unless the command
+ * connection was lost. The remote directory is created when it is missing.
+ *
+ * @param stats receives file and byte counts of this run, may be NULL
+ * @param syncFlags FTP_SYNC_USE_TIME and FTP_SYNC_RESUME
+ * @return FTP_RESCODE_ACTION_SUCCESS, or the reply of the last failure
+ */
+uint16_t M5_Ethernet_FtpSync::Sync(M5_Ethernet_FtpClient &ftp, const char *localDir, const char *remoteDir,
+                                   FtpSyncStats *stats, uint8_t syncFlags)
+{
+  FtpSyncStats runStats;
+  if (stats == NULL)
+    stats = &runStats;
+  memset(stats, 0, sizeof(FtpSyncStats));
+
+  if (!ftp.isConnected())
+    return FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+
+  unsigned long startMillis = millis();
+  flags = syncFlags;
+
+  uint16_t responseCode = ListRemote(ftp, remoteDir);
+  if (ftp.isErrorCode(responseCode))
+    return responseCode;
+
+  DIR *dir = opendir(localDir);
+  if (dir == NULL)
+  {
+    FTP_LOGERROR1("Sync: Can not open ", localDir);
+    return FTP_RESCODE_FILE_UNAVAILABLE;
+  }
+
+  size_t localLength = strlen(localDir);
+  size_t remoteLength = strlen(remoteDir);
+  const char *localSeparator = localLength > 0 && localDir[localLength - 1] == '/' ? "" : "/";
+  const char *remoteSeparator = remoteLength > 0 && remoteDir[remoteLength - 1] == '/' ? "" : "/";
+
+  uint16_t result = FTP_RESCODE_ACTION_SUCCESS;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] == '.')
+      continue;
+
+    char localPath[FTP_PATH_MAX];
+    char remotePath[FTP_PATH_MAX];
+    if (snprintf(localPath, sizeof(localPath), "%s%s%s", localDir, localSeparator, entry->d_name) >= (int)sizeof(localPath) ||
+        snprintf(remotePath, sizeof(remotePath), "%s%s%s", remoteDir, remoteSeparator, entry->d_name) >= (int)sizeof(remotePath))
+    {
+      FTP_LOGWARN1("Sync: Path too long, skipped ", entry->d_name);
+      stats->filesFailed++;
+      continue;
+    }
+
+    struct stat info;
+    if (stat(localPath, &info) != 0 || !S_ISREG(info.st_mode))
+      continue;
+
+    responseCode = SyncFile(ftp, entry->d_name, localPath, remotePath, info.st_size, info.st_mtime, stats);
+    if (ftp.isErrorCode(responseCode))
+    {
+      FTP_LOGERROR3("Sync: Upload of ", entry->d_name, " failed, reply ", responseCode);
+      stats->filesFailed++;
+      result = responseCode;
+      if (!ftp.isConnected())
+        break;
+    }
+  }
+  closedir(dir);
+
+  stats->elapsedMs = millis() - startMillis;
+  FTP_LOGINFO3("Sync: Uploaded files =", stats->filesUploaded, ", skipped files =", stats->filesSkipped);
+  return result;
+}
+
+/**
+ * @brief Compare one local file with the server's copy and upload it, or its missing tail, when they differ.
+ */
+uint16_t M5_Ethernet_FtpSync::SyncFile(M5_Ethernet_FtpClient &ftp, const char *name, const char *localPath, const char *remotePath,
+                                       uint64_t localSize, uint32_t localModify, FtpSyncStats *stats)
+{
+  bool exists = false;
+  uint64_t remoteSize = 0;
+  uint32_t remoteModify = 0;
+  uint16_t responseCode = FindRemote(ftp, name, remotePath, &exists, &remoteSize, &remoteModify);
+  if (ftp.isErrorCode(responseCode))
+    return responseCode;
+
+  uint64_t offset = 0;
+  if (exists)
+  {
+    bool isNewer = (flags & FTP_SYNC_USE_TIME) && remoteModify != 0 && localModify > remoteModify + FTP_SYNC_TIME_SLACK_S;
+    if (remoteSize == localSize && !isNewer)
+    {
+      FTP_LOGDEBUG1("Sync: Unchanged ", name);
+      stats->filesSkipped++;
+      stats->bytesSkipped += localSize;
+      return FTP_RESCODE_ACTION_SUCCESS;
+    }
+
+    if ((flags & FTP_SYNC_RESUME) && remoteSize < localSize)
+      offset = remoteSize;
+  }
+
+  file = fopen(localPath, "rb");
+  if (file == NULL)
+    return FTP_RESCODE_FILE_UNAVAILABLE;
+
+  if (offset > 0 && !isRemoteTailEqual(ftp, remotePath, offset))
+  {
+    FTP_LOGWARN1("Sync: Remote copy differs, uploading again ", name);
+    offset = 0;
+  }
+
+  if (!ftp.isConnected() || fseek(file, (long)offset, SEEK_SET) != 0)
+  {
+    fclose(file);
+    file = NULL;
+    return ftp.isConnected() ? FTP_RESCODE_FILE_UNAVAILABLE : FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  FtpTransferStats transfer;
+  memset(&transfer, 0, sizeof(transfer));
+  responseCode = ftp.UploadStream(remotePath, ReadFile, this, &transfer, offset > 0);
+  fclose(file);
+  file = NULL;
+  if (ftp.isErrorCode(responseCode))
+    return responseCode;
+
+  FTP_LOGINFO3("Sync: Uploaded ", name, ", bytes =", transfer.bytes);
+  stats->filesUploaded++;
+  stats->bytesUploaded += transfer.bytes;
+  stats->bytesSkipped += offset;
+  return responseCode;
+}
+
+/**
+ * @brief Check that the server's copy ends with the same bytes the open local file has at that position.
+ *
+ * Only the last FTP_SYNC_RESUME_CHECK bytes are downloaded (REST), so appending to a rewritten file is caught
+ * for the price of one small transfer.
+ */
+bool M5_Ethernet_FtpSync::isRemoteTailEqual(M5_Ethernet_FtpClient &ftp, const char *remotePath, uint64_t remoteSize)
+{
+  uint32_t start = remoteSize > FTP_SYNC_RESUME_CHECK ? (uint32_t)(remoteSize - FTP_SYNC_RESUME_CHECK) : 0;
+  size_t length = (size_t)(remoteSize - start);
+  if (fseek(file, (long)start, SEEK_SET) != 0 || fread(buffer, 1, length, file) != length)
+    return false;
+
+  FtpSyncCompare compare = {buffer, length, 0, true};
+  uint16_t responseCode = ftp.DownloadStream(remotePath, CompareTail, &compare, &start);
+  return !ftp.isErrorCode(responseCode) && compare.isEqual && compare.position == length;
+}
+
+/**
+ * @brief Fill the remote table from one MLSD of remoteDir.
+ *
+ * Without a listing (no MLSD, or the directory does not exist yet) the table stays empty, FindRemote() asks
+ * per file, and the directory is created.
+ */
+uint16_t M5_Ethernet_FtpSync::ListRemote(M5_Ethernet_FtpClient &ftp, const char *remoteDir)
+{
+  remoteCount = 0;
+  isListed = false;
+  isComplete = true;
+
+  uint16_t responseCode = ftp.ListDir(remoteDir, CollectEntry, this);
+  if (!ftp.isErrorCode(responseCode))
+  {
+    isListed = true;
+    return responseCode;
+  }
+
+  if (!ftp.isConnected() || responseCode == FTP_RESCODE_CLIENT_ISNOT_CONNECTED)
+    return responseCode;
+
+  FTP_LOGWARN1("Sync: No MLSD listing, asking per file, reply ", responseCode);
+  return ftp.MakeDirRecursive(remoteDir);
+}
+
+bool M5_Ethernet_FtpSync::CollectEntry(void *context, const FtpListEntry &entry)
+{
+  M5_Ethernet_FtpSync *sync = (M5_Ethernet_FtpSync *)context;
+  if (entry.type != FTP_ENTRY_FILE || entry.isTruncated)
+    return true; // Files with names that long are asked for by FindRemote()
+
+  if (sync->remoteCount >= FTP_SYNC_REMOTE_MAX)
+  {
+    sync->isComplete = false;
+    return true;
+  }
+
+  FtpSyncEntry *remote = &sync->remote[sync->remoteCount++];
+  memcpy(remote->name, entry.name, sizeof(remote->name));
+  remote->size = entry.size;
+  remote->modify = entry.modify;
+  return true;
+}
+
+/**
+ * @brief Look up a file in the remote table, or ask the server with SIZE and MDTM when the table can not tell.
+ */
+uint16_t M5_Ethernet_FtpSync::FindRemote(M5_Ethernet_FtpClient &ftp, const char *name, const char *remotePath,
+                                         bool *exists, uint64_t *size, uint32_t *modify)
+{
+  *exists = false;
+  *size = 0;
+  *modify = 0;
+
+  if (isListed && strlen(name) < FTP_LIST_NAME_MAX)
+  {
+    for (uint16_t i = 0; i < remoteCount; i++)
+    {
+      if (strcmp(remote[i].name, name) == 0)
+      {
+        *exists = true;
+        *size = remote[i].size;
+        *modify = remote[i].modify;
+        return FTP_RESCODE_ACTION_SUCCESS;
+      }
+    }
+
+    if (isComplete)
+      return FTP_RESCODE_ACTION_SUCCESS;
+  }
+
+  uint32_t remoteSize = 0;
+  uint16_t responseCode = ftp.GetFileSize(remotePath, &remoteSize);
+  if (responseCode != FTP_RESCODE_FILE_STATUS)
+  {
+    // 550 and servers without SIZE: upload the file, STOR reports it when that fails too
+    return ftp.isConnected() ? FTP_RESCODE_ACTION_SUCCESS : FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+  }
+
+  *exists = true;
+  *size = remoteSize;
+  if (flags & FTP_SYNC_USE_TIME)
+    ftp.GetLastModifiedTime(remotePath, modify);
+
+  return ftp.isConnected() ? FTP_RESCODE_ACTION_SUCCESS : FTP_RESCODE_CLIENT_ISNOT_CONNECTED;
+}
+
+/**
+ * @brief FtpReadCallback for UploadStream(), hands out the open file FTP_SYNC_READ_SIZE bytes at a time.
+ */
+int M5_Ethernet_FtpSync::ReadFile(void *context, const uint8_t **data)
+{
+  M5_Ethernet_FtpSync *sync = (M5_Ethernet_FtpSync *)context;
+  size_t length = fread(sync->buffer, 1, sizeof(sync->buffer), sync->file);
+  if (length == 0 && ferror(sync->file))
+    return -1;
+
+  *data = sync->buffer;
+  return (int)length;
+}
\ No newline at end of file
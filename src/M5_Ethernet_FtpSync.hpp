@@ -0,0 +1,101 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include "M5_Ethernet_FtpClient.hpp"
+
+#ifndef M5_Ethernet_FtpSync_H
+#define M5_Ethernet_FtpSync_H
+
+#define FTP_SYNC_REMOTE_MAX 64    // Remote files remembered from one MLSD, the rest are asked for with SIZE/MDTM
+#define FTP_SYNC_READ_SIZE 2048   // Local file reads, one W5500 TX window
+#define FTP_SYNC_TIME_SLACK_S 2   // FAT keeps modification times in 2 s steps
+#define FTP_SYNC_RESUME_CHECK 256 // Bytes before the resume point compared with the server's copy
+
+#define FTP_SYNC_USE_TIME 0x01 // Upload again when the local file is newer than the remote copy
+#define FTP_SYNC_RESUME 0x02   // Append only the missing tail when the remote copy is shorter
+#define FTP_SYNC_DEFAULT (FTP_SYNC_USE_TIME | FTP_SYNC_RESUME)
+
+/// @brief Result of one Sync() run
+struct FtpSyncStats
+{
+  uint32_t filesUploaded; // Uploaded whole or resumed
+  uint32_t filesSkipped;  // Already on the server
+  uint32_t filesFailed;
+  uint64_t bytesUploaded;
+  uint64_t bytesSkipped; // Includes the part of resumed files that was on the server before
+  uint32_t elapsedMs;
+};
+
+/// @brief Size and modification time of one remote file, from MLSD
+struct FtpSyncEntry
+{
+  char name[FTP_LIST_NAME_MAX];
+  uint64_t size;
+  uint32_t modify;
+};
+
+/**
+ * @brief Mirror the files of a local directory, for example "/sd/capture", to a remote directory.
+ *
+ * The remote directory is listed once with MLSD and only new or changed files are uploaded, so a run after a
+ * partial failure costs little more than the listing. Servers without MLSD are asked per file with SIZE and MDTM.
+ * Subdirectories are not descended into.
+ *
+ * A file counts as changed when its size differs or, with FTP_SYNC_USE_TIME, when it was modified after the
+ * server's copy. Servers record the upload time, so the device clock has to be set (NTP) and close to the server's.
+ * With FTP_SYNC_RESUME a remote copy shorter than the local file is completed with APPE, which suits capture files
+ * that only grow. The last FTP_SYNC_RESUME_CHECK bytes of the remote copy are downloaded and compared first,
+ * a file that was rewritten is uploaded again.
+ *
+ * The remote table and the read buffer take about 11 KB, keep the object static.
+ */
+class M5_Ethernet_FtpSync
+{
+private:
+  FtpSyncEntry remote[FTP_SYNC_REMOTE_MAX];
+  uint16_t remoteCount;
+  bool isListed;   // remote holds the MLSD listing
+  bool isComplete; // and every file of it
+  uint8_t flags;
+
+  FILE *file;
+  uint8_t buffer[FTP_SYNC_READ_SIZE];
+
+  static bool CollectEntry(void *context, const FtpListEntry &entry);
+  static int ReadFile(void *context, const uint8_t **data);
+  bool isRemoteTailEqual(M5_Ethernet_FtpClient &ftp, const char *remotePath, uint64_t remoteSize);
+  uint16_t ListRemote(M5_Ethernet_FtpClient &ftp, const char *remoteDir);
+  uint16_t FindRemote(M5_Ethernet_FtpClient &ftp, const char *name, const char *remotePath, bool *exists, uint64_t *size, uint32_t *modify);
+  uint16_t SyncFile(M5_Ethernet_FtpClient &ftp, const char *name, const char *localPath, const char *remotePath,
+                    uint64_t localSize, uint32_t localModify, FtpSyncStats *stats);
+
+public:
+  M5_Ethernet_FtpSync();
+
+  uint16_t Sync(M5_Ethernet_FtpClient &ftp, const char *localDir, const char *remoteDir,
+                FtpSyncStats *stats = NULL, uint8_t syncFlags = FTP_SYNC_DEFAULT);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <Arduino.h>
+#include "M5_Ethernet_FtpTransport.hpp"
+
+#ifdef ESP32
+static SemaphoreHandle_t EthernetMutex()
+{
+  static SemaphoreHandle_t mutex = xSemaphoreCreateRecursiveMutex();
+  return mutex;
+}
+
+void FtpEthernetLock::Lock()
+{
+  xSemaphoreTakeRecursive(EthernetMutex(), portMAX_DELAY);
+}
+
+void FtpEthernetLock::Unlock()
+{
+  xSemaphoreGiveRecursive(EthernetMutex());
+}
+#else
+static std::recursive_mutex ethernetMutex;
+
+void FtpEthernetLock::Lock()
+{
+  ethernetMutex.lock();
+}
+
+void FtpEthernetLock::Unlock()
+{
+  ethernetMutex.unlock();
+}
+#endif
+
+/////////////////////////////////////////////
+
+bool FtpEthernetTransport::Connect(const char *host, uint16_t port, uint16_t timeoutMs)
+{
+  FtpEthernetGuard guard;
+#if ((ESP32) && !FTP_CLIENT_USING_ETHERNET)
+  return client.connect(host, port, timeoutMs);
+#else
+  client.setConnectionTimeout(timeoutMs);
+  return client.connect(host, port);
+#endif
+}
+
+bool FtpEthernetTransport::Connect(IPAddress address, uint16_t port, uint16_t timeoutMs)
+{
+  FtpEthernetGuard guard;
+#if ((ESP32) && !FTP_CLIENT_USING_ETHERNET)
+  return client.connect(address, port, timeoutMs);
+#else
+  client.setConnectionTimeout(timeoutMs);
+  return client.connect(address, port);
+#endif
+}
+
+/**
+ * @brief Hand the bytes to the socket; the W5500 library spins on SPI until they fit, so the caller keeps
+ * them within AvailableForWrite().
+ */
+size_t FtpEthernetTransport::Write(const uint8_t *buffer, size_t size)
+{
+  FtpEthernetGuard guard;
+#if FTP_CLIENT_USING_QNETHERNET
+  return client.writeFully(buffer, size);
+#else
+  return client.write(buffer, size);
+#endif
+}
+
+bool FtpEthernetTransport::isConnected()
+{
+  FtpEthernetGuard guard;
+  return client.connected();
+}
+
+void FtpEthernetTransport::Stop()
+{
+  FtpEthernetGuard guard;
+  client.stop();
+}
+
+int FtpEthernetTransport::Available()
+{
+  FtpEthernetGuard guard;
+  return client.available();
+}
+
+int FtpEthernetTransport::Read(uint8_t *buffer, size_t size)
+{
+  FtpEthernetGuard guard;
+  return client.read(buffer, size);
+}
+
+int FtpEthernetTransport::AvailableForWrite()
+{
+  FtpEthernetGuard guard;
+  return client.availableForWrite();
+}
+
+IPAddress FtpEthernetTransport::RemoteIP()
+{
+  FtpEthernetGuard guard;
+  return client.remoteIP();
+}
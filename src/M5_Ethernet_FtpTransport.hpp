@@ -0,0 +1,102 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <Arduino.h>
+#include <M5_Ethernet.h>
+
+#ifndef ESP32
+#include <mutex>
+#endif
+
+#ifndef M5_Ethernet_FtpTransport_H
+#define M5_Ethernet_FtpTransport_H
+
+/**
+ * @brief Serializes every use of the W5500 across tasks.
+ *
+ * SPI.beginTransaction() in the Ethernet library only guards single register accesses; the socket table,
+ * socketBegin() and the RX/TX pointer bookkeeping assume one caller. FtpEthernetTransport holds this lock
+ * for each call, any other task holds it (FtpEthernetGuard) around its own Ethernet, EthernetClient and
+ * EthernetUDP use. The lock is recursive, so a guarded block may call into the FTP client.
+ */
+class FtpEthernetLock
+{
+public:
+  static void Lock();
+  static void Unlock();
+};
+
+/// @brief Holds FtpEthernetLock until it goes out of scope
+class FtpEthernetGuard
+{
+public:
+  FtpEthernetGuard() { FtpEthernetLock::Lock(); }
+  ~FtpEthernetGuard() { FtpEthernetLock::Unlock(); }
+};
+
+/**
+ * @brief One TCP stream of the FTP client, the command or the data connection.
+ *
+ * Read() never blocks and returns 0 or less when nothing has arrived. Write() may take less than it was
+ * given, the caller retries the rest once AvailableForWrite() reports room again. isConnected() stays
+ * true while received data is still unread, so a reply sent just before the server closes is not lost.
+ */
+class FtpTransport
+{
+public:
+  virtual ~FtpTransport() {}
+
+  virtual bool Connect(const char *host, uint16_t port, uint16_t timeoutMs) = 0;
+  virtual bool Connect(IPAddress address, uint16_t port, uint16_t timeoutMs) = 0;
+  virtual bool isConnected() = 0;
+  virtual void Stop() = 0;
+  virtual int Available() = 0;
+  virtual int Read(uint8_t *buffer, size_t size) = 0;
+  virtual int AvailableForWrite() = 0;
+  virtual size_t Write(const uint8_t *buffer, size_t size) = 0;
+  virtual IPAddress RemoteIP() = 0;
+};
+
+/**
+ * @brief EthernetClient of the W5500 library (or WiFiClient / QNEthernet, see the build flags).
+ *
+ * Each call holds FtpEthernetLock, Connect() for the whole handshake.
+ */
+class FtpEthernetTransport : public FtpTransport
+{
+private:
+  EthernetClient client;
+
+public:
+  bool Connect(const char *host, uint16_t port, uint16_t timeoutMs);
+  bool Connect(IPAddress address, uint16_t port, uint16_t timeoutMs);
+  bool isConnected();
+  void Stop();
+  int Available();
+  int Read(uint8_t *buffer, size_t size);
+  int AvailableForWrite();
+  size_t Write(const uint8_t *buffer, size_t size);
+  IPAddress RemoteIP();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,261 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include "M5_Ethernet_FtpUploader.hpp"
+
+#ifndef ESP32
+#include <thread>
+#endif
+
+FtpRecordQueue::FtpRecordQueue() : head(0), tail(0)
+{
+}
+
+/**
+ * @brief Copy a record into the next free slot. Producer side only.
+ *
+ * @return false when the ring is full or the record does not fit into a slot
+ */
+bool FtpRecordQueue::Push(const char *path, const char *line, size_t length)
+{
+  size_t pathLength = strlen(path);
+  if (pathLength >= FTP_PATH_MAX || length > FTP_RECORD_LINE_MAX)
+    return false;
+
+  uint32_t currentHead = head.load(std::memory_order_relaxed);
+  if (currentHead - tail.load(std::memory_order_acquire) >= FTP_RECORD_QUEUE_SIZE)
+    return false;
+
+  FtpRecord *record = &slots[currentHead & (FTP_RECORD_QUEUE_SIZE - 1)];
+  memcpy(record->path, path, pathLength + 1);
+  memcpy(record->line, line, length);
+  record->length = length;
+
+  head.store(currentHead + 1, std::memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Oldest record, or NULL when the ring is empty. Consumer side only.
+ */
+FtpRecord *FtpRecordQueue::Front()
+{
+  uint32_t currentTail = tail.load(std::memory_order_relaxed);
+  if (currentTail == head.load(std::memory_order_acquire))
+    return NULL;
+
+  return &slots[currentTail & (FTP_RECORD_QUEUE_SIZE - 1)];
+}
+
+/**
+ * @brief Release the slot returned by Front() to the producer.
+ */
+void FtpRecordQueue::Pop()
+{
+  tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+uint32_t FtpRecordQueue::GetDepth()
+{
+  return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+/////////////////////////////////////////////
+
+M5_Ethernet_FtpUploader::M5_Ethernet_FtpUploader(M5_Ethernet_FtpClient &_ftp, M5_Ethernet_FtpSpool *_spool)
+    : ftp(_ftp), spool(_spool), droppedCount(0), rejectedCount(0), storedCount(0), maxDepth(0), stopRequested(false), isRunning(false)
+{
+  ftpReady = false;
+}
+
+/**
+ * @brief Start the uploader task, pinned to core (the Arduino loop() runs on core 1).
+ *
+ * The FTP client reaches the W5500 only through FtpEthernetTransport, which holds FtpEthernetLock for each
+ * call. Code on other tasks that uses Ethernet, EthernetClient or EthernetUDP must hold FtpEthernetGuard
+ * while it does, otherwise both cores change the socket state of the library at once.
+ */
+bool M5_Ethernet_FtpUploader::Begin(int core, unsigned int priority)
+{
+  if (isRunning)
+    return true;
+
+  stopRequested = false;
+  isRunning = true;
+
+#ifdef ESP32
+  if (xTaskCreatePinnedToCore(TaskEntry, "FtpUploader", FTP_UPLOADER_STACK_SIZE, this, priority, NULL, core) != pdPASS)
+  {
+    FTP_LOGERROR("Uploader: Task creation failed");
+    isRunning = false;
+    return false;
+  }
+#else
+  (void)core;
+  (void)priority;
+  std::thread(TaskEntry, this).detach();
+#endif
+
+  return true;
+}
+
+/**
+ * @brief Stop the task after it has handed out the queued records, then close the session.
+ */
+void M5_Ethernet_FtpUploader::End(unsigned long waitMs)
+{
+  if (!isRunning)
+  {
+    ftp.CloseConnection();
+    return;
+  }
+
+  stopRequested = true;
+  unsigned long startMillis = millis();
+  while (isRunning && millis() - startMillis < waitMs)
+    delay(FTP_UPLOADER_IDLE_MS);
+}
+
+/**
+ * @brief Queue a line for filePath. Never blocks; when the ring is full the record is counted as dropped.
+ */
+bool M5_Ethernet_FtpUploader::Push(const char *filePath, const char *textLine, size_t lineLength)
+{
+  if (!queue.Push(filePath, textLine, lineLength))
+  {
+    droppedCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  uint32_t depth = queue.GetDepth();
+  if (depth > maxDepth.load(std::memory_order_relaxed))
+    maxDepth.store(depth, std::memory_order_relaxed);
+
+  return true;
+}
+
+bool M5_Ethernet_FtpUploader::Push(const char *filePath, const char *textLine)
+{
+  return Push(filePath, textLine, strlen(textLine));
+}
+
+uint32_t M5_Ethernet_FtpUploader::GetDepth()
+{
+  return queue.GetDepth();
+}
+
+uint32_t M5_Ethernet_FtpUploader::GetMaxDepth()
+{
+  return maxDepth.load(std::memory_order_relaxed);
+}
+
+uint32_t M5_Ethernet_FtpUploader::GetDroppedCount()
+{
+  return droppedCount.load(std::memory_order_relaxed);
+}
+
+uint32_t M5_Ethernet_FtpUploader::GetRejectedCount()
+{
+  return rejectedCount.load(std::memory_order_relaxed);
+}
+
+uint32_t M5_Ethernet_FtpUploader::GetStoredCount()
+{
+  return storedCount.load(std::memory_order_relaxed);
+}
+
+/////////////////////////////////////////////
+
+void M5_Ethernet_FtpUploader::TaskEntry(void *parameter)
+{
+  ((M5_Ethernet_FtpUploader *)parameter)->Run();
+
+#ifdef ESP32
+  vTaskDelete(NULL);
+#endif
+}
+
+void M5_Ethernet_FtpUploader::Run()
+{
+  while (!stopRequested)
+    Step();
+
+  // Hand out what is still queued, CloseConnection() flushes the append buffers
+  Step();
+  ftp.CloseConnection();
+  isRunning = false;
+}
+
+/**
+ * @brief One pass of the uploader task: check the session, move queued records on, flush what is due.
+ *
+ * Records go to the client while the server is reachable and nothing is spooled, otherwise to the spool
+ * so the order is kept. Without a spool, or with one whose Begin() failed, they wait in the ring until
+ * the server is back.
+ */
+void M5_Ethernet_FtpUploader::Step()
+{
+  // While the server is down EnsureSession() returns at once until its reconnect backoff has passed
+  ftpReady = !ftp.isErrorCode(ftp.EnsureSession());
+  M5_Ethernet_FtpSpool *store = spool != NULL && spool->isReady() ? spool : NULL;
+
+  uint32_t taken = 0;
+  FtpRecord *record;
+  while ((record = queue.Front()) != NULL)
+  {
+    bool isStored;
+    if (store != NULL && (!ftpReady || !store->isEmpty()))
+    {
+      isStored = store->Write(record->path, record->line, record->length);
+    }
+    else if (ftpReady)
+    {
+      isStored = !ftp.isErrorCode(ftp.QueueTextLine(record->path, record->line, record->length)) ||
+                 (store != NULL && store->Write(record->path, record->line, record->length));
+    }
+    else
+    {
+      break;
+    }
+
+    if (isStored)
+      storedCount.fetch_add(1, std::memory_order_relaxed);
+    else
+      rejectedCount.fetch_add(1, std::memory_order_relaxed);
+
+    queue.Pop();
+    taken++;
+  }
+
+  if (ftpReady)
+  {
+    if (store != NULL)
+      store->Replay(ftp);
+    ftp.FlushAppendBuffers(false);
+  }
+
+  if (taken == 0)
+    delay(FTP_UPLOADER_IDLE_MS);
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <atomic>
+#include "M5_Ethernet_FtpClient.hpp"
+#include "M5_Ethernet_FtpSpool.hpp"
+
+#ifndef M5_Ethernet_FtpUploader_H
+#define M5_Ethernet_FtpUploader_H
+
+#define FTP_RECORD_QUEUE_SIZE 32     // Slots in the ring, must be a power of two
+#define FTP_RECORD_LINE_MAX 128      // Longest line a record holds
+#define FTP_UPLOADER_STACK_SIZE 8192
+#define FTP_UPLOADER_IDLE_MS 10      // Sleep of the uploader task while the queue is empty
+
+/// @brief One text line waiting to be appended to a remote file
+struct FtpRecord
+{
+  char path[FTP_PATH_MAX];
+  uint16_t length;
+  char line[FTP_RECORD_LINE_MAX];
+};
+
+/**
+ * @brief Lock-free ring for one producer and one consumer, records are copied into fixed slots.
+ *
+ * head is only written by the producer and tail only by the consumer; acquire/release ordering on them
+ * publishes the slot contents, so neither side ever blocks or allocates.
+ */
+class FtpRecordQueue
+{
+private:
+  FtpRecord slots[FTP_RECORD_QUEUE_SIZE];
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+
+public:
+  FtpRecordQueue();
+
+  bool Push(const char *path, const char *line, size_t length);
+  FtpRecord *Front();
+  void Pop();
+  uint32_t GetDepth();
+};
+
+/**
+ * @brief Runs the blocking FTP work in its own task so a slow server does not stall loop().
+ *
+ * loop() calls Push() for each record; the uploader task appends them with QueueTextLine(),
+ * keeps the session alive and flushes. While the server is unreachable records go to the spool if one is set and ready.
+ * After Begin() the client must only be used through this class, and other W5500 users hold FtpEthernetGuard.
+ */
+class M5_Ethernet_FtpUploader
+{
+private:
+  M5_Ethernet_FtpClient &ftp;
+  M5_Ethernet_FtpSpool *spool;
+  FtpRecordQueue queue;
+
+  std::atomic<uint32_t> droppedCount;  // Push() found the ring full
+  std::atomic<uint32_t> rejectedCount; // Neither the client nor the spool took the record
+  std::atomic<uint32_t> storedCount;
+  std::atomic<uint32_t> maxDepth;
+  std::atomic<bool> stopRequested;
+  std::atomic<bool> isRunning;
+
+  bool ftpReady;
+
+  static void TaskEntry(void *parameter);
+  void Run();
+  void Step();
+
+public:
+  M5_Ethernet_FtpUploader(M5_Ethernet_FtpClient &_ftp, M5_Ethernet_FtpSpool *_spool = NULL);
+
+  bool Begin(int core = 0, unsigned int priority = 1);
+  void End(unsigned long waitMs = FTP_TIMEOUT_MS);
+  bool Push(const char *filePath, const char *textLine, size_t lineLength);
+  bool Push(const char *filePath, const char *textLine);
+
+  uint32_t GetDepth();
+  uint32_t GetMaxDepth();
+  uint32_t GetDroppedCount();
+  uint32_t GetRejectedCount();
+  uint32_t GetStoredCount(); // Records handed to the client or the spool
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "M5_Ethernet_Metrics.hpp"
+
+// Upper bounds of the histogram buckets, the last bucket takes everything above
+static const uint32_t bucketBoundsMicros[METRICS_HISTOGRAM_BUCKETS - 1] = {
+    500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+static const char *const bucketLabels[METRICS_HISTOGRAM_BUCKETS] = {
+    "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "10", "+Inf"};
+
+void MetricsHistogram::Observe(uint32_t micros)
+{
+  uint8_t index = 0;
+  while (index < METRICS_HISTOGRAM_BUCKETS - 1 && micros > bucketBoundsMicros[index])
+    index++;
+
+  buckets[index]++;
+  count++;
+  sumMicros += micros;
+}
+
+/////////////////////////////////////////////
+
+MetricsWriter::MetricsWriter(Print &_out) : out(_out)
+{
+}
+
+void MetricsWriter::Header(const char *name, const char *type, const char *help)
+{
+  out.print("# HELP ");
+  out.print(name);
+  out.print(' ');
+  out.print(help);
+  out.print("\n# TYPE ");
+  out.print(name);
+  out.print(' ');
+  out.print(type);
+  out.print('\n');
+}
+
+void MetricsWriter::WriteName(const char *name, const char *suffix, const char *labels, const char *extraLabel)
+{
+  out.print(name);
+  out.print(suffix);
+
+  bool hasLabels = labels != NULL && labels[0] != 0;
+  if (hasLabels || extraLabel != NULL)
+  {
+    out.print('{');
+    if (hasLabels)
+      out.print(labels);
+    if (hasLabels && extraLabel != NULL)
+      out.print(',');
+    if (extraLabel != NULL)
+      out.print(extraLabel);
+    out.print('}');
+  }
+  out.print(' ');
+}
+
+void MetricsWriter::Value(const char *name, uint64_t value, const char *labels)
+{
+  char number[24];
+  snprintf(number, sizeof(number), "%llu\n", (unsigned long long)value);
+  WriteName(name, "", labels);
+  out.print(number);
+}
+
+/**
+ * @brief Write the _bucket, _sum and _count lines of one histogram, in seconds.
+ */
+void MetricsWriter::Histogram(const char *name, const MetricsHistogram &histogram, const char *labels)
+{
+  char line[32];
+  uint32_t cumulative = 0;
+  for (uint8_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+  {
+    cumulative += histogram.buckets[i];
+    snprintf(line, sizeof(line), "le=\"%s\"", bucketLabels[i]);
+    WriteName(name, "_bucket", labels, line);
+    snprintf(line, sizeof(line), "%lu\n", (unsigned long)cumulative);
+    out.print(line);
+  }
+
+  WriteName(name, "_sum", labels);
+  snprintf(line, sizeof(line), "%llu.%06llu\n", (unsigned long long)(histogram.sumMicros / 1000000), (unsigned long long)(histogram.sumMicros % 1000000));
+  out.print(line);
+
+  WriteName(name, "_count", labels);
+  snprintf(line, sizeof(line), "%lu\n", (unsigned long)cumulative); // Same as +Inf even mid-update
+  out.print(line);
+}
\ No newline at end of file
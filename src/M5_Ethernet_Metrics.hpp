@@ -0,0 +1,67 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+
+#ifndef M5_Ethernet_Metrics_H
+#define M5_Ethernet_Metrics_H
+
+#define METRICS_HISTOGRAM_BUCKETS 15 // 14 bounds from 500 us to 10 s, then +Inf
+
+/**
+ * @brief Latency histogram with fixed bucket bounds, no allocation.
+ *
+ * Updated by the task that owns the client and read by the HTTP handler without a lock;
+ * a scrape taken during an update may see _sum one observation ahead of the buckets.
+ */
+struct MetricsHistogram
+{
+  uint32_t buckets[METRICS_HISTOGRAM_BUCKETS]; // Per bucket, not cumulative
+  uint32_t count;
+  uint64_t sumMicros;
+
+  void Observe(uint32_t micros);
+};
+
+/**
+ * @brief Writes metrics in the Prometheus text exposition format (version 0.0.4).
+ *
+ * Header() once per metric name, then one Value() or Histogram() per label set.
+ * labels is the inside of the braces, e.g. `verb="STOR"`, or NULL.
+ */
+class MetricsWriter
+{
+private:
+  Print &out;
+  void WriteName(const char *name, const char *suffix, const char *labels, const char *extraLabel = NULL);
+
+public:
+  MetricsWriter(Print &_out);
+
+  void Header(const char *name, const char *type, const char *help);
+  void Value(const char *name, uint64_t value, const char *labels = NULL);
+  void Histogram(const char *name, const MetricsHistogram &histogram, const char *labels = NULL);
+};
+
+#endif
\ No newline at end of file
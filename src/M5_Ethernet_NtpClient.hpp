@@ -1,11 +1,14 @@
 #include <M5Unified.h>
 #include <M5_Ethernet.h>
 #include <time.h>
+#include "M5_Ethernet_Metrics.hpp"
+#include "M5_Ethernet_FtpTransport.hpp"
 
 #ifndef M5_Ethernet_NtpClient_H
 #define M5_Ethernet_NtpClient_H
 
 #define NTP_PACKET_SIZE 48 // NTP time stamp is in the first 48 bytes of the message
+#define NTP_REPLY_TIMEOUT_MS 1000
 
 class M5_Ethernet_NtpClient
 {
@@ -15,6 +18,7 @@ public:
     EthernetUDP Udp;
     byte packetBuffer[NTP_PACKET_SIZE]; // buffer to hold incoming and outgoing packets
     void sendNTPpacket(const char *address);
+    bool receivePacket();
 
     unsigned long lastEpoch = 0;
     unsigned long lastMillis = 0;
@@ -23,9 +27,17 @@ public:
 
     int timezoneOffset = +9;
 
+    uint32_t requestCount = 0;
+    uint32_t timeoutCount = 0;
+    MetricsHistogram roundTrip = {}; // From sending the request to reading the reply
+
     void begin();
     String getTime(String address);
     String getTime(String address, int timezoneOffset);
+    bool update(const char *address);
+    size_t getTime(const char *address, char *buffer, size_t size);
+    bool readDateTime(struct tm *dateTime);
+    void writeMetrics(MetricsWriter &writer);
 
     String readYear();
     String readMonth();
@@ -37,8 +49,10 @@ public:
 
 M5_Ethernet_NtpClient NtpClient;
 
+// Every Udp call holds FtpEthernetGuard on its own, so the FTP uploader task gets the W5500 between them
 void M5_Ethernet_NtpClient::begin()
 {
+    FtpEthernetGuard guard;
     Udp.begin(localPort);
 }
 
@@ -50,42 +64,88 @@ String M5_Ethernet_NtpClient::getTime(String address)
 String M5_Ethernet_NtpClient::getTime(String address, int timezone)
 {
     timezoneOffset = timezone;
+
+    char buffer[30];
+    if (getTime(address.c_str(), buffer, sizeof(buffer)) > 0)
+        return String(buffer);
+
+    return String("Failed to get time");
+}
+
+// query the server when the last sync is older than Interval; returns false while no time is known
+bool M5_Ethernet_NtpClient::update(const char *address)
+{
     if ((lastEpoch == 0 || (millis() - lastMillis) > Interval * 1000 && (millis() - intMillis) > Interval * 1000))
     {
-        sendNTPpacket(address.c_str());
-        delay(1000);
-        if (Udp.parsePacket())
+        sendNTPpacket(address);
+        requestCount++;
+
+        // Wait for the reply instead of a fixed second, so the round trip can be measured
+        unsigned long sentMicros = micros();
+        bool isReceived;
+        while (!(isReceived = receivePacket()) && micros() - sentMicros < NTP_REPLY_TIMEOUT_MS * 1000UL)
+            delay(1);
+
+        if (isReceived)
         {
-            Udp.read(packetBuffer, NTP_PACKET_SIZE); // read the packet into the buffer
+            roundTrip.Observe(micros() - sentMicros);
+
             unsigned long highWord = word(packetBuffer[40], packetBuffer[41]);
             unsigned long lowWord = word(packetBuffer[42], packetBuffer[43]);
             unsigned long secsSince1900 = highWord << 16 | lowWord;
             const unsigned long seventyYears = 2208988800UL;
             unsigned long epoch = secsSince1900 - seventyYears;
             epoch += timezoneOffset * 3600;
-            
+
             lastEpoch = epoch;
             lastMillis = millis();
             intMillis = millis();
-
-            // create a time string
-            char buffer[30];
-            sprintf(buffer, "%02d:%02d:%02d", (epoch % 86400L) / 3600, (epoch % 3600) / 60, epoch % 60);
-            return String(buffer);
+            return true;
         }
+        timeoutCount++;
         intMillis = millis();
     }
 
+    return lastEpoch != 0;
+}
+
+// write "HH:MM:SS" into buffer without heap allocation; returns the length, 0 when no time is known
+size_t M5_Ethernet_NtpClient::getTime(const char *address, char *buffer, size_t size)
+{
+    if (!update(address))
+        return 0;
+
+    unsigned long currentEpoch = lastEpoch + ((millis() - lastMillis) / 1000);
+    int length = snprintf(buffer, size, "%02d:%02d:%02d", (int)((currentEpoch % 86400L) / 3600), (int)((currentEpoch % 3600) / 60), (int)(currentEpoch % 60));
+    return length > 0 ? length : 0;
+}
+
+// current local date and time; returns false when no time is known
+bool M5_Ethernet_NtpClient::readDateTime(struct tm *dateTime)
+{
+    if (lastEpoch == 0)
+        return false;
+
+    time_t currentEpoch = lastEpoch + ((millis() - lastMillis) / 1000);
+    gmtime_r(&currentEpoch, dateTime);
+    return true;
+}
+
+// request, timeout and round trip counters, plus the age of the last sync once there is one
+void M5_Ethernet_NtpClient::writeMetrics(MetricsWriter &writer)
+{
+    writer.Header("ntp_requests_total", "counter", "NTP requests sent.");
+    writer.Value("ntp_requests_total", requestCount);
+    writer.Header("ntp_timeouts_total", "counter", "NTP requests without a reply.");
+    writer.Value("ntp_timeouts_total", timeoutCount);
+    writer.Header("ntp_round_trip_seconds", "histogram", "Time from sending a request to its reply.");
+    writer.Histogram("ntp_round_trip_seconds", roundTrip);
+
     if (lastEpoch != 0)
     {
-        unsigned long currentEpoch = lastEpoch + ((millis() - lastMillis) / 1000);
-        
-        // create a time string
-        char buffer[30];
-        sprintf(buffer, "%02d:%02d:%02d", (currentEpoch % 86400L) / 3600, (currentEpoch % 3600) / 60, currentEpoch % 60);
-        return String(buffer);
+        writer.Header("ntp_last_sync_age_seconds", "gauge", "Seconds since the clock was last set from the server.");
+        writer.Value("ntp_last_sync_age_seconds", (millis() - lastMillis) / 1000);
     }
-    return String("Failed to get time");
 }
 
 // send an NTP request to the time server at the given address
@@ -105,11 +165,23 @@ void M5_Ethernet_NtpClient::sendNTPpacket(const char *address)
 
     // all NTP fields have been given values, now
     // you can send a packet requesting a timestamp:
+    FtpEthernetGuard guard;
     Udp.beginPacket(address, 123); // NTP requests are to port 123
     Udp.write(packetBuffer, NTP_PACKET_SIZE);
     Udp.endPacket();
 }
 
+// read a waiting reply into packetBuffer; false when none has arrived
+bool M5_Ethernet_NtpClient::receivePacket()
+{
+    FtpEthernetGuard guard;
+    if (Udp.parsePacket() <= 0)
+        return false;
+
+    Udp.read(packetBuffer, NTP_PACKET_SIZE);
+    return true;
+}
+
 String M5_Ethernet_NtpClient::readYear()
 {
     if (lastEpoch != 0)
@@ -4,9 +4,13 @@
 #include <time.h>
 #include <M5_Ethernet.h>
 #include <EEPROM.h>
+#include <LittleFS.h>
 
 #include "M5_Ethernet_FtpClient.hpp"
 #include "M5_Ethernet_NtpClient.hpp"
+#include "M5_Ethernet_FtpSpool.hpp"
+#include "M5_Ethernet_FtpPool.hpp"
+#include "M5_Ethernet_FtpUploader.hpp"
 
 // == M5Basic_Bus ==
 /*#define SCK  18
@@ -37,6 +41,24 @@
 
 #define STORE_DATA_SIZE 64 // byte
 
+// W5500 memory per socket as the Ethernet library derives it (SSIZE in utility/w5100.h), see platformio.ini
+#if defined(ETHERNET_LARGE_BUFFERS) && MAX_SOCK_NUM <= 1
+#define SOCKET_BUFFER_SIZE 16384
+#elif defined(ETHERNET_LARGE_BUFFERS) && MAX_SOCK_NUM <= 2
+#define SOCKET_BUFFER_SIZE 8192
+#elif defined(ETHERNET_LARGE_BUFFERS) && MAX_SOCK_NUM <= 4
+#define SOCKET_BUFFER_SIZE 4096
+#else
+#define SOCKET_BUFFER_SIZE 2048
+#endif
+
+#if defined(ETHERNET_LARGE_BUFFERS) && MAX_SOCK_NUM > 4
+#warning "ETHERNET_LARGE_BUFFERS has no effect with more than 4 sockets, set MAX_SOCK_NUM in platformio.ini"
+#endif
+
+#define LOG_DRAIN_SERIAL 1 // Tokenized builds print log entries on Serial from loop(); 0 leaves them for GET /log
+#define LOG_DRAIN_BYTES 8192 // Entry bytes printed per loop() pass, a full default ring, so Serial keeps up at debug level
+
 // Enter a MAC address and IP address for your controller below.
 // The IP address will be dependent on your local network:
 byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED};
@@ -57,11 +79,20 @@ String ftp_newDirName = "/dataDir";
 
 M5_Ethernet_FtpClient ftp(ftp_address, ftp_user, ftp_pass, 60000);
 
+/// @brief Lines that could not be sent wait here until the server is back
+M5_Ethernet_FtpSpool spool("/littlefs/spool");
+
+/// @brief Sends the lines from its own task on core 0, so a stalled server does not hold up loop()
+M5_Ethernet_FtpUploader uploader(ftp, &spool);
+
 String ntp_address = "192.168.25.77";
 
 char textArray[] = "textArray";
 
+bool isRestartRequested = false; // Set by HTTPUI() after a config POST, loop() restarts once the uploader is drained
+
 void HTTPUI();
+void WriteMetrics(Print &out);
 
 /// @brief Encorder Profile Struct
 struct DATA_SET
@@ -112,6 +143,74 @@ String deviceIP_String = "";
 String ftpSrvIP_String = "";
 String ntpSrvIP_String = "";
 
+#ifdef FTP_POOL_BENCHMARK
+// Build with -D FTP_POOL_BENCHMARK to compare pooled upload throughput for 1, 2 and 3 sessions
+#define BENCH_FILES 6
+#define BENCH_FILE_SIZE 65536UL
+
+M5_Ethernet_FtpClient ftp2(ftp_address, ftp_user, ftp_pass, 60000);
+M5_Ethernet_FtpClient ftp3(ftp_address, ftp_user, ftp_pass, 60000);
+
+uint8_t benchPattern[1024]; // Filled by RunPoolBenchmark()
+
+struct BenchSource
+{
+  uint32_t remaining;
+};
+
+int BenchRead(void *context, const uint8_t **span)
+{
+  BenchSource *source = (BenchSource *)context;
+  if (source->remaining == 0)
+    return 0;
+
+  int length = source->remaining < sizeof(benchPattern) ? source->remaining : sizeof(benchPattern);
+  source->remaining -= length;
+  *span = benchPattern;
+  return length;
+}
+
+void RunPoolBenchmark()
+{
+  for (size_t i = 0; i < sizeof(benchPattern); i++)
+    benchPattern[i] = 'A' + i % 26;
+
+  M5_Ethernet_FtpClient *clients[] = {&ftp, &ftp2, &ftp3};
+  for (uint8_t sessions = 1; sessions <= 3; sessions++)
+  {
+    M5_Ethernet_FtpPool pool(clients, sessions);
+    if (ftp.isErrorCode(pool.Open()))
+    {
+      Serial.println("Benchmark: login failed");
+      return;
+    }
+
+    BenchSource sources[BENCH_FILES];
+    for (uint8_t i = 0; i < BENCH_FILES; i++)
+    {
+      FtpPath path;
+      path.Append("/bench_").AppendNumber(i, 2).Append(".bin");
+      if (path.isOverflow())
+      {
+        Serial.println("Benchmark: path too long");
+        return;
+      }
+      sources[i].remaining = BENCH_FILE_SIZE;
+      pool.Enqueue(path.c_str(), BenchRead, &sources[i]);
+    }
+
+    FtpTransferStats stats;
+    pool.Run(&stats);
+    Serial.printf("Benchmark: %u session(s) %lu bytes in %lu ms = %lu bytes/s, failed %lu\n", sessions,
+                  (unsigned long)stats.bytes, (unsigned long)stats.elapsedMs, (unsigned long)stats.bytesPerSecond,
+                  (unsigned long)pool.GetFailedCount());
+  }
+
+  ftp2.CloseConnection();
+  ftp3.CloseConnection();
+}
+#endif
+
 void setup()
 {
   // Open serial communications and wait for port to open:
@@ -132,32 +231,75 @@ void setup()
 
   Serial.print("server is at ");
   Serial.println(Ethernet.localIP());
+  Serial.printf("W5500: %d sockets, %d bytes TX and RX each\n", MAX_SOCK_NUM, SOCKET_BUFFER_SIZE);
 
   draw_Title();
 
   NtpClient.begin();
+  NtpClient.timezoneOffset = +9;
+
+  ftp.SetLazyMakeDir(true);
+  ftp.SetCompression(true); // MODE Z when the server offers it
+
+  // Without a spool the uploader keeps records in its ring while the server is down
+  if (!LittleFS.begin(true) || !spool.Begin())
+    Serial.println("Spool is not available");
+
+#ifdef FTP_POOL_BENCHMARK
+  RunPoolBenchmark();
+#endif
+
+  uploader.Begin(0);
 }
 
 void loop()
 {
   M5.Display.setCursor(0, 12);
 
-  String timeLine = NtpClient.getTime(ntp_address, +9);
-  String YYYY = NtpClient.readYear();
-  String MM = NtpClient.readMonth();
-  String DD = NtpClient.readDay();
-  String HH = NtpClient.readHour();
+  char timeLine[16];
+  struct tm now;
+  // NtpClient locks the W5500 per UDP call, the uploader task gets it while the reply is awaited
+  if (NtpClient.getTime(ntp_address.c_str(), timeLine, sizeof(timeLine)) > 0 && NtpClient.readDateTime(&now))
+  {
+    M5.Display.println(timeLine);
+    Serial.println(timeLine);
+
+    // "/<device>/YYYY/YYYYMM/YYYYMMDD/YYYYMMDD_HH.txt" built in place, no String temporaries
+    FtpPath path;
+    path.Append('/').Append(deviceName.c_str());
+    path.Append('/').AppendNumber(now.tm_year + 1900, 4);
+    path.Append('/').AppendNumber(now.tm_year + 1900, 4).AppendNumber(now.tm_mon + 1, 2);
+    path.Append('/').AppendNumber(now.tm_year + 1900, 4).AppendNumber(now.tm_mon + 1, 2).AppendNumber(now.tm_mday, 2);
+    path.Append('/').AppendNumber(now.tm_year + 1900, 4).AppendNumber(now.tm_mon + 1, 2).AppendNumber(now.tm_mday, 2);
+    path.Append('_').AppendNumber(now.tm_hour, 2).Append(".txt");
+
+    // A truncated path would name another file, drop the line instead
+    if (path.isOverflow())
+      Serial.println("Log path longer than FTP_PATH_MAX, line dropped: " + deviceName);
+    else
+      uploader.Push(path.c_str(), timeLine);
+  }
+  else
+  {
+    M5.Display.println("Failed to get time");
+  }
 
-  M5.Display.println(timeLine);
-  Serial.println(timeLine);
+  HTTPUI();
+  {
+    FtpEthernetGuard guard;
+    Ethernet.maintain();
+  }
 
-  ftp.OpenConnection();
-  ftp.MakeDirRecursive("/" + deviceName + "/" + YYYY + "/" + YYYY + MM + "/" + YYYY + MM + DD);
-  ftp.AppendTextLine("/" + deviceName + "/" + YYYY + "/" + YYYY + MM + "/" + YYYY + MM + DD + "/" + YYYY + MM + DD + "_" + HH + ".txt", timeLine);
-  ftp.CloseConnection();
+  if (isRestartRequested)
+  {
+    uploader.End(); // Drain queued and buffered lines before the restart
+    delay(1000);
+    ESP.restart();
+  }
 
-  HTTPUI();
-  Ethernet.maintain();
+#if FTP_LOG_TOKENIZED && LOG_DRAIN_SERIAL
+  FtpLog.Dump(Serial, LOG_DRAIN_BYTES); // Decode the capture with tools/ftp_log_decode.cpp
+#endif
 
   delay(1000);
 }
@@ -190,6 +332,7 @@ void loop()
 
 void HTTPUI()
 {
+  FtpEthernetGuard guard; // The uploader task shares the W5500, see M5_Ethernet_FtpUploader::Begin()
   EthernetClient client = server.available();
   if (client)
   {
@@ -197,6 +340,8 @@ void HTTPUI()
     boolean currentLineIsBlank = true;
     String currentLine = "";
     bool isPost = false;
+    bool isMetrics = false;
+    bool isLog = false;
 
     while (client.connected())
     {
@@ -234,10 +379,36 @@ void HTTPUI()
 
             EEPROM.put<DATA_SET>(0, storeData);
             EEPROM.commit();
-            delay(1000);
-            ESP.restart();
+            isRestartRequested = true; // loop() restarts once this guard is gone, End() needs the W5500 too
+            break;
           }
 
+          if (isMetrics)
+          {
+            client.println("HTTP/1.1 200 OK");
+            client.println("Content-Type: text/plain; version=0.0.4");
+            client.println("Connection: close");
+            client.println();
+            WriteMetrics(client);
+            break;
+          }
+
+#if FTP_LOG_TOKENIZED
+          if (isLog)
+          {
+            client.println("HTTP/1.1 200 OK");
+            client.println("Content-Type: application/octet-stream");
+            client.println("Connection: close");
+            client.println();
+
+            uint8_t entries[512];
+            size_t length;
+            while ((length = FtpLog.Read(entries, sizeof(entries))) > 0)
+              client.write(entries, length);
+            break;
+          }
+#endif
+
           client.println("HTTP/1.1 200 OK");
           client.println("Content-Type: text/html");
           client.println("Connection: close");
@@ -288,6 +459,21 @@ void HTTPUI()
         {
           isPost = true;
         }
+        if (currentLine.startsWith("GET /metrics"))
+        {
+          isMetrics = true;
+        }
+        if (currentLine.startsWith("GET /log"))
+        {
+          isLog = true;
+        }
+      }
+      else
+      {
+        // Let the uploader task at the W5500 while the browser is still sending
+        FtpEthernetLock::Unlock();
+        delay(1);
+        FtpEthernetLock::Lock();
       }
     }
     delay(1);
@@ -295,3 +481,35 @@ void HTTPUI()
     Serial.println("client disconnected");
   }
 }
+
+/// @brief Prometheus text for GET /metrics: FTP and NTP clients, uploader queue and spool
+void WriteMetrics(Print &out)
+{
+  MetricsWriter writer(out);
+  ftp.WriteMetrics(writer);
+  NtpClient.writeMetrics(writer);
+
+  writer.Header("uploader_queue_depth", "gauge", "Records waiting for the uploader task.");
+  writer.Value("uploader_queue_depth", uploader.GetDepth());
+  writer.Header("uploader_queue_max_depth", "gauge", "Highest queue depth seen.");
+  writer.Value("uploader_queue_max_depth", uploader.GetMaxDepth());
+  writer.Header("uploader_dropped_total", "counter", "Records dropped because the queue was full.");
+  writer.Value("uploader_dropped_total", uploader.GetDroppedCount());
+  writer.Header("uploader_rejected_total", "counter", "Records lost because the FTP client and the spool both refused them.");
+  writer.Value("uploader_rejected_total", uploader.GetRejectedCount());
+  writer.Header("uploader_stored_total", "counter", "Records handed to the FTP client or the spool.");
+  writer.Value("uploader_stored_total", uploader.GetStoredCount());
+  writer.Header("spool_pending_bytes", "gauge", "Bytes spooled while the server was unreachable.");
+  writer.Value("spool_pending_bytes", spool.GetPendingBytes());
+  writer.Header("spool_dropped_segments_total", "counter", "Spool segments dropped to stay within the size limit.");
+  writer.Value("spool_dropped_segments_total", spool.GetDroppedSegments());
+  writer.Header("spool_dropped_records_total", "counter", "Spooled lines the server refused for good.");
+  writer.Value("spool_dropped_records_total", spool.GetDroppedRecords());
+
+#if FTP_LOG_TOKENIZED
+  writer.Header("ftp_log_buffered_bytes", "gauge", "Log bytes waiting in the RAM ring.");
+  writer.Value("ftp_log_buffered_bytes", FtpLog.GetUsedBytes());
+  writer.Header("ftp_log_dropped_total", "counter", "Log entries overwritten before they were read.");
+  writer.Value("ftp_log_dropped_total", FtpLog.GetDroppedCount());
+#endif
+}
@@ -0,0 +1,416 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Decode tokenized FTP logs (FTP_LOG_TOKENIZED builds) back into text.
+
+  g++ -std=c++11 -O2 -o ftp_log_decode tools/ftp_log_decode.cpp
+  ./ftp_log_decode log.bin src/M5_Ethernet_*.cpp src/M5_Ethernet_*.hpp
+  ./ftp_log_decode serial.txt src/M5_Ethernet_*.cpp src/M5_Ethernet_*.hpp
+
+The log is either the raw bytes of GET /log or a Serial capture with "FTPLOG <hex>" lines
+from FtpLog.Dump(); other lines of the capture are ignored. The sources must be the ones the
+firmware was built from, since call sites are found by file name and line.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../src/M5_Ethernet_FtpLogFormat.hpp"
+
+/// @brief One FTP_LOG* call found in the sources
+struct CallSite
+{
+  std::string location; // file:line
+  std::string macro;
+  std::vector<std::string> args; // Source text of each argument
+};
+
+static const char *const levelNames[] = {"?", "ERROR", "WARN", "INFO", "DEBUG"};
+
+static bool ReadFile(const char *fileName, std::string *text)
+{
+  FILE *file = fopen(fileName, "rb");
+  if (file == NULL)
+    return false;
+
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    text->append(buffer, length);
+  fclose(file);
+  return true;
+}
+
+/// @brief Skip a "..." or '...' literal starting at pos, return the position after it
+static size_t SkipQuoted(const std::string &text, size_t pos, int *line)
+{
+  char quote = text[pos++];
+  while (pos < text.size() && text[pos] != quote)
+  {
+    if (text[pos] == '\\')
+      pos++;
+    else if (text[pos] == '\n')
+      (*line)++;
+    pos++;
+  }
+  return pos + 1;
+}
+
+/// @brief Argument text as the preprocessor stringifies it: trimmed, whitespace runs as one space
+static std::string NormalizeArg(const std::string &arg)
+{
+  std::string result;
+  bool inSpace = false;
+  for (size_t i = 0; i < arg.size(); i++)
+  {
+    if (isspace((unsigned char)arg[i]))
+    {
+      inSpace = true;
+      continue;
+    }
+    if (inSpace && !result.empty())
+      result += ' ';
+    inSpace = false;
+    result += arg[i];
+  }
+  return result;
+}
+
+/// @brief Contents of "a" "b" or F("a") with escapes resolved
+static std::string LiteralText(const std::string &arg)
+{
+  std::string result;
+  bool inString = false;
+  for (size_t i = 0; i < arg.size(); i++)
+  {
+    char c = arg[i];
+    if (c == '"')
+    {
+      inString = !inString;
+      continue;
+    }
+    if (!inString)
+      continue;
+    if (c == '\\' && i + 1 < arg.size())
+    {
+      c = arg[++i];
+      c = c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c;
+    }
+    result += c;
+  }
+  return result;
+}
+
+static bool IsLogMacro(const std::string &name)
+{
+  static const char *const levels[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+  static const char *const suffixes[] = {"", "_LINE", "0", "1", "2", "3", "5"};
+  if (name == "FTP_LOGDEBUG0m" || name == "FTP_LOGHEXDEBUG1")
+    return true;
+  for (size_t i = 0; i < 4; i++)
+    for (size_t j = 0; j < 7; j++)
+      if (name == std::string("FTP_LOG") + levels[i] + suffixes[j])
+        return true;
+  return false;
+}
+
+/**
+ * @brief Find the FTP_LOG* calls of one source file, keyed by FtpLogHash() of its name and line.
+ *
+ * Comments, #define lines and string literals are skipped; the line is that of the macro name,
+ * which is what __LINE__ gives with GCC for a call spread over several lines.
+ */
+static void ScanSource(const char *fileName, std::map<uint32_t, CallSite> *sites)
+{
+  std::string text;
+  if (!ReadFile(fileName, &text))
+  {
+    fprintf(stderr, "%s: can not open\n", fileName);
+    return;
+  }
+
+  int line = 1;
+  bool isDirective = false;
+  size_t pos = 0;
+  while (pos < text.size())
+  {
+    char c = text[pos];
+    if (c == '\n')
+    {
+      // A directive continues over lines that end with a backslash
+      if (!(pos > 0 && (text[pos - 1] == '\\' || (text[pos - 1] == '\r' && pos > 1 && text[pos - 2] == '\\'))))
+        isDirective = false;
+      line++;
+      pos++;
+    }
+    else if (c == '/' && pos + 1 < text.size() && text[pos + 1] == '/')
+      pos = text.find('\n', pos) == std::string::npos ? text.size() : text.find('\n', pos);
+    else if (c == '/' && pos + 1 < text.size() && text[pos + 1] == '*')
+    {
+      size_t end = text.find("*/", pos + 2);
+      end = end == std::string::npos ? text.size() : end + 2;
+      for (; pos < end; pos++)
+        line += text[pos] == '\n';
+    }
+    else if (c == '"' || c == '\'')
+      pos = SkipQuoted(text, pos, &line);
+    else if (c == '#')
+    {
+      isDirective = true;
+      pos++;
+    }
+    else if (isalpha((unsigned char)c) || c == '_')
+    {
+      size_t start = pos;
+      while (pos < text.size() && (isalnum((unsigned char)text[pos]) || text[pos] == '_'))
+        pos++;
+      std::string name = text.substr(start, pos - start);
+      if (isDirective || !IsLogMacro(name))
+        continue;
+
+      size_t open = pos;
+      while (open < text.size() && isspace((unsigned char)text[open]))
+        open++;
+      if (open >= text.size() || text[open] != '(')
+        continue;
+
+      // Split the arguments at top-level commas
+      CallSite site;
+      site.macro = name;
+      site.location = std::string(fileName) + ":" + std::to_string(line);
+      int callLine = line;
+      int depth = 0;
+      std::string arg;
+      for (pos = open + 1; pos < text.size(); pos++)
+      {
+        char d = text[pos];
+        if (d == '"' || d == '\'')
+        {
+          size_t end = SkipQuoted(text, pos, &line);
+          arg.append(text, pos, end - pos);
+          pos = end - 1;
+          continue;
+        }
+        if (d == '\n')
+          line++;
+        if (d == '(')
+          depth++;
+        else if (d == ')' && depth-- == 0)
+          break;
+        else if (d == ',' && depth == 0)
+        {
+          site.args.push_back(NormalizeArg(arg));
+          arg.clear();
+          continue;
+        }
+        arg += d;
+      }
+      site.args.push_back(NormalizeArg(arg));
+      pos++;
+
+      uint32_t id = FtpLogHash(fileName, callLine);
+      std::map<uint32_t, CallSite>::iterator it = sites->find(id);
+      if (it != sites->end())
+        fprintf(stderr, "%s: same id as %s, entries of both print as the first\n", site.location.c_str(), it->second.location.c_str());
+      else
+        (*sites)[id] = site;
+    }
+    else
+      pos++;
+  }
+}
+
+/// @brief Render one recorded argument, return false when the entry is damaged
+static bool FormatArg(const uint8_t **in, const uint8_t *end, bool hex, std::string *out)
+{
+  if (*in >= end)
+    return false;
+
+  char text[32];
+  uint64_t value;
+  uint8_t type = *(*in)++;
+  switch (type)
+  {
+  case FTP_LOG_ARG_UINT:
+    if (!FtpBinGetVarint(in, end, &value))
+      return false;
+    snprintf(text, sizeof(text), hex ? "%llX" : "%llu", (unsigned long long)value);
+    break;
+  case FTP_LOG_ARG_INT:
+    if (!FtpBinGetVarint(in, end, &value))
+      return false;
+    snprintf(text, sizeof(text), hex ? "%llX" : "%lld", (long long)FtpBinUnZigZag(value));
+    break;
+  case FTP_LOG_ARG_CHAR:
+    if (*in >= end)
+      return false;
+    snprintf(text, sizeof(text), "%c", *(*in)++);
+    break;
+  case FTP_LOG_ARG_STRING:
+  {
+    if (*in >= end || end - *in < 1 + **in)
+      return false;
+    uint8_t length = *(*in)++;
+    out->append((const char *)*in, length);
+    *in += length;
+    return true;
+  }
+  case FTP_LOG_ARG_IP:
+    if (end - *in < 4)
+      return false;
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", (*in)[0], (*in)[1], (*in)[2], (*in)[3]);
+    *in += 4;
+    break;
+  case FTP_LOG_ARG_FLOAT:
+    if (end - *in < 4)
+      return false;
+    snprintf(text, sizeof(text), "%.2f", FtpBinBitsFloat(FtpLogGetLE32(*in)));
+    *in += 4;
+    break;
+  default:
+    return false;
+  }
+
+  out->append(text);
+  return true;
+}
+
+/**
+ * @brief Print one entry the way the printing FTP_LOG* macros would have shown it, prefixed by time and level.
+ */
+static bool DecodeEntry(const uint8_t *entry, size_t length, const std::map<uint32_t, CallSite> &sites)
+{
+  if (length < FTP_LOG_HEADER_SIZE || entry[0] != length)
+    return false;
+
+  uint32_t id = FtpLogGetLE32(entry + 1);
+  uint32_t millis = FtpLogGetLE32(entry + 5);
+  uint8_t level = entry[9] <= 4 ? entry[9] : 0;
+  const uint8_t *in = entry + FTP_LOG_HEADER_SIZE;
+  const uint8_t *end = entry + length;
+
+  std::map<uint32_t, CallSite>::const_iterator it = sites.find(id);
+  std::string text;
+  if (it == sites.end())
+  {
+    // Unknown call site, show the recorded arguments at least
+    char unknown[24];
+    snprintf(unknown, sizeof(unknown), "<%08x>", id);
+    text = unknown;
+    while (in < end)
+    {
+      text += ' ';
+      if (!FormatArg(&in, end, false, &text))
+        return false;
+    }
+    printf("%10u %-5s %s\n", millis, levelNames[level], text.c_str());
+    return true;
+  }
+
+  const CallSite &site = it->second;
+  for (size_t i = 0; i < site.args.size(); i++)
+  {
+    if (i > 0)
+      text += ' ';
+
+    const std::string &arg = site.args[i];
+    if (FtpLogIsLiteral(arg.c_str(), arg.size()))
+      text += LiteralText(arg);
+    else if (!FormatArg(&in, end, site.macro == "FTP_LOGHEXDEBUG1" && i == 1, &text))
+      return false;
+  }
+
+  // Each entry gets its own line, so the line ends that came with a reply are dropped
+  while (!text.empty() && (text[text.size() - 1] == '\n' || text[text.size() - 1] == '\r'))
+    text.erase(text.size() - 1);
+
+  // The 0 variants continue the previous output, the printing macros leave the mark out there
+  bool hasMark = site.macro[site.macro.size() - 1] != '0';
+  printf("%10u %-5s %s%s\n", millis, levelNames[level], hasMark ? "[FTP] " : "", text.c_str());
+  return true;
+}
+
+static int HexValue(char c)
+{
+  return isdigit((unsigned char)c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: %s log.bin|serial.txt source [source ...]\n", argv[0]);
+    return 2;
+  }
+
+  std::map<uint32_t, CallSite> sites;
+  for (int i = 2; i < argc; i++)
+    ScanSource(argv[i], &sites);
+
+  std::string log;
+  if (!ReadFile(argv[1], &log))
+  {
+    fprintf(stderr, "%s: can not open\n", argv[1]);
+    return 2;
+  }
+
+  // A Serial capture carries the entries as hex lines, a GET /log response as raw bytes
+  std::vector<uint8_t> data;
+  if (log.find("FTPLOG ") != std::string::npos)
+  {
+    size_t pos = 0;
+    while ((pos = log.find("FTPLOG ", pos)) != std::string::npos)
+    {
+      pos += 7;
+      int high, low;
+      while (pos + 1 < log.size() && (high = HexValue(log[pos])) >= 0 && (low = HexValue(log[pos + 1])) >= 0)
+      {
+        data.push_back((uint8_t)(high << 4 | low));
+        pos += 2;
+      }
+    }
+  }
+  else
+    data.assign(log.begin(), log.end());
+
+  bool isClean = true;
+  size_t pos = 0;
+  while (pos < data.size())
+  {
+    size_t length = data[pos];
+    if (length < FTP_LOG_HEADER_SIZE || pos + length > data.size() || !DecodeEntry(data.data() + pos, length, sites))
+    {
+      fprintf(stderr, "damaged entry at offset %zu, rest of the log skipped\n", pos);
+      isClean = false;
+      break;
+    }
+    pos += length;
+  }
+
+  return isClean ? 0 : 1;
+}
\ No newline at end of file
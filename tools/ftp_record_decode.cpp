@@ -0,0 +1,149 @@
+/*
+MIT License
+
+Copyright (c) 2024 SmallCodeNote
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Convert binary record files written by QueueRecord()/AppendRecord() to CSV.
+
+  g++ -std=c++11 -O2 -o ftp_record_decode tools/ftp_record_decode.cpp
+  ./ftp_record_decode 20261017_12.bin [more files] > out.csv
+
+Each row is "timestamp_ms,value0,value1,...". A damaged block is reported on stderr and skipped
+up to the next sync header.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "../src/M5_Ethernet_FtpRecordFormat.hpp"
+
+static void PrintRow(uint64_t timestampMs, const uint32_t *bits, uint8_t channels)
+{
+  printf("%llu", (unsigned long long)timestampMs);
+  for (uint8_t i = 0; i < channels; i++)
+    printf(",%.9g", FtpBinBitsFloat(bits[i]));
+  printf("\n");
+}
+
+static bool IsMagic(const std::vector<uint8_t> &data, size_t pos)
+{
+  return pos + sizeof(FTP_BIN_MAGIC) <= data.size() && memcmp(data.data() + pos, FTP_BIN_MAGIC, sizeof(FTP_BIN_MAGIC)) == 0;
+}
+
+/**
+ * @brief Decode the block at pos, return the position after it or 0 when it is damaged.
+ *
+ * Rows are printed only after the whole block decoded and the next sync header (or the end of the file)
+ * follows it, so a damaged block leaves no partial output.
+ */
+static size_t DecodeBlock(const std::vector<uint8_t> &data, size_t pos, uint8_t *lastChannels)
+{
+  const uint8_t *end = data.data() + data.size();
+  const uint8_t *in = data.data() + pos;
+  uint8_t channels;
+  uint64_t timestampMs;
+  uint32_t bits[FTP_BIN_MAX_CHANNELS];
+  uint16_t count = FtpBinReadHeader(in, end, &channels, &timestampMs, bits);
+  if (count == 0)
+    return 0;
+
+  std::vector<uint64_t> timestamps(count);
+  std::vector<uint32_t> values((size_t)count * channels);
+  in += FTP_BIN_HEADER_SIZE(channels);
+  for (uint16_t record = 0; record < count; record++)
+  {
+    if (record > 0 && !FtpBinReadDelta(&in, end, channels, &timestampMs, bits))
+      return 0;
+    timestamps[record] = timestampMs;
+    memcpy(&values[(size_t)record * channels], bits, channels * sizeof(uint32_t));
+  }
+
+  size_t next = in - data.data();
+  if (next < data.size() && !IsMagic(data, next))
+    return 0;
+
+  if (channels != *lastChannels)
+  {
+    printf("timestamp_ms");
+    for (uint8_t i = 0; i < channels; i++)
+      printf(",ch%u", i);
+    printf("\n");
+    *lastChannels = channels;
+  }
+  for (uint16_t record = 0; record < count; record++)
+    PrintRow(timestamps[record], &values[(size_t)record * channels], channels);
+
+  return next;
+}
+
+static bool DecodeFile(const char *fileName, uint8_t *lastChannels)
+{
+  FILE *file = fopen(fileName, "rb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "%s: can not open\n", fileName);
+    return false;
+  }
+
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data.insert(data.end(), buffer, buffer + length);
+  fclose(file);
+
+  bool isClean = true;
+  size_t pos = 0;
+  while (pos < data.size())
+  {
+    size_t next = IsMagic(data, pos) ? DecodeBlock(data, pos, lastChannels) : 0;
+    if (next > 0)
+    {
+      pos = next;
+      continue;
+    }
+
+    fprintf(stderr, "%s: damaged block at offset %zu, searching the next sync header\n", fileName, pos);
+    isClean = false;
+    for (pos++; pos < data.size() && !IsMagic(data, pos); pos++)
+      ;
+  }
+
+  return isClean;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s file.bin [file.bin ...] > out.csv\n", argv[0]);
+    return 2;
+  }
+
+  uint8_t lastChannels = 0;
+  bool isClean = true;
+  for (int i = 1; i < argc; i++)
+    isClean = DecodeFile(argv[i], &lastChannels) && isClean;
+
+  return isClean ? 0 : 1;
+}
\ No newline at end of file
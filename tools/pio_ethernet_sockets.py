@@ -0,0 +1,46 @@
+# PlatformIO pre-build script: lets build_flags choose MAX_SOCK_NUM for the W5500 Ethernet library.
+#
+# The library defines MAX_SOCK_NUM unconditionally in M5_Ethernet.h, so "-D MAX_SOCK_NUM=4" is overridden
+# and ETHERNET_LARGE_BUFFERS keeps splitting the 16 KB socket memory 8 ways (2 KB, as without the flag).
+# This wraps that definition in #ifndef MAX_SOCK_NUM in the downloaded copy under .pio/libdeps. The edit
+# is idempotent and is made again after the library is updated or reinstalled.
+#
+#   [env:...]
+#   extra_scripts = pre:tools/pio_ethernet_sockets.py
+
+import os
+import re
+
+Import("env")
+
+HEADERS = ("M5_Ethernet.h", "Ethernet.h")
+GUARD = "#ifndef MAX_SOCK_NUM // Set by build_flags, see tools/pio_ethernet_sockets.py\n"
+
+# The "#if ... #define MAX_SOCK_NUM 4 #else #define MAX_SOCK_NUM 8 #endif" block of the library,
+# or a single define when a fork simplified it
+BLOCK = re.compile(r"^#if[^\n]*\n(?:(?!#if|#endif)[^\n]*\n)*?#define MAX_SOCK_NUM\b(?:(?!#if|#endif)[^\n]*\n)*?#endif[^\n]*\n", re.M)
+LINE = re.compile(r"^#define MAX_SOCK_NUM\b[^\n]*\n", re.M)
+
+
+def patch_header(path):
+    with open(path, "r", newline="") as file:
+        text = file.read()
+    if "MAX_SOCK_NUM" not in text or GUARD in text:
+        return
+
+    match = BLOCK.search(text) or LINE.search(text)
+    if match is None:
+        print("pio_ethernet_sockets: no MAX_SOCK_NUM definition found in %s" % path)
+        return
+
+    text = text[: match.start()] + GUARD + match.group(0) + "#endif\n" + text[match.end():]
+    with open(path, "w", newline="") as file:
+        file.write(text)
+    print("pio_ethernet_sockets: MAX_SOCK_NUM can now be set by build_flags in %s" % path)
+
+
+libdeps = os.path.join(env.subst("$PROJECT_LIBDEPS_DIR"), env.subst("$PIOENV"))
+for root, _, files in os.walk(libdeps):
+    for name in files:
+        if name in HEADERS:
+            patch_header(os.path.join(root, name))